@@ -0,0 +1,867 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Load generator for ConsoleKit.
+ *
+ * Starts a private dbus-daemon and a ck-bench-daemon on it (a
+ * console-kit-daemon that keeps its files under /tmp/ck-bench and runs
+ * the mock ck-collect-session-info from the build tree), then has a
+ * number of clients open a session through libck-connector, look it
+ * up with GetSessionForUnixProcess, call ListSessions and close it
+ * again, as fast as they can. Throughput and latency percentiles for
+ * each call are written to stdout as a key file.
+ *
+ * Every client is a ck-bench process of its own started with --client,
+ * so that it is the leader of the sessions it opens. For each session
+ * it starts a process with the session's XDG_SESSION_COOKIE, the way
+ * pam_ck_connector sets up a login, and looks that one up.
+ *
+ * The daemon only lets root open sessions, so this has to be run as
+ * root. Use --address to run against a bus that is already up. The
+ * sessions belong to nobody unless --unix-user says otherwise, root is
+ * refused since each session recreates the user's runtime dir.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <pwd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <dbus/dbus.h>
+
+#include "ck-connector.h"
+
+#define CK_NAME              "org.freedesktop.ConsoleKit"
+#define CK_MANAGER_PATH      "/org/freedesktop/ConsoleKit/Manager"
+#define CK_MANAGER_INTERFACE "org.freedesktop.ConsoleKit.Manager"
+
+/* How long to wait for the daemon to show up on the bus, in ms */
+#define DAEMON_START_TIMEOUT 10000
+
+/* Exit status automake's test harness takes as a skipped test */
+#define EXIT_SKIP 77
+
+typedef enum {
+        OP_OPEN_SESSION,
+        OP_GET_SESSION_FOR_UNIX_PROCESS,
+        OP_LIST_SESSIONS,
+        OP_CLOSE_SESSION,
+        N_OPS
+} BenchOp;
+
+static const char *op_names[N_OPS] = {
+        "OpenSessionWithParameters",
+        "GetSessionForUnixProcess",
+        "ListSessions",
+        "CloseSession",
+};
+
+typedef struct
+{
+        GArray          *usec[N_OPS];
+        guint            errors[N_OPS];
+        /* when the client was done, on the monotonic clock */
+        gint64           end;
+} BenchClient;
+
+static gint      n_clients    = 8;
+static gint      n_iterations = 100;
+static gint      unix_user    = -1;
+static gchar    *daemon_path  = NULL;
+static gchar    *dbus_daemon  = NULL;
+static gchar    *bus_address  = NULL;
+static gboolean  use_helper   = FALSE;
+static gint64    max_p99      = 0;
+static gboolean  client_mode  = FALSE;
+
+static GOptionEntry entries [] = {
+        { "clients", 'c', 0, G_OPTION_ARG_INT, &n_clients, "Number of concurrent clients", "N" },
+        { "iterations", 'n', 0, G_OPTION_ARG_INT, &n_iterations, "Sessions each client opens and closes", "N" },
+        { "unix-user", 'u', 0, G_OPTION_ARG_INT, &unix_user, "User to open the sessions for, defaults to nobody. Can't be root", "UID" },
+        { "daemon", 0, 0, G_OPTION_ARG_FILENAME, &daemon_path, "ConsoleKit daemon to benchmark", "PATH" },
+        { "dbus-daemon", 0, 0, G_OPTION_ARG_FILENAME, &dbus_daemon, "dbus-daemon to run the private bus with", "PATH" },
+        { "address", 'a', 0, G_OPTION_ARG_STRING, &bus_address, "Use the ConsoleKit already running on this bus", "ADDRESS" },
+        { "helper", 0, 0, G_OPTION_ARG_NONE, &use_helper, "Open sessions the daemon has to run ck-collect-session-info for", NULL },
+        { "max-p99", 0, 0, G_OPTION_ARG_INT64, &max_p99, "Fail if the 99th percentile latency of any call exceeds this", "USEC" },
+        { "client", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &client_mode, "Run a single client and print its raw results", NULL },
+        { NULL }
+};
+
+static const char bus_config[] =
+        "<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\"\n"
+        " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+        "<busconfig>\n"
+        "  <type>system</type>\n"
+        "  <listen>unix:tmpdir=/tmp</listen>\n"
+        "  <policy context=\"default\">\n"
+        "    <allow user=\"*\"/>\n"
+        "    <allow own=\"*\"/>\n"
+        "    <allow send_destination=\"*\"/>\n"
+        "    <allow receive_sender=\"*\"/>\n"
+        "  </policy>\n"
+        "</busconfig>\n";
+
+static GPid  bus_pid = 0;
+static GPid  daemon_pid = 0;
+static char *bus_config_file = NULL;
+
+static gboolean
+start_bus (char **address)
+{
+        GError     *error = NULL;
+        char       *argv[5];
+        int         out_fd;
+        int         fd;
+        GIOChannel *channel;
+        gsize       len;
+
+        fd = g_file_open_tmp ("ck-bench-XXXXXX.conf", &bus_config_file, &error);
+        if (fd == -1) {
+                g_printerr ("Unable to write the bus configuration: %s\n", error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+        close (fd);
+
+        if (!g_file_set_contents (bus_config_file, bus_config, -1, &error)) {
+                g_printerr ("Unable to write the bus configuration: %s\n", error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        argv[0] = dbus_daemon != NULL ? dbus_daemon : "dbus-daemon";
+        argv[1] = "--nofork";
+        argv[2] = "--print-address=1";
+        argv[3] = g_strdup_printf ("--config-file=%s", bus_config_file);
+        argv[4] = NULL;
+
+        if (!g_spawn_async_with_pipes (NULL, argv, NULL,
+                                       G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                       NULL, NULL,
+                                       &bus_pid,
+                                       NULL, &out_fd, NULL,
+                                       &error)) {
+                g_printerr ("Unable to start %s: %s\n", argv[0], error->message);
+                g_error_free (error);
+                g_free (argv[3]);
+                return FALSE;
+        }
+        g_free (argv[3]);
+
+        channel = g_io_channel_unix_new (out_fd);
+        g_io_channel_set_close_on_unref (channel, TRUE);
+        if (g_io_channel_read_line (channel, address, NULL, &len, &error) != G_IO_STATUS_NORMAL) {
+                g_printerr ("Unable to read the bus address: %s\n", error != NULL ? error->message : "end of file");
+                g_clear_error (&error);
+                g_io_channel_unref (channel);
+                return FALSE;
+        }
+        g_io_channel_unref (channel);
+
+        (*address)[len] = '\0';
+
+        return TRUE;
+}
+
+static gboolean
+wait_for_daemon (GDBusConnection *bus)
+{
+        gint64 deadline;
+
+        deadline = g_get_monotonic_time () + DAEMON_START_TIMEOUT * 1000;
+
+        while (g_get_monotonic_time () < deadline) {
+                GVariant *value;
+                gboolean  has_owner = FALSE;
+
+                value = g_dbus_connection_call_sync (bus,
+                                                     "org.freedesktop.DBus",
+                                                     "/org/freedesktop/DBus",
+                                                     "org.freedesktop.DBus",
+                                                     "NameHasOwner",
+                                                     g_variant_new ("(s)", CK_NAME),
+                                                     G_VARIANT_TYPE ("(b)"),
+                                                     G_DBUS_CALL_FLAGS_NONE,
+                                                     -1,
+                                                     NULL,
+                                                     NULL);
+                if (value != NULL) {
+                        g_variant_get (value, "(b)", &has_owner);
+                        g_variant_unref (value);
+                }
+
+                if (has_owner) {
+                        return TRUE;
+                }
+
+                if (daemon_pid != 0 && waitpid (daemon_pid, NULL, WNOHANG) == daemon_pid) {
+                        g_printerr ("%s exited before it got on the bus\n", daemon_path);
+                        daemon_pid = 0;
+                        return FALSE;
+                }
+
+                g_usleep (50 * 1000);
+        }
+
+        g_printerr ("Timed out waiting for %s on the bus\n", CK_NAME);
+        return FALSE;
+}
+
+static gboolean
+start_daemon (void)
+{
+        GError *error = NULL;
+        char   *argv[3];
+
+        argv[0] = daemon_path;
+        argv[1] = "--no-daemon";
+        argv[2] = NULL;
+
+        if (!g_spawn_async (NULL, argv, NULL,
+                            G_SPAWN_DO_NOT_REAP_CHILD,
+                            NULL, NULL,
+                            &daemon_pid,
+                            &error)) {
+                g_printerr ("Unable to start %s: %s\n", daemon_path, error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static void
+stop_child (GPid *pid)
+{
+        if (*pid == 0) {
+                return;
+        }
+
+        kill (*pid, SIGTERM);
+        waitpid (*pid, NULL, 0);
+        g_spawn_close_pid (*pid);
+        *pid = 0;
+}
+
+static void
+record (BenchClient *client,
+        BenchOp      op,
+        gint64       start,
+        gboolean     ok)
+{
+        gint64 usec;
+
+        if (!ok) {
+                client->errors[op]++;
+                return;
+        }
+
+        usec = g_get_monotonic_time () - start;
+        g_array_append_val (client->usec[op], usec);
+}
+
+static gboolean
+call_manager (GDBusConnection    *bus,
+              const char         *method,
+              GVariant           *parameters,
+              const GVariantType *reply_type)
+{
+        GVariant *value;
+        GError   *error = NULL;
+
+        value = g_dbus_connection_call_sync (bus,
+                                             CK_NAME,
+                                             CK_MANAGER_PATH,
+                                             CK_MANAGER_INTERFACE,
+                                             method,
+                                             parameters,
+                                             reply_type,
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             -1,
+                                             NULL,
+                                             &error);
+        if (value == NULL) {
+                g_printerr ("%s failed: %s\n", method, error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        g_variant_unref (value);
+        return TRUE;
+}
+
+/* Starts a process that belongs to the session with @cookie, it
+ * keeps running until its stdin is closed */
+static gboolean
+start_session_member (const char *cookie,
+                      GPid       *pid,
+                      int        *stdin_fd)
+{
+        GError  *error = NULL;
+        char    *argv[] = { "cat", NULL };
+        char   **envp;
+        gboolean res;
+
+        envp = g_environ_setenv (g_get_environ (), "XDG_SESSION_COOKIE", cookie, TRUE);
+
+        res = g_spawn_async_with_pipes (NULL, argv, envp,
+                                        G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL,
+                                        NULL, NULL,
+                                        pid,
+                                        stdin_fd, NULL, NULL,
+                                        &error);
+        if (!res) {
+                g_printerr ("Unable to start a session process: %s\n", error->message);
+                g_error_free (error);
+        }
+
+        g_strfreev (envp);
+
+        return res;
+}
+
+static void
+stop_session_member (GPid pid,
+                     int  stdin_fd)
+{
+        close (stdin_fd);
+        waitpid (pid, NULL, 0);
+        g_spawn_close_pid (pid);
+}
+
+static void
+run_client (BenchClient     *client,
+            GDBusConnection *bus)
+{
+        const char *session_type = "ck-bench";
+        const char *x11_display_device = "/dev/tty15";
+        dbus_bool_t is_local = FALSE;
+        gint        i;
+
+        for (i = 0; i < n_iterations; i++) {
+                CkConnector *connector;
+                DBusError    error;
+                gint64       start;
+                dbus_bool_t  res;
+                GPid         member_pid;
+                int          member_stdin;
+
+                connector = ck_connector_new ();
+                if (connector == NULL) {
+                        g_printerr ("OOM creating CkConnector\n");
+                        break;
+                }
+
+                dbus_error_init (&error);
+                start = g_get_monotonic_time ();
+                if (use_helper) {
+                        res = ck_connector_open_session_with_parameters (connector, &error,
+                                                                         "unix-user", &unix_user,
+                                                                         "session-type", &session_type,
+                                                                         "is-local", &is_local,
+                                                                         "x11-display-device", &x11_display_device,
+                                                                         NULL);
+                } else {
+                        res = ck_connector_open_session_with_parameters (connector, &error,
+                                                                         "unix-user", &unix_user,
+                                                                         "session-type", &session_type,
+                                                                         "is-local", &is_local,
+                                                                         NULL);
+                }
+                record (client, OP_OPEN_SESSION, start, res);
+
+                if (!res) {
+                        if (dbus_error_is_set (&error)) {
+                                g_printerr ("OpenSessionWithParameters failed: %s\n", error.message);
+                                dbus_error_free (&error);
+                        }
+                        ck_connector_unref (connector);
+                        continue;
+                }
+
+                if (start_session_member (ck_connector_get_cookie (connector), &member_pid, &member_stdin)) {
+                        start = g_get_monotonic_time ();
+                        res = call_manager (bus,
+                                            "GetSessionForUnixProcess",
+                                            g_variant_new ("(u)", (guint32) member_pid),
+                                            G_VARIANT_TYPE ("(o)"));
+                        record (client, OP_GET_SESSION_FOR_UNIX_PROCESS, start, res);
+
+                        stop_session_member (member_pid, member_stdin);
+                } else {
+                        record (client, OP_GET_SESSION_FOR_UNIX_PROCESS, 0, FALSE);
+                }
+
+                start = g_get_monotonic_time ();
+                res = call_manager (bus,
+                                    "ListSessions",
+                                    NULL,
+                                    G_VARIANT_TYPE ("(a(susso))"));
+                record (client, OP_LIST_SESSIONS, start, res);
+
+                start = g_get_monotonic_time ();
+                res = ck_connector_close_session (connector, &error);
+                record (client, OP_CLOSE_SESSION, start, res);
+
+                if (!res && dbus_error_is_set (&error)) {
+                        g_printerr ("CloseSession failed: %s\n", error.message);
+                        dbus_error_free (&error);
+                }
+
+                ck_connector_unref (connector);
+        }
+
+        client->end = g_get_monotonic_time ();
+}
+
+/* Body of ck-bench --client: waits for the go from the parent on
+ * stdin, runs and prints the raw latencies for the parent to merge */
+static int
+client_main (void)
+{
+        GDBusConnection *bus;
+        GError          *error = NULL;
+        GKeyFile        *key_file;
+        BenchClient      client;
+        char            *data;
+        char             go;
+        gint             op;
+
+        bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+        if (bus == NULL) {
+                g_printerr ("Unable to connect to the bus: %s\n", error->message);
+                g_error_free (error);
+                return 1;
+        }
+
+        for (op = 0; op < N_OPS; op++) {
+                client.usec[op] = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_iterations);
+                client.errors[op] = 0;
+        }
+
+        if (read (STDIN_FILENO, &go, 1) == 1) {
+                run_client (&client, bus);
+        } else {
+                client.end = g_get_monotonic_time ();
+        }
+
+        key_file = g_key_file_new ();
+        g_key_file_set_int64 (key_file, "client", "end", client.end);
+        for (op = 0; op < N_OPS; op++) {
+                gint *usec;
+                guint j;
+
+                /* a single call won't take more than half an hour */
+                usec = g_new (gint, MAX (client.usec[op]->len, 1));
+                for (j = 0; j < client.usec[op]->len; j++) {
+                        usec[j] = (gint) g_array_index (client.usec[op], gint64, j);
+                }
+
+                g_key_file_set_integer_list (key_file, op_names[op], "usec", usec, client.usec[op]->len);
+                g_key_file_set_integer (key_file, op_names[op], "errors", client.errors[op]);
+
+                g_free (usec);
+                g_array_free (client.usec[op], TRUE);
+        }
+
+        data = g_key_file_to_data (key_file, NULL, NULL);
+        fputs (data, stdout);
+        g_free (data);
+        g_key_file_free (key_file);
+
+        g_object_unref (bus);
+
+        return 0;
+}
+
+typedef struct
+{
+        GPid pid;
+        int  stdin_fd;
+        int  stdout_fd;
+} ClientProcess;
+
+static gboolean
+start_client (const char    *self,
+              ClientProcess *process)
+{
+        GError  *error = NULL;
+        char    *argv[6];
+        gint     n = 0;
+        gboolean res;
+
+        argv[n++] = (char *) self;
+        argv[n++] = "--client";
+        argv[n++] = g_strdup_printf ("--iterations=%d", n_iterations);
+        argv[n++] = g_strdup_printf ("--unix-user=%d", unix_user);
+        if (use_helper) {
+                argv[n++] = "--helper";
+        }
+        argv[n] = NULL;
+
+        res = g_spawn_async_with_pipes (NULL, argv, NULL,
+                                        G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                        NULL, NULL,
+                                        &process->pid,
+                                        &process->stdin_fd, &process->stdout_fd, NULL,
+                                        &error);
+        if (!res) {
+                g_printerr ("Unable to start a client: %s\n", error->message);
+                g_error_free (error);
+        }
+
+        g_free (argv[2]);
+        g_free (argv[3]);
+
+        return res;
+}
+
+/* Reads the results of a client started with start_client and reaps it */
+static gboolean
+finish_client (ClientProcess *process,
+               BenchClient   *client)
+{
+        GIOChannel *channel;
+        GKeyFile   *key_file;
+        GError     *error = NULL;
+        char       *data = NULL;
+        gsize       len;
+        gboolean    ok = FALSE;
+        gint        op;
+
+        channel = g_io_channel_unix_new (process->stdout_fd);
+        g_io_channel_set_close_on_unref (channel, TRUE);
+        if (g_io_channel_read_to_end (channel, &data, &len, &error) != G_IO_STATUS_NORMAL) {
+                g_printerr ("Unable to read the results of a client: %s\n", error != NULL ? error->message : "end of file");
+                g_clear_error (&error);
+        }
+        g_io_channel_unref (channel);
+
+        waitpid (process->pid, NULL, 0);
+        g_spawn_close_pid (process->pid);
+
+        key_file = g_key_file_new ();
+        if (data == NULL || !g_key_file_load_from_data (key_file, data, len, G_KEY_FILE_NONE, NULL)) {
+                g_printerr ("A client didn't report any results\n");
+                goto out;
+        }
+
+        client->end = g_key_file_get_int64 (key_file, "client", "end", NULL);
+        for (op = 0; op < N_OPS; op++) {
+                gint  *usec;
+                gsize  n_usec = 0;
+                gsize  j;
+
+                usec = g_key_file_get_integer_list (key_file, op_names[op], "usec", &n_usec, NULL);
+                for (j = 0; j < n_usec; j++) {
+                        gint64 value = usec[j];
+
+                        g_array_append_val (client->usec[op], value);
+                }
+                g_free (usec);
+
+                client->errors[op] = g_key_file_get_integer (key_file, op_names[op], "errors", NULL);
+        }
+
+        ok = TRUE;
+
+ out:
+        g_key_file_free (key_file);
+        g_free (data);
+
+        return ok;
+}
+
+static gint
+compare_usec (gconstpointer a,
+              gconstpointer b)
+{
+        gint64 x = *(const gint64 *) a;
+        gint64 y = *(const gint64 *) b;
+
+        return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static gint64
+percentile (GArray *sorted,
+            guint   percent)
+{
+        guint rank;
+
+        if (sorted->len == 0) {
+                return 0;
+        }
+
+        rank = (sorted->len * percent + 99) / 100;
+        return g_array_index (sorted, gint64, MAX (rank, 1) - 1);
+}
+
+/* Merges the clients' results and prints them, returns FALSE if any
+ * call failed or was slower than --max-p99 */
+static gboolean
+report (BenchClient *clients,
+        gint64       elapsed_usec)
+{
+        GKeyFile *key_file;
+        char     *data;
+        gboolean  ok = TRUE;
+        guint     total_calls = 0;
+        gint      op;
+        gint      i;
+
+        key_file = g_key_file_new ();
+
+        g_key_file_set_integer (key_file, "ck-bench", "clients", n_clients);
+        g_key_file_set_integer (key_file, "ck-bench", "iterations", n_iterations);
+        g_key_file_set_boolean (key_file, "ck-bench", "helper", use_helper);
+        g_key_file_set_int64 (key_file, "ck-bench", "elapsed_usec", elapsed_usec);
+
+        for (op = 0; op < N_OPS; op++) {
+                GArray *all;
+                guint   errors = 0;
+                gint64  total = 0;
+                gint64  p99;
+                guint   j;
+
+                all = g_array_new (FALSE, FALSE, sizeof (gint64));
+                for (i = 0; i < n_clients; i++) {
+                        g_array_append_vals (all, clients[i].usec[op]->data, clients[i].usec[op]->len);
+                        errors += clients[i].errors[op];
+                }
+                g_array_sort (all, compare_usec);
+
+                for (j = 0; j < all->len; j++) {
+                        total += g_array_index (all, gint64, j);
+                }
+                total_calls += all->len;
+
+                p99 = percentile (all, 99);
+
+                g_key_file_set_integer (key_file, op_names[op], "calls", all->len);
+                g_key_file_set_integer (key_file, op_names[op], "errors", errors);
+                g_key_file_set_double (key_file, op_names[op], "calls_per_sec",
+                                       elapsed_usec > 0 ? all->len * 1000000.0 / elapsed_usec : 0.0);
+                g_key_file_set_int64 (key_file, op_names[op], "mean_usec", all->len > 0 ? total / all->len : 0);
+                g_key_file_set_int64 (key_file, op_names[op], "p50_usec", percentile (all, 50));
+                g_key_file_set_int64 (key_file, op_names[op], "p90_usec", percentile (all, 90));
+                g_key_file_set_int64 (key_file, op_names[op], "p99_usec", p99);
+                g_key_file_set_int64 (key_file, op_names[op], "max_usec", all->len > 0 ? g_array_index (all, gint64, all->len - 1) : 0);
+
+                if (errors > 0) {
+                        ok = FALSE;
+                }
+                if (max_p99 > 0 && p99 > max_p99) {
+                        g_printerr ("%s: p99 of %" G_GINT64_FORMAT " us exceeds %" G_GINT64_FORMAT " us\n",
+                                    op_names[op], p99, max_p99);
+                        ok = FALSE;
+                }
+
+                g_array_free (all, TRUE);
+        }
+
+        g_key_file_set_double (key_file, "ck-bench", "calls_per_sec",
+                               elapsed_usec > 0 ? total_calls * 1000000.0 / elapsed_usec : 0.0);
+        g_key_file_set_boolean (key_file, "ck-bench", "passed", ok);
+
+        data = g_key_file_to_data (key_file, NULL, NULL);
+        fputs (data, stdout);
+        g_free (data);
+        g_key_file_free (key_file);
+
+        return ok;
+}
+
+int
+main (int argc, char *argv[])
+{
+        GOptionContext  *context;
+        GError          *error = NULL;
+        GDBusConnection *bus = NULL;
+        BenchClient     *clients = NULL;
+        ClientProcess   *processes = NULL;
+        char            *self;
+        char            *address = NULL;
+        gint64           start;
+        gint64           elapsed;
+        gint             n_started = 0;
+        gint             ret = 1;
+        gint             i;
+        gint             op;
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+        g_type_init ();
+#endif
+
+        self = argv[0];
+
+        context = g_option_context_new ("- benchmark session open and close throughput");
+        g_option_context_add_main_entries (context, entries, NULL);
+        if (!g_option_context_parse (context, &argc, &argv, &error)) {
+                g_printerr ("%s\n", error->message);
+                g_error_free (error);
+                g_option_context_free (context);
+                return 1;
+        }
+        g_option_context_free (context);
+
+        if (n_clients < 1 || n_iterations < 1) {
+                g_printerr ("--clients and --iterations must be at least 1\n");
+                return 1;
+        }
+
+        /* Opening and closing sessions recreates the user's runtime
+         * dir, keep that away from any real user */
+        if (unix_user < 0) {
+                struct passwd *pwent = getpwnam ("nobody");
+
+                unix_user = pwent != NULL ? (gint) pwent->pw_uid : 65534;
+        }
+
+        if (unix_user == 0) {
+                g_printerr ("ck-bench won't open sessions for root, use --unix-user with an unprivileged test user\n");
+                return 1;
+        }
+
+        if (client_mode) {
+                return client_main ();
+        }
+
+        if (daemon_path == NULL) {
+                daemon_path = g_strdup (CK_BENCH_DAEMON);
+        }
+
+        if (bus_address != NULL) {
+                address = g_strdup (bus_address);
+        } else {
+                if (getuid () != 0) {
+                        g_printerr ("ck-bench has to be run as root to start the daemon, skipping\n");
+                        return EXIT_SKIP;
+                }
+
+                if (!start_bus (&address)) {
+                        goto out;
+                }
+        }
+
+        /* libck-connector always uses the system bus */
+        g_setenv ("DBUS_SYSTEM_BUS_ADDRESS", address, TRUE);
+
+        if (bus_address == NULL && !start_daemon ()) {
+                goto out;
+        }
+
+        bus = g_dbus_connection_new_for_address_sync (address,
+                                                      G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                      G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                      NULL,
+                                                      NULL,
+                                                      &error);
+        if (bus == NULL) {
+                g_printerr ("Unable to connect to %s: %s\n", address, error->message);
+                g_error_free (error);
+                goto out;
+        }
+
+        if (!wait_for_daemon (bus)) {
+                goto out;
+        }
+
+        clients = g_new0 (BenchClient, n_clients);
+        for (i = 0; i < n_clients; i++) {
+                for (op = 0; op < N_OPS; op++) {
+                        clients[i].usec[op] = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_iterations);
+                }
+        }
+
+        /* start them all first so that starting up isn't measured */
+        processes = g_new0 (ClientProcess, n_clients);
+        for (n_started = 0; n_started < n_clients; n_started++) {
+                if (!start_client (self, &processes[n_started])) {
+                        break;
+                }
+        }
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < n_started; i++) {
+                /* a client that sees end of file instead just reports */
+                if (n_started == n_clients && write (processes[i].stdin_fd, "g", 1) != 1) {
+                        g_printerr ("Unable to start client %d\n", i);
+                }
+                close (processes[i].stdin_fd);
+        }
+
+        elapsed = 0;
+        ret = n_started == n_clients ? 0 : 1;
+        for (i = 0; i < n_started; i++) {
+                if (!finish_client (&processes[i], &clients[i])) {
+                        ret = 1;
+                }
+                elapsed = MAX (elapsed, clients[i].end - start);
+        }
+        g_free (processes);
+
+        if (ret == 0) {
+                ret = report (clients, elapsed) ? 0 : 1;
+        }
+
+ out:
+        if (clients != NULL) {
+                for (i = 0; i < n_clients; i++) {
+                        for (op = 0; op < N_OPS; op++) {
+                                g_array_free (clients[i].usec[op], TRUE);
+                        }
+                }
+                g_free (clients);
+        }
+
+        if (bus != NULL) {
+                g_object_unref (bus);
+        }
+
+        stop_child (&daemon_pid);
+        stop_child (&bus_pid);
+
+        if (bus_config_file != NULL) {
+                g_unlink (bus_config_file);
+                g_free (bus_config_file);
+        }
+
+        g_free (address);
+
+        return ret;
+}
@@ -0,0 +1,617 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Resolves the uid and pid behind a D-Bus unique name. Unique names are
+ * never reused by the bus daemon so a resolved name stays valid until
+ * the peer disconnects. The manager only watches the names that own a
+ * session and calls ck_caller_cache_remove for those, entries for other
+ * peers simply go stale and are dropped when the cache fills up. Lookups use a
+ * single GetConnectionCredentials call and only fall back to the older
+ * GetConnectionUnixUser/GetConnectionUnixProcessID pair when the bus
+ * daemon doesn't provide it.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+/* For TRACE */
+#include "ck-sysdeps.h"
+
+#include "ck-caller-cache.h"
+
+#define CK_CALLER_CACHE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CK_TYPE_CALLER_CACHE, CkCallerCachePrivate))
+
+#define DBUS_NAME       "org.freedesktop.DBus"
+#define DBUS_PATH       "/org/freedesktop/DBus"
+#define DBUS_INTERFACE  "org.freedesktop.DBus"
+
+/* Timeout for the requests to the bus daemon, in ms */
+#define CALL_TIMEOUT    2000
+
+/* Only peers owning a session are removed on NameOwnerChanged, this
+ * bounds the stale entries left by everybody else.
+ */
+#define MAX_ENTRIES     4096
+
+typedef struct
+{
+        uid_t uid;
+        pid_t pid;
+} CallerEntry;
+
+typedef struct
+{
+        CkCallerCacheFunc callback;
+        gpointer          user_data;
+} CallerWaiter;
+
+typedef struct
+{
+        CkCallerCache   *cache;
+        GDBusConnection *connection;
+        gchar           *sender;
+        GSList          *waiters;
+        /* set when the sender went away while we were asking about it */
+        gboolean         invalidated;
+        uid_t            uid;
+} PendingLookup;
+
+struct CkCallerCachePrivate
+{
+        /* sender -> CallerEntry */
+        GHashTable *entries;
+        /* sender -> PendingLookup, requests in flight */
+        GHashTable *pending;
+
+        guint       hits;
+        guint       misses;
+};
+
+static void     ck_caller_cache_finalize    (GObject            *object);
+
+G_DEFINE_TYPE (CkCallerCache, ck_caller_cache, G_TYPE_OBJECT)
+
+
+/**
+ * ck_caller_cache_get:
+ *
+ * Return value:  Returns the CkCallerCache object or
+ *                NULL on failure. Do not unref when finished. [transfer: none]
+ **/
+CkCallerCache*
+ck_caller_cache_get (void)
+{
+        static GObject *cache = NULL;
+
+        if (cache == NULL) {
+                cache = g_object_new (CK_TYPE_CALLER_CACHE, NULL);
+
+                g_object_add_weak_pointer (cache,
+                                           (gpointer *) &cache);
+        }
+
+        return CK_CALLER_CACHE (cache);
+}
+
+static void
+ck_caller_cache_class_init (CkCallerCacheClass *klass)
+{
+        GObjectClass   *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = ck_caller_cache_finalize;
+
+        g_type_class_add_private (klass, sizeof (CkCallerCachePrivate));
+}
+
+static void
+ck_caller_cache_init (CkCallerCache *cache)
+{
+        cache->priv = CK_CALLER_CACHE_GET_PRIVATE (cache);
+
+        cache->priv->entries = g_hash_table_new_full (g_str_hash,
+                                                      g_str_equal,
+                                                      g_free,
+                                                      g_free);
+        /* PendingLookups free themselves when the call completes */
+        cache->priv->pending = g_hash_table_new (g_str_hash,
+                                                 g_str_equal);
+}
+
+static void
+ck_caller_cache_finalize (GObject *object)
+{
+        CkCallerCache *cache;
+
+        TRACE ();
+
+        cache = CK_CALLER_CACHE (object);
+
+        g_hash_table_destroy (cache->priv->entries);
+        g_hash_table_destroy (cache->priv->pending);
+
+        G_OBJECT_CLASS (ck_caller_cache_parent_class)->finalize (object);
+}
+
+static void
+cache_insert (CkCallerCache *cache,
+              const gchar   *sender,
+              uid_t          uid,
+              pid_t          pid)
+{
+        CallerEntry *entry;
+
+        if (g_hash_table_size (cache->priv->entries) >= MAX_ENTRIES) {
+                g_debug ("caller cache full, flushing %u entries",
+                         g_hash_table_size (cache->priv->entries));
+                g_hash_table_remove_all (cache->priv->entries);
+        }
+
+        entry = g_new0 (CallerEntry, 1);
+        entry->uid = uid;
+        entry->pid = pid;
+
+        g_hash_table_insert (cache->priv->entries, g_strdup (sender), entry);
+}
+
+/**
+ * ck_caller_cache_lookup:
+ * @cache: the @CkCallerCache object
+ * @sender: the unique bus name of the caller
+ * @uid: (out): the caller's uid
+ * @pid: (out): the caller's pid
+ *
+ * Looks up @sender without doing any I/O.
+ *
+ * Return value: TRUE if @sender was in the cache.
+ **/
+gboolean
+ck_caller_cache_lookup (CkCallerCache *cache,
+                        const gchar   *sender,
+                        uid_t         *uid,
+                        pid_t         *pid)
+{
+        CallerEntry *entry;
+
+        g_return_val_if_fail (CK_IS_CALLER_CACHE (cache), FALSE);
+
+        if (sender == NULL) {
+                return FALSE;
+        }
+
+        entry = g_hash_table_lookup (cache->priv->entries, sender);
+        if (entry == NULL) {
+                return FALSE;
+        }
+
+        cache->priv->hits++;
+
+        if (uid != NULL) {
+                *uid = entry->uid;
+        }
+        if (pid != NULL) {
+                *pid = entry->pid;
+        }
+
+        return TRUE;
+}
+
+static void
+pending_lookup_finish (PendingLookup *lookup,
+                       gboolean       success,
+                       uid_t          uid,
+                       pid_t          pid)
+{
+        CkCallerCache *cache = lookup->cache;
+        GSList        *l;
+
+        g_hash_table_remove (cache->priv->pending, lookup->sender);
+
+        if (success) {
+                g_debug ("caller %s: uid = %d pid = %d", lookup->sender, uid, pid);
+
+                if (!lookup->invalidated) {
+                        cache_insert (cache, lookup->sender, uid, pid);
+                }
+        }
+
+        g_debug ("caller cache: %u entries, %u hits, %u misses",
+                 g_hash_table_size (cache->priv->entries),
+                 cache->priv->hits,
+                 cache->priv->misses);
+
+        /* Waiters are served in the order they asked */
+        lookup->waiters = g_slist_reverse (lookup->waiters);
+        for (l = lookup->waiters; l != NULL; l = l->next) {
+                CallerWaiter *waiter = l->data;
+
+                waiter->callback (cache, lookup->sender, success, uid, pid, waiter->user_data);
+        }
+
+        g_slist_free_full (lookup->waiters, g_free);
+        g_object_unref (lookup->connection);
+        g_object_unref (lookup->cache);
+        g_free (lookup->sender);
+        g_free (lookup);
+}
+
+static void
+legacy_pid_cb (GObject      *source,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+        PendingLookup *lookup = user_data;
+        GVariant      *value;
+        GError        *error = NULL;
+        guint32        pid;
+
+        value = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &error);
+        if (value == NULL) {
+                g_warning ("GetConnectionUnixProcessID() failed: %s", error->message);
+                g_error_free (error);
+                pending_lookup_finish (lookup, FALSE, 0, 0);
+                return;
+        }
+
+        g_variant_get (value, "(u)", &pid);
+        g_variant_unref (value);
+
+        pending_lookup_finish (lookup, TRUE, lookup->uid, (pid_t) pid);
+}
+
+static void
+legacy_uid_cb (GObject      *source,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+        PendingLookup *lookup = user_data;
+        GVariant      *value;
+        GError        *error = NULL;
+        guint32        uid;
+
+        value = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &error);
+        if (value == NULL) {
+                g_warning ("GetConnectionUnixUser() failed: %s", error->message);
+                g_error_free (error);
+                pending_lookup_finish (lookup, FALSE, 0, 0);
+                return;
+        }
+
+        g_variant_get (value, "(u)", &uid);
+        g_variant_unref (value);
+
+        lookup->uid = (uid_t) uid;
+
+        g_dbus_connection_call (lookup->connection,
+                                DBUS_NAME,
+                                DBUS_PATH,
+                                DBUS_INTERFACE,
+                                "GetConnectionUnixProcessID",
+                                g_variant_new ("(s)", lookup->sender),
+                                G_VARIANT_TYPE ("(u)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                CALL_TIMEOUT,
+                                NULL,
+                                legacy_pid_cb,
+                                lookup);
+}
+
+/* Pulls the uid and pid out of a GetConnectionCredentials reply */
+static gboolean
+parse_credentials (GVariant *value,
+                   uid_t    *uid,
+                   pid_t    *pid)
+{
+        GVariant *dict;
+        guint32   unix_user;
+        guint32   process_id;
+        gboolean  ret;
+
+        g_variant_get (value, "(@a{sv})", &dict);
+
+        ret = g_variant_lookup (dict, "UnixUserID", "u", &unix_user) &&
+              g_variant_lookup (dict, "ProcessID", "u", &process_id);
+
+        g_variant_unref (dict);
+
+        if (ret) {
+                *uid = (uid_t) unix_user;
+                *pid = (pid_t) process_id;
+        }
+
+        return ret;
+}
+
+static void
+credentials_cb (GObject      *source,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+        PendingLookup *lookup = user_data;
+        GVariant      *value;
+        GError        *error = NULL;
+        uid_t          uid = 0;
+        pid_t          pid = 0;
+        gboolean       ret = FALSE;
+
+        value = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &error);
+        if (value != NULL) {
+                ret = parse_credentials (value, &uid, &pid);
+                g_variant_unref (value);
+        } else {
+                g_debug ("GetConnectionCredentials() failed: %s", error->message);
+                g_error_free (error);
+        }
+
+        if (ret) {
+                pending_lookup_finish (lookup, TRUE, uid, pid);
+                return;
+        }
+
+        /* Older bus daemons, or platforms where it can't tell us the pid */
+        g_dbus_connection_call (lookup->connection,
+                                DBUS_NAME,
+                                DBUS_PATH,
+                                DBUS_INTERFACE,
+                                "GetConnectionUnixUser",
+                                g_variant_new ("(s)", lookup->sender),
+                                G_VARIANT_TYPE ("(u)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                CALL_TIMEOUT,
+                                NULL,
+                                legacy_uid_cb,
+                                lookup);
+}
+
+/**
+ * ck_caller_cache_resolve:
+ * @cache: the @CkCallerCache object
+ * @connection: the bus @sender is connected to
+ * @sender: the unique bus name of the caller
+ * @callback: called with the result
+ * @user_data: passed to @callback
+ *
+ * Resolves the uid and pid of @sender. If the answer is already cached
+ * @callback runs before this function returns, otherwise it runs from
+ * the main loop once the bus daemon replies. Concurrent requests for
+ * the same sender share a single round trip.
+ **/
+void
+ck_caller_cache_resolve (CkCallerCache     *cache,
+                         GDBusConnection   *connection,
+                         const gchar       *sender,
+                         CkCallerCacheFunc  callback,
+                         gpointer           user_data)
+{
+        PendingLookup *lookup;
+        CallerWaiter  *waiter;
+        uid_t          uid;
+        pid_t          pid;
+
+        TRACE ();
+
+        g_return_if_fail (CK_IS_CALLER_CACHE (cache));
+        g_return_if_fail (callback != NULL);
+
+        if (sender == NULL || connection == NULL) {
+                g_debug ("sender or connection == NULL");
+                callback (cache, sender, FALSE, 0, 0, user_data);
+                return;
+        }
+
+        if (ck_caller_cache_lookup (cache, sender, &uid, &pid)) {
+                callback (cache, sender, TRUE, uid, pid, user_data);
+                return;
+        }
+
+        waiter = g_new0 (CallerWaiter, 1);
+        waiter->callback = callback;
+        waiter->user_data = user_data;
+
+        lookup = g_hash_table_lookup (cache->priv->pending, sender);
+        if (lookup != NULL) {
+                lookup->waiters = g_slist_prepend (lookup->waiters, waiter);
+                return;
+        }
+
+        cache->priv->misses++;
+
+        lookup = g_new0 (PendingLookup, 1);
+        lookup->cache = g_object_ref (cache);
+        lookup->connection = g_object_ref (connection);
+        lookup->sender = g_strdup (sender);
+        lookup->waiters = g_slist_prepend (NULL, waiter);
+
+        g_hash_table_insert (cache->priv->pending, lookup->sender, lookup);
+
+        g_dbus_connection_call (connection,
+                                DBUS_NAME,
+                                DBUS_PATH,
+                                DBUS_INTERFACE,
+                                "GetConnectionCredentials",
+                                g_variant_new ("(s)", sender),
+                                G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                CALL_TIMEOUT,
+                                NULL,
+                                credentials_cb,
+                                lookup);
+}
+
+static gboolean
+call_sync_u (GDBusConnection *connection,
+             const gchar     *method,
+             const gchar     *sender,
+             guint32         *out)
+{
+        GVariant *value;
+        GError   *error = NULL;
+
+        value = g_dbus_connection_call_sync (connection,
+                                             DBUS_NAME,
+                                             DBUS_PATH,
+                                             DBUS_INTERFACE,
+                                             method,
+                                             g_variant_new ("(s)", sender),
+                                             G_VARIANT_TYPE ("(u)"),
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             CALL_TIMEOUT,
+                                             NULL,
+                                             &error);
+        if (value == NULL) {
+                g_warning ("%s() failed: %s", method, error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        g_variant_get (value, "(u)", out);
+        g_variant_unref (value);
+
+        return TRUE;
+}
+
+/**
+ * ck_caller_cache_resolve_sync:
+ * @cache: the @CkCallerCache object
+ * @connection: the bus @sender is connected to
+ * @sender: the unique bus name of the caller
+ * @uid: (out): the caller's uid
+ * @pid: (out): the caller's pid
+ *
+ * Blocking version of ck_caller_cache_resolve for the few callers that
+ * can't be restructured around a callback. Prefer the async version.
+ *
+ * Return value: TRUE on success.
+ **/
+gboolean
+ck_caller_cache_resolve_sync (CkCallerCache   *cache,
+                              GDBusConnection *connection,
+                              const gchar     *sender,
+                              uid_t           *uid,
+                              pid_t           *pid)
+{
+        GVariant *value;
+        guint32   unix_user;
+        guint32   process_id;
+        gboolean  ret;
+
+        TRACE ();
+
+        g_return_val_if_fail (CK_IS_CALLER_CACHE (cache), FALSE);
+
+        if (sender == NULL || connection == NULL) {
+                return FALSE;
+        }
+
+        if (ck_caller_cache_lookup (cache, sender, uid, pid)) {
+                return TRUE;
+        }
+
+        cache->priv->misses++;
+
+        value = g_dbus_connection_call_sync (connection,
+                                             DBUS_NAME,
+                                             DBUS_PATH,
+                                             DBUS_INTERFACE,
+                                             "GetConnectionCredentials",
+                                             g_variant_new ("(s)", sender),
+                                             G_VARIANT_TYPE ("(a{sv})"),
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             CALL_TIMEOUT,
+                                             NULL,
+                                             NULL);
+        ret = FALSE;
+        if (value != NULL) {
+                ret = parse_credentials (value, uid, pid);
+                g_variant_unref (value);
+        }
+
+        if (!ret) {
+                if (!call_sync_u (connection, "GetConnectionUnixUser", sender, &unix_user) ||
+                    !call_sync_u (connection, "GetConnectionUnixProcessID", sender, &process_id)) {
+                        return FALSE;
+                }
+
+                *uid = (uid_t) unix_user;
+                *pid = (pid_t) process_id;
+        }
+
+        cache_insert (cache, sender, *uid, *pid);
+
+        return TRUE;
+}
+
+/**
+ * ck_caller_cache_remove:
+ * @cache: the @CkCallerCache object
+ * @sender: the unique bus name that disconnected
+ *
+ * Drops @sender from the cache. Lookups still in flight for it will
+ * complete but their result isn't cached.
+ **/
+void
+ck_caller_cache_remove (CkCallerCache *cache,
+                        const gchar   *sender)
+{
+        PendingLookup *lookup;
+
+        g_return_if_fail (CK_IS_CALLER_CACHE (cache));
+
+        if (sender == NULL) {
+                return;
+        }
+
+        g_hash_table_remove (cache->priv->entries, sender);
+
+        lookup = g_hash_table_lookup (cache->priv->pending, sender);
+        if (lookup != NULL) {
+                lookup->invalidated = TRUE;
+        }
+}
+
+void
+ck_caller_cache_get_stats (CkCallerCache *cache,
+                           guint         *entries,
+                           guint         *hits,
+                           guint         *misses)
+{
+        g_return_if_fail (CK_IS_CALLER_CACHE (cache));
+
+        if (entries != NULL) {
+                *entries = g_hash_table_size (cache->priv->entries);
+        }
+        if (hits != NULL) {
+                *hits = cache->priv->hits;
+        }
+        if (misses != NULL) {
+                *misses = cache->priv->misses;
+        }
+}
@@ -0,0 +1,97 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CK_CALLER_CACHE_H_
+#define __CK_CALLER_CACHE_H_
+
+#include <sys/types.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#define CK_TYPE_CALLER_CACHE           (ck_caller_cache_get_type ())
+#define CK_CALLER_CACHE(o)             (G_TYPE_CHECK_INSTANCE_CAST ((o), CK_TYPE_CALLER_CACHE, CkCallerCache))
+#define CK_CALLER_CACHE_CLASS(k)       (G_TYPE_CHECK_CLASS_CAST((k), CK_TYPE_CALLER_CACHE, CkCallerCacheClass))
+#define CK_IS_CALLER_CACHE(o)          (G_TYPE_CHECK_INSTANCE_TYPE ((o), CK_TYPE_CALLER_CACHE))
+#define CK_IS_CALLER_CACHE_CLASS(k)    (G_TYPE_CHECK_CLASS_TYPE ((k), CK_TYPE_CALLER_CACHE))
+#define CK_CALLER_CACHE_GET_CLASS(o)   (G_TYPE_INSTANCE_GET_CLASS ((o), CK_TYPE_CALLER_CACHE, CkCallerCacheClass))
+
+typedef struct CkCallerCachePrivate CkCallerCachePrivate;
+
+typedef struct
+{
+        GObject               parent;
+        CkCallerCachePrivate *priv;
+} CkCallerCache;
+
+typedef struct
+{
+        GObjectClass parent_class;
+} CkCallerCacheClass;
+
+/* Called once the credentials of @sender are known. When @success is
+ * FALSE @uid and @pid are undefined.
+ */
+typedef void (* CkCallerCacheFunc) (CkCallerCache *cache,
+                                    const gchar   *sender,
+                                    gboolean       success,
+                                    uid_t          uid,
+                                    pid_t          pid,
+                                    gpointer       user_data);
+
+
+GType             ck_caller_cache_get_type          (void);
+
+CkCallerCache    *ck_caller_cache_get               (void);
+
+gboolean          ck_caller_cache_lookup            (CkCallerCache     *cache,
+                                                     const gchar       *sender,
+                                                     uid_t             *uid,
+                                                     pid_t             *pid);
+
+void              ck_caller_cache_resolve           (CkCallerCache     *cache,
+                                                     GDBusConnection   *connection,
+                                                     const gchar       *sender,
+                                                     CkCallerCacheFunc  callback,
+                                                     gpointer           user_data);
+
+gboolean          ck_caller_cache_resolve_sync      (CkCallerCache     *cache,
+                                                     GDBusConnection   *connection,
+                                                     const gchar       *sender,
+                                                     uid_t             *uid,
+                                                     pid_t             *pid);
+
+void              ck_caller_cache_remove            (CkCallerCache     *cache,
+                                                     const gchar       *sender);
+
+void              ck_caller_cache_get_stats         (CkCallerCache     *cache,
+                                                     guint             *entries,
+                                                     guint             *hits,
+                                                     guint             *misses);
+
+#endif /* __CK_CALLER_CACHE_H_ */
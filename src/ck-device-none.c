@@ -127,6 +127,13 @@ ck_device_get_category (CkDevice *device)
         return DEVICE_OTHER;
 }
 
+
+gboolean
+ck_device_get_removed (CkDevice *device)
+{
+        return FALSE;
+}
+
 gboolean
 ck_device_compare_devices (CkDevice *device1,
                            CkDevice *device2)
@@ -34,6 +34,7 @@
 #include <glib-object.h>
 #include <glib/gstdio.h>
 #include <glib/gi18n.h>
+#include <glib-unix.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -91,6 +92,13 @@
 static void     ck_device_finalize    (GObject       *object);
 
 
+enum {
+        REMOVED,
+        LAST_SIGNAL
+};
+
+static guint signals [LAST_SIGNAL] = { 0, };
+
 
 struct _CkDevice
 {
@@ -102,10 +110,19 @@ struct _CkDevice
         CkDeviceCategory    category;
         gint                fd;
         gboolean            state;
+        gboolean            removed;
 };
 
 static struct udev *dev = NULL;
 
+#if !defined(HAVE_DEVATTR_H)
+/* A single monitor watches the input subsystem for every session, the
+ * evdev devices that have been handed out are tracked in live_devices
+ * (without holding a ref) so a remove event can be matched to them. */
+static struct udev_monitor *monitor = NULL;
+static GList               *live_devices = NULL;
+#endif
+
 
 G_DEFINE_TYPE (CkDevice, ck_device, G_TYPE_OBJECT)
 
@@ -116,6 +133,22 @@ ck_device_class_init (CkDeviceClass *klass)
         GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
         object_class->finalize = ck_device_finalize;
+
+        /**
+         * CkDevice::removed:
+         *
+         * Emitted once when the underlying device node goes away, for
+         * example when an input device is unplugged.
+         */
+        signals [REMOVED] = g_signal_new ("removed",
+                                          G_TYPE_FROM_CLASS (object_class),
+                                          G_SIGNAL_RUN_LAST,
+                                          0,
+                                          NULL,
+                                          NULL,
+                                          g_cclosure_marshal_VOID__VOID,
+                                          G_TYPE_NONE,
+                                          0);
 }
 
 
@@ -131,6 +164,10 @@ ck_device_finalize (GObject *object)
 {
         CkDevice *device = CK_DEVICE (object);
 
+#if !defined(HAVE_DEVATTR_H)
+        live_devices = g_list_remove (live_devices, device);
+#endif
+
         /* Always revoke/drop master before we are removed */
         ck_device_set_active (device, FALSE);
 
@@ -347,6 +384,85 @@ udevice_get_device_name (struct udev_device *udevice)
 #endif
 }
 
+#if !defined(HAVE_DEVATTR_H)
+static gboolean
+ck_device_monitor_cb (gint         fd,
+                      GIOCondition condition,
+                      gpointer     user_data)
+{
+        struct udev_device *udevice;
+        GList              *removed = NULL;
+        GList              *l;
+        dev_t               devnum;
+
+        udevice = udev_monitor_receive_device (monitor);
+        if (udevice == NULL) {
+                return TRUE;
+        }
+
+        if (g_strcmp0 (udev_device_get_action (udevice), "remove") != 0) {
+                udev_device_unref (udevice);
+                return TRUE;
+        }
+
+        devnum = udev_device_get_devnum (udevice);
+        udev_device_unref (udevice);
+
+        for (l = live_devices; l != NULL; l = g_list_next (l)) {
+                CkDevice *device = l->data;
+
+                if (device->removed || makedev (device->major, device->minor) != devnum) {
+                        continue;
+                }
+
+                device->removed = TRUE;
+                removed = g_list_prepend (removed, g_object_ref (device));
+        }
+
+        /* Emit outside of the walk, handlers usually drop the last ref
+         * which takes the device out of live_devices */
+        for (l = removed; l != NULL; l = g_list_next (l)) {
+                CkDevice *device = l->data;
+
+                g_debug ("device %d, %d was removed", device->major, device->minor);
+                g_signal_emit (device, signals[REMOVED], 0);
+        }
+
+        g_list_free_full (removed, g_object_unref);
+
+        return TRUE;
+}
+
+static void
+ck_device_monitor_start (void)
+{
+        if (monitor != NULL) {
+                return;
+        }
+
+        monitor = udev_monitor_new_from_netlink (dev, "udev");
+        if (monitor == NULL) {
+                g_warning ("failed to create a udev monitor, removed input devices will not be noticed");
+                return;
+        }
+
+        udev_monitor_filter_add_match_subsystem_devtype (monitor, "input", NULL);
+
+        if (udev_monitor_enable_receiving (monitor) < 0) {
+                g_warning ("failed to enable the udev monitor, removed input devices will not be noticed");
+                udev_monitor_unref (monitor);
+                monitor = NULL;
+                return;
+        }
+
+        /* The monitor lives as long as the daemon does */
+        g_unix_fd_add (udev_monitor_get_fd (monitor),
+                       G_IO_IN,
+                       ck_device_monitor_cb,
+                       NULL);
+}
+#endif
+
 CkDevice*
 ck_device_new (guint    major,
                guint    minor,
@@ -423,6 +539,15 @@ ck_device_new (guint    major,
                 }
         }
 
+#if !defined(HAVE_DEVATTR_H)
+        /* Input devices come and go, watch for them to be unplugged */
+        if (device->category == DEVICE_EVDEV)
+        {
+                ck_device_monitor_start ();
+                live_devices = g_list_prepend (live_devices, device);
+        }
+#endif
+
         return device;
 }
 
@@ -508,6 +633,25 @@ ck_device_get_category (CkDevice *device)
 }
 
 
+gboolean
+ck_device_get_removed (CkDevice *device)
+{
+#if defined(HAVE_DEVATTR_H)
+        /* No udev monitor here, so fall back to checking whether the
+         * input device's fd has gone bad */
+        if (device->removed == FALSE && device->category == DEVICE_EVDEV) {
+                struct stat st;
+
+                if (fstat (device->fd, &st) == -1 && errno == EBADF) {
+                        device->removed = TRUE;
+                }
+        }
+#endif
+
+        return device->removed;
+}
+
+
 gboolean
 ck_device_compare_devices (CkDevice *device1,
                            CkDevice *device2)
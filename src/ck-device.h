@@ -68,6 +68,7 @@ guint             ck_device_get_major                   (CkDevice *device);
 guint             ck_device_get_minor                   (CkDevice *device);
 CkDeviceCategory  ck_device_get_category                (CkDevice *device);
 gint              ck_device_get_fd                      (CkDevice *device);
+gboolean          ck_device_get_removed                 (CkDevice *device);
 
 gboolean          ck_device_compare_devices             (CkDevice *device1,
                                                          CkDevice *device2);
@@ -92,6 +92,20 @@ ck_event_logger_queue_event (CkEventLogger      *event_logger,
         return ret;
 }
 
+/* The number of events waiting to be written out */
+guint
+ck_event_logger_get_queue_length (CkEventLogger *event_logger)
+{
+        gint length;
+
+        g_return_val_if_fail (CK_IS_EVENT_LOGGER (event_logger), 0);
+
+        /* negative while the writer thread is waiting for an event */
+        length = g_async_queue_length (event_logger->priv->event_queue);
+
+        return (guint) MAX (length, 0);
+}
+
 /* Adapted from auditd auditd-event.c */
 static gboolean
 open_log_file (CkEventLogger *event_logger)
@@ -60,6 +60,7 @@ CkEventLogger      * ck_event_logger_new                 (const char         *fi
 gboolean             ck_event_logger_queue_event         (CkEventLogger      *event_logger,
                                                           CkLogEvent         *event,
                                                           GError            **error);
+guint                ck_event_logger_get_queue_length    (CkEventLogger      *event_logger);
 
 G_END_DECLS
 
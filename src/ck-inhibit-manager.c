@@ -49,6 +49,8 @@ struct CkInhibitManagerPrivate
          * inhibits are suppressing that event. The CkInhibitMode indicates
          * if it's a block or delay event */
         gint inhibitors[CK_INHIBIT_MODE_LAST][CK_INHIBIT_EVENT_LAST];
+        /* bumped whenever inhibit_list changes */
+        guint serial;
 };
 
 typedef enum {
@@ -228,6 +230,7 @@ ck_inhibit_manager_create_lock (CkInhibitManager *manager,
         /* Add it to our list */
         priv->inhibit_list = g_list_append (priv->inhibit_list,
                                             inhibit);
+        priv->serial++;
 
         return fd;
 }
@@ -262,6 +265,7 @@ ck_inhibit_manager_remove_lock (CkInhibitManager *manager,
                                                               G_CALLBACK (cb_changed_event),
                                                               manager);
                         priv->inhibit_list = g_list_remove (priv->inhibit_list, l->data);
+                        priv->serial++;
                         return TRUE;
                 }
         }
@@ -269,6 +273,35 @@ ck_inhibit_manager_remove_lock (CkInhibitManager *manager,
         return FALSE;
 }
 
+/**
+ * ck_inhibit_manager_get_n_inhibitors:
+ * @manager: The @CkInhibitManager object
+ *
+ * Return value: the number of inhibit locks currently held.
+ **/
+guint
+ck_inhibit_manager_get_n_inhibitors (CkInhibitManager *manager)
+{
+        g_return_val_if_fail (CK_IS_INHIBIT_MANAGER (manager), 0);
+
+        return g_list_length (CK_INHIBIT_MANAGER_GET_PRIVATE (manager)->inhibit_list);
+}
+
+/**
+ * ck_inhibit_manager_get_serial:
+ * @manager: The @CkInhibitManager object
+ *
+ * Return value: a number that changes whenever an inhibit lock is
+ *               added or removed.
+ **/
+guint
+ck_inhibit_manager_get_serial (CkInhibitManager *manager)
+{
+        g_return_val_if_fail (CK_IS_INHIBIT_MANAGER (manager), 0);
+
+        return CK_INHIBIT_MANAGER_GET_PRIVATE (manager)->serial;
+}
+
 /**
  * ck_inhibit_manager_get:
  *
@@ -65,6 +65,9 @@ gint              ck_inhibit_manager_create_lock                 (CkInhibitManag
 gboolean          ck_inhibit_manager_remove_lock                 (CkInhibitManager *manager,
                                                                   const gchar      *named_pipe_path);
 
+guint             ck_inhibit_manager_get_n_inhibitors            (CkInhibitManager *manager);
+guint             ck_inhibit_manager_get_serial                  (CkInhibitManager *manager);
+
 gboolean          ck_inhibit_manager_is_shutdown_delayed         (CkInhibitManager *manager);
 gboolean          ck_inhibit_manager_is_suspend_delayed          (CkInhibitManager *manager);
 gboolean          ck_inhibit_manager_is_idle_delayed             (CkInhibitManager *manager);
@@ -27,13 +27,36 @@
 #include <glib.h>
 
 #include "ck-log-event.h"
+#include "ck-string-pool.h"
+
+/* The seat ids, session types, display devices and so on are shared
+ * between events through the string pool, there are only ever a few
+ * different ones of each.
+ */
+static char *
+pool_copy (const char *str)
+{
+        return (char *) ck_string_pool_intern (str);
+}
+
+/* Like pool_copy, but frees @str */
+static char *
+pool_take (char *str)
+{
+        char *pooled;
+
+        pooled = pool_copy (str);
+        g_free (str);
+
+        return pooled;
+}
 
 static void
 event_seat_added_free (CkLogSeatAddedEvent *event)
 {
         g_assert (event != NULL);
 
-        g_free (event->seat_id);
+        ck_string_pool_release (event->seat_id);
         event->seat_id = NULL;
 }
 
@@ -42,7 +65,7 @@ event_seat_removed_free (CkLogSeatRemovedEvent *event)
 {
         g_assert (event != NULL);
 
-        g_free (event->seat_id);
+        ck_string_pool_release (event->seat_id);
         event->seat_id = NULL;
 }
 
@@ -84,20 +107,20 @@ event_seat_session_added_free (CkLogSeatSessionAddedEvent *event)
 {
         g_assert (event != NULL);
 
-        g_free (event->seat_id);
+        ck_string_pool_release (event->seat_id);
         event->seat_id = NULL;
 
         g_free (event->session_id);
         event->session_id = NULL;
-        g_free (event->session_type);
+        ck_string_pool_release (event->session_type);
         event->session_type = NULL;
-        g_free (event->session_x11_display);
+        ck_string_pool_release (event->session_x11_display);
         event->session_x11_display = NULL;
-        g_free (event->session_x11_display_device);
+        ck_string_pool_release (event->session_x11_display_device);
         event->session_x11_display_device = NULL;
-        g_free (event->session_display_device);
+        ck_string_pool_release (event->session_display_device);
         event->session_display_device = NULL;
-        g_free (event->session_remote_host_name);
+        ck_string_pool_release (event->session_remote_host_name);
         event->session_remote_host_name = NULL;
         g_free (event->session_creation_time);
         event->session_creation_time = NULL;
@@ -108,20 +131,20 @@ event_seat_session_removed_free (CkLogSeatSessionRemovedEvent *event)
 {
         g_assert (event != NULL);
 
-        g_free (event->seat_id);
+        ck_string_pool_release (event->seat_id);
         event->seat_id = NULL;
 
         g_free (event->session_id);
         event->session_id = NULL;
-        g_free (event->session_type);
+        ck_string_pool_release (event->session_type);
         event->session_type = NULL;
-        g_free (event->session_x11_display);
+        ck_string_pool_release (event->session_x11_display);
         event->session_x11_display = NULL;
-        g_free (event->session_x11_display_device);
+        ck_string_pool_release (event->session_x11_display_device);
         event->session_x11_display_device = NULL;
-        g_free (event->session_display_device);
+        ck_string_pool_release (event->session_display_device);
         event->session_display_device = NULL;
-        g_free (event->session_remote_host_name);
+        ck_string_pool_release (event->session_remote_host_name);
         event->session_remote_host_name = NULL;
         g_free (event->session_creation_time);
         event->session_creation_time = NULL;
@@ -132,7 +155,7 @@ event_seat_active_session_changed_free (CkLogSeatActiveSessionChangedEvent *even
 {
         g_assert (event != NULL);
 
-        g_free (event->seat_id);
+        ck_string_pool_release (event->seat_id);
         event->seat_id = NULL;
 
         g_free (event->session_id);
@@ -144,11 +167,11 @@ event_seat_device_added_free (CkLogSeatDeviceAddedEvent *event)
 {
         g_assert (event != NULL);
 
-        g_free (event->seat_id);
+        ck_string_pool_release (event->seat_id);
         event->seat_id = NULL;
         g_free (event->device_id);
         event->device_id = NULL;
-        g_free (event->device_type);
+        ck_string_pool_release (event->device_type);
         event->device_type = NULL;
 }
 
@@ -157,11 +180,11 @@ event_seat_device_removed_free (CkLogSeatDeviceRemovedEvent *event)
 {
         g_assert (event != NULL);
 
-        g_free (event->seat_id);
+        ck_string_pool_release (event->seat_id);
         event->seat_id = NULL;
         g_free (event->device_id);
         event->device_id = NULL;
-        g_free (event->device_type);
+        ck_string_pool_release (event->device_type);
         event->device_type = NULL;
 }
 
@@ -172,7 +195,7 @@ event_seat_added_copy (CkLogSeatAddedEvent *event,
         g_assert (event != NULL);
         g_assert (event_copy != NULL);
 
-        event_copy->seat_id = g_strdup (event->seat_id);
+        event_copy->seat_id = pool_copy (event->seat_id);
         event_copy->seat_kind = event->seat_kind;
 }
 
@@ -183,7 +206,7 @@ event_seat_removed_copy (CkLogSeatRemovedEvent *event,
         g_assert (event != NULL);
         g_assert (event_copy != NULL);
 
-        event_copy->seat_id = g_strdup (event->seat_id);
+        event_copy->seat_id = pool_copy (event->seat_id);
         event_copy->seat_kind = event->seat_kind;
 }
 
@@ -238,13 +261,13 @@ event_seat_session_added_copy (CkLogSeatSessionAddedEvent *event,
         g_assert (event != NULL);
         g_assert (event_copy != NULL);
 
-        event_copy->seat_id = g_strdup (event->seat_id);
+        event_copy->seat_id = pool_copy (event->seat_id);
         event_copy->session_id = g_strdup (event->session_id);
-        event_copy->session_type = g_strdup (event->session_type);
-        event_copy->session_x11_display = g_strdup (event->session_x11_display);
-        event_copy->session_x11_display_device = g_strdup (event->session_x11_display_device);
-        event_copy->session_display_device = g_strdup (event->session_display_device);
-        event_copy->session_remote_host_name = g_strdup (event->session_remote_host_name);
+        event_copy->session_type = pool_copy (event->session_type);
+        event_copy->session_x11_display = pool_copy (event->session_x11_display);
+        event_copy->session_x11_display_device = pool_copy (event->session_x11_display_device);
+        event_copy->session_display_device = pool_copy (event->session_display_device);
+        event_copy->session_remote_host_name = pool_copy (event->session_remote_host_name);
         event_copy->session_is_local = event->session_is_local;
         event_copy->session_unix_user = event->session_unix_user;
         event_copy->session_creation_time = g_strdup (event->session_creation_time);
@@ -257,13 +280,13 @@ event_seat_session_removed_copy (CkLogSeatSessionRemovedEvent *event,
         g_assert (event != NULL);
         g_assert (event_copy != NULL);
 
-        event_copy->seat_id = g_strdup (event->seat_id);
+        event_copy->seat_id = pool_copy (event->seat_id);
         event_copy->session_id = g_strdup (event->session_id);
-        event_copy->session_type = g_strdup (event->session_type);
-        event_copy->session_x11_display = g_strdup (event->session_x11_display);
-        event_copy->session_x11_display_device = g_strdup (event->session_x11_display_device);
-        event_copy->session_display_device = g_strdup (event->session_display_device);
-        event_copy->session_remote_host_name = g_strdup (event->session_remote_host_name);
+        event_copy->session_type = pool_copy (event->session_type);
+        event_copy->session_x11_display = pool_copy (event->session_x11_display);
+        event_copy->session_x11_display_device = pool_copy (event->session_x11_display_device);
+        event_copy->session_display_device = pool_copy (event->session_display_device);
+        event_copy->session_remote_host_name = pool_copy (event->session_remote_host_name);
         event_copy->session_is_local = event->session_is_local;
         event_copy->session_unix_user = event->session_unix_user;
         event_copy->session_creation_time = g_strdup (event->session_creation_time);
@@ -276,7 +299,7 @@ event_seat_active_session_changed_copy (CkLogSeatActiveSessionChangedEvent *even
         g_assert (event != NULL);
         g_assert (event_copy != NULL);
 
-        event_copy->seat_id = g_strdup (event->seat_id);
+        event_copy->seat_id = pool_copy (event->seat_id);
         event_copy->session_id = g_strdup (event->session_id);
 }
 
@@ -287,9 +310,9 @@ event_seat_device_added_copy (CkLogSeatDeviceAddedEvent *event,
         g_assert (event != NULL);
         g_assert (event_copy != NULL);
 
-        event_copy->seat_id = g_strdup (event->seat_id);
+        event_copy->seat_id = pool_copy (event->seat_id);
         event_copy->device_id = g_strdup (event->device_id);
-        event_copy->device_type = g_strdup (event->device_type);
+        event_copy->device_type = pool_copy (event->device_type);
 }
 
 static void
@@ -299,9 +322,9 @@ event_seat_device_removed_copy (CkLogSeatDeviceRemovedEvent *event,
         g_assert (event != NULL);
         g_assert (event_copy != NULL);
 
-        event_copy->seat_id = g_strdup (event->seat_id);
+        event_copy->seat_id = pool_copy (event->seat_id);
         event_copy->device_id = g_strdup (event->device_id);
-        event_copy->device_type = g_strdup (event->device_type);
+        event_copy->device_type = pool_copy (event->device_type);
 }
 
 CkLogEvent *
@@ -792,7 +815,7 @@ parse_log_for_seat_added (const GString *str,
         }
 
         e = (CkLogSeatAddedEvent *)event;
-        e->seat_id = g_match_info_fetch_named (match_info, "seatid");
+        e->seat_id = pool_take (g_match_info_fetch_named (match_info, "seatid"));
 
         tmp = g_match_info_fetch_named (match_info, "seatkind");
         if (tmp != NULL) {
@@ -852,7 +875,7 @@ parse_log_for_seat_removed (const GString *str,
         }
 
         e = (CkLogSeatRemovedEvent *)event;
-        e->seat_id = g_match_info_fetch_named (match_info, "seatid");
+        e->seat_id = pool_take (g_match_info_fetch_named (match_info, "seatid"));
 
         tmp = g_match_info_fetch_named (match_info, "seatkind");
         if (tmp != NULL) {
@@ -1006,13 +1029,13 @@ parse_log_for_seat_session_added (const GString *str,
         }
 
         e = (CkLogSeatSessionAddedEvent *)event;
-        e->seat_id = g_match_info_fetch_named (match_info, "seatid");
+        e->seat_id = pool_take (g_match_info_fetch_named (match_info, "seatid"));
         e->session_id = g_match_info_fetch_named (match_info, "sessionid");
-        e->session_type = g_match_info_fetch_named (match_info, "sessiontype");
-        e->session_x11_display = g_match_info_fetch_named (match_info, "sessionx11display");
-        e->session_x11_display_device = g_match_info_fetch_named (match_info, "sessionx11displaydevice");
-        e->session_display_device = g_match_info_fetch_named (match_info, "sessiondisplaydevice");
-        e->session_remote_host_name = g_match_info_fetch_named (match_info, "sessionremotehostname");
+        e->session_type = pool_take (g_match_info_fetch_named (match_info, "sessiontype"));
+        e->session_x11_display = pool_take (g_match_info_fetch_named (match_info, "sessionx11display"));
+        e->session_x11_display_device = pool_take (g_match_info_fetch_named (match_info, "sessionx11displaydevice"));
+        e->session_display_device = pool_take (g_match_info_fetch_named (match_info, "sessiondisplaydevice"));
+        e->session_remote_host_name = pool_take (g_match_info_fetch_named (match_info, "sessionremotehostname"));
         e->session_creation_time = g_match_info_fetch_named (match_info, "sessioncreationtime");
 
         tmp = g_match_info_fetch_named (match_info, "sessionislocal");
@@ -1081,13 +1104,13 @@ parse_log_for_seat_session_removed (const GString *str,
         }
 
         e = (CkLogSeatSessionRemovedEvent *)event;
-        e->seat_id = g_match_info_fetch_named (match_info, "seatid");
+        e->seat_id = pool_take (g_match_info_fetch_named (match_info, "seatid"));
         e->session_id = g_match_info_fetch_named (match_info, "sessionid");
-        e->session_type = g_match_info_fetch_named (match_info, "sessiontype");
-        e->session_x11_display = g_match_info_fetch_named (match_info, "sessionx11display");
-        e->session_x11_display_device = g_match_info_fetch_named (match_info, "sessionx11displaydevice");
-        e->session_display_device = g_match_info_fetch_named (match_info, "sessiondisplaydevice");
-        e->session_remote_host_name = g_match_info_fetch_named (match_info, "sessionremotehostname");
+        e->session_type = pool_take (g_match_info_fetch_named (match_info, "sessiontype"));
+        e->session_x11_display = pool_take (g_match_info_fetch_named (match_info, "sessionx11display"));
+        e->session_x11_display_device = pool_take (g_match_info_fetch_named (match_info, "sessionx11displaydevice"));
+        e->session_display_device = pool_take (g_match_info_fetch_named (match_info, "sessiondisplaydevice"));
+        e->session_remote_host_name = pool_take (g_match_info_fetch_named (match_info, "sessionremotehostname"));
         e->session_creation_time = g_match_info_fetch_named (match_info, "sessioncreationtime");
 
         tmp = g_match_info_fetch_named (match_info, "sessionislocal");
@@ -1155,7 +1178,7 @@ parse_log_for_seat_active_session_changed (const GString *str,
         }
 
         e = (CkLogSeatActiveSessionChangedEvent *)event;
-        e->seat_id = g_match_info_fetch_named (match_info, "seatid");
+        e->seat_id = pool_take (g_match_info_fetch_named (match_info, "seatid"));
         e->session_id = g_match_info_fetch_named (match_info, "sessionid");
 
         ret = TRUE;
@@ -1207,9 +1230,9 @@ parse_log_for_seat_device_added (const GString *str,
         }
 
         e = (CkLogSeatDeviceAddedEvent *)event;
-        e->seat_id = g_match_info_fetch_named (match_info, "seatid");
+        e->seat_id = pool_take (g_match_info_fetch_named (match_info, "seatid"));
         e->device_id = g_match_info_fetch_named (match_info, "deviceid");
-        e->device_type = g_match_info_fetch_named (match_info, "devicetype");
+        e->device_type = pool_take (g_match_info_fetch_named (match_info, "devicetype"));
 
         ret = TRUE;
  out:
@@ -1260,9 +1283,9 @@ parse_log_for_seat_device_removed (const GString *str,
         }
 
         e = (CkLogSeatDeviceRemovedEvent *)event;
-        e->seat_id = g_match_info_fetch_named (match_info, "seatid");
+        e->seat_id = pool_take (g_match_info_fetch_named (match_info, "seatid"));
         e->device_id = g_match_info_fetch_named (match_info, "deviceid");
-        e->device_type = g_match_info_fetch_named (match_info, "devicetype");
+        e->device_type = pool_take (g_match_info_fetch_named (match_info, "devicetype"));
 
         ret = TRUE;
  out:
@@ -37,6 +37,7 @@
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 #include <glib-object.h>
+#include <glib-unix.h>
 #include <gio/gio.h>
 #include <gio/gunixfdlist.h>
 
@@ -57,11 +58,27 @@
 #include "ck-inhibit.h"
 #include "ck-sysdeps.h"
 #include "ck-process-group.h"
+#include "ck-caller-cache.h"
+#include "ck-pid-index.h"
+#include "ck-query-server.h"
+#include "ck-statistics.h"
+#include "ck-watchdog.h"
+#include "ck-string-pool.h"
 
 #define CK_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CK_TYPE_MANAGER, CkManagerPrivate))
 
 #define CK_SEAT_DIR            SYSCONFDIR "/ConsoleKit/seats.d"
 #define LOG_FILE               LOCALSTATEDIR "/log/ConsoleKit/history"
+#define DATABASE_FILE          RUNDIR "/ConsoleKit/database"
+/* Same as the database plus the session cookies, readable by root
+ * only. It is what a restarted daemon restores its sessions from. */
+#define RESTORE_FILE           RUNDIR "/ConsoleKit/restore"
+
+/* How often the sleep capabilities are probed again, in seconds */
+#define SLEEP_PROBE_INTERVAL   60
+
+/* OpenSession calls beyond this many waiting are refused as busy */
+#define MAX_QUEUED_OPENS       1024
 
 typedef enum {
         PREPARE_FOR_SHUTDOWN,
@@ -77,23 +94,147 @@ typedef struct
         CkLogEventType         event_type;
         const gchar           *description;
         SIGNALS                signal;
+        /* when the PrepareFor signal went out */
+        gint64                 delay_start;
 } SystemActionData;
 
+/* What the Can* sleep methods answer from, see refresh_sleep_capabilities */
+typedef struct
+{
+        gboolean can_suspend;
+        gboolean can_hibernate;
+        gboolean can_hybrid_sleep;
+} SleepCapabilities;
+
+/* Opening a session goes through these stages in order. The slow ones
+ * run on worker threads, so OpenSession calls overlap rather than
+ * queueing up behind each other on the main loop.
+ */
+typedef enum
+{
+        OPEN_STAGE_RUNTIME_DIR,
+        OPEN_STAGE_PROCESS_GROUP,
+        OPEN_STAGE_ATTACH,
+        OPEN_STAGE_LAST
+} OpenSessionStage;
+
+/* A serialized copy of the state database waiting to be written */
+typedef struct
+{
+        gchar *data;
+        gsize  len;
+        gchar *restore_data;
+        gsize  restore_len;
+        guint  serial;
+} DumpSnapshot;
+
+/* Per-uid bookkeeping so we don't have to walk every session to answer
+ * questions about a user. Entries exist only while the user has at least
+ * one session open.
+ */
+typedef struct
+{
+        guint       uid;
+        /* FALSE for display manager accounts (gdm, sddm, kdm) */
+        gboolean    is_real_user;
+        /* Shared by all of the user's sessions, removed with the last one */
+        gchar      *runtime_dir;
+        /* set of CkSession* (no reference held, the sessions table owns it) */
+        GHashTable *sessions;
+} CkManagerUser;
+
 struct CkManagerPrivate
 {
 #ifdef HAVE_POLKIT
         PolkitAuthority *pol_ctx;
+
+        /* Answers to the Can* queries, see check_polkit_decision */
+        GHashTable      *polkit_decisions;
+        guint            polkit_generation;
 #endif
 
         GHashTable      *seats;
         GHashTable      *sessions;
         GHashTable      *leaders;
 
-        GDBusProxy      *bus_proxy;
+        /* Secondary indexes over sessions, kept in sync by
+         * manager_index_session and manager_unindex_session.
+         * users: uid -> CkManagerUser
+         * busy_sessions: set of CkSession* with the idle-hint unset
+         */
+        GHashTable      *users;
+        GHashTable      *busy_sessions;
+        guint            num_real_users;
+        /* process -> session, for GetSessionForUnixProcess */
+        CkPidIndex      *pid_index;
+        /* answers the read-only queries off the main loop */
+        CkQueryServer   *query_server;
+        /* org.freedesktop.ConsoleKit.Statistics, on the manager object */
+        CkStatistics    *statistics;
+
+        /* Replies to the list methods, built when first asked for and
+         * dropped when the sessions, seats or inhibitors change */
+        GVariant        *get_sessions_reply;
+        GVariant        *list_sessions_reply;
+        GVariant        *get_seats_reply;
+        GVariant        *list_seats_reply;
+        GVariant        *list_inhibitors_reply;
+        guint            list_inhibitors_serial;
+
         GDBusConnection *connection;
         CkEventLogger   *logger;
 
-        guint            name_owner_id;
+        /* org.freedesktop.DBus.ObjectManager at CK_DBUS_PATH, every
+         * seat and session is exported on the bus through it */
+        GDBusObjectManagerServer *object_manager;
+
+        /* State database writer. The writer thread only ever touches
+         * the fields protected by dump_lock.
+         */
+        GThreadPool     *dump_pool;
+        GMutex           dump_lock;
+        guint            dump_interval;
+        guint            dump_id;
+        guint            dump_serial;
+        guint            dump_requests;
+        guint            dump_written_serial;   /* dump_lock */
+        guint            dump_writes;           /* dump_lock */
+        gint64           dump_total_usec;       /* dump_lock */
+        gint64           dump_max_usec;         /* dump_lock */
+
+        /* uid -> OpeningUser, for the sessions being opened */
+        GHashTable      *opening_users;
+        /* total time spent in each OpenSessionStage */
+        gint64           open_stage_usec[OPEN_STAGE_LAST];
+        guint            opens;
+
+        /* OpenSession admission control, see open_session_enqueue.
+         * open_admitted: set of the CkSessionLeaders being opened
+         * open_queues: uid -> GQueue of QueuedOpen
+         * open_queue_uids: the uids in open_queues, in the order
+         *                  they get their next turn
+         */
+        guint            max_opening;
+        GHashTable      *open_admitted;
+        GHashTable      *open_queues;
+        GQueue           open_queue_uids;
+        guint            open_queued;
+        guint            open_queued_max;
+        guint            open_rejected;
+        guint            open_admissions;
+        gint64           open_wait_usec;
+        gint64           open_wait_max_usec;
+        gboolean         open_admitting;
+
+        /* SessionsChanged batching, ssid -> object path */
+        guint            sessions_changed_interval;
+        guint            sessions_changed_id;
+        GHashTable      *sessions_added;
+        GHashTable      *sessions_removed;
+
+        /* unique bus name -> LeaderConnection, only for the names
+         * that own at least one session leader */
+        GHashTable      *leader_connections;
 
         guint32          session_serial;
         guint32          seat_serial;
@@ -101,27 +242,40 @@ struct CkManagerPrivate
         gboolean         system_idle_hint;
         GTimeVal         system_idle_since_hint;
 
-        /* How long to delay after emitting the PREPARE_FOR_SHUTDOWN or
-         * PREPARE_FOR_SLEEP signal
-         */
-        guint            system_action_idle_delay;
-        /* How long to delay after emitting the PREPARE_FOR_SHUTDOWN or
-         * PREPARE_FOR_SLEEP signal with something holding the delay
-         * inhibit
+        /* The longest the delay inhibitors can hold up a system
+         * action after the PREPARE_FOR_SHUTDOWN or PREPARE_FOR_SLEEP
+         * signal, in seconds
          */
-        guint            system_action_idle_inhibited_delay;
-        /* The idle callback id so we can detect multiple attempts to
-         * perform a system action at the same time
+        guint            inhibit_delay_max;
+        /* The idle or timeout callback id so we can detect multiple
+         * attempts to perform a system action at the same time
          */
         guint            system_action_idle_id;
-        /* Now that the action data can be delayed and that delay can
-         * be lifted sooner than system_action_idle_inhibited_delay,
-         * we need to keep a pointer to the system action data so we
-         * can manually call system_action_idle_cb
+        /* The action waiting for its delay inhibitors to be released,
+         * it is started as soon as the last one goes away
          */
         SystemActionData *system_action_data;
+        /* time spent waiting on delay inhibitors */
+        guint            system_action_delays;
+        guint            system_action_delay_timeouts;
+        gint64           system_action_delay_usec;
+        gint64           system_action_delay_max_usec;
+        /* The child watch of the command carrying out the action,
+         * the action is still in progress until it exits
+         */
+        guint            system_action_child_id;
 
         CkInhibitManager *inhibit_manager;
+
+        /* Probing means file I/O, and used to mean spawning grep too,
+         * so it is done at startup and then on a worker thread.
+         */
+        SleepCapabilities sleep_caps;
+        guint            sleep_probe_id;
+        guint            sleep_swap_watch_id;
+        int              sleep_swap_fd;
+        gboolean         sleep_probe_running;
+        gboolean         sleep_probe_again;
 };
 
 static void     ck_manager_iface_init  (ConsoleKitManagerIface *iface);
@@ -134,6 +288,7 @@ static gboolean session_is_real_user           (CkSession *session,
                                                 char     **userp);
 static CkSession* get_session_from_id          (CkManager   *manager,
                                                 const gchar *arg_session_id);
+static void     open_session_admit_queued      (CkManager *manager);
 
 static gpointer manager_object = NULL;
 
@@ -187,6 +342,14 @@ dump_state_leader_iter (char            *id,
         ck_session_leader_dump (leader, key_file);
 }
 
+static void
+dump_secrets_leader_iter (char            *id,
+                          CkSessionLeader *leader,
+                          GKeyFile        *key_file)
+{
+        ck_session_leader_dump_secrets (leader, key_file);
+}
+
 typedef struct {
         GString *sessions;
         gboolean is_local;
@@ -310,21 +473,22 @@ dump_user_section (CkManager *manager,
         g_hash_table_destroy (users_hash);
 }
 
-static gboolean
-do_dump (CkManager *manager,
-         int        fd)
+/* Serializes the state database. When @restore_data is given it also
+ * gets a copy that includes the leaders' cookies, for RESTORE_FILE.
+ */
+static gchar *
+dump_to_data (CkManager *manager,
+              gsize     *len,
+              gchar    **restore_data,
+              gsize     *restore_len)
 {
         char     *str;
         char     *s;
-        gsize     str_len;
         GString  *seats_string;
         GKeyFile *key_file;
         GError   *error;
-        gboolean  ret;
 
-        str = NULL;
         error = NULL;
-        ret = FALSE;
 
         key_file = g_key_file_new ();
 
@@ -341,49 +505,31 @@ do_dump (CkManager *manager,
 
         dump_user_section (manager, key_file);
 
-        str = g_key_file_to_data (key_file, &str_len, &error);
-        g_key_file_free (key_file);
-        if (str != NULL) {
-                ssize_t written;
-
-                written = 0;
-                while ((size_t)written < str_len) {
-                        ssize_t num_written;
-                        num_written = write (fd, str + written, str_len - written);
-                        if (num_written < 0) {
-                                if (errno == EAGAIN || errno == EINTR) {
-                                        continue;
-                                } else {
-                                        g_warning ("Error writing state file: %s", strerror (errno));
-                                        goto out;
-                                }
-                        }
-                        written += num_written;
-                }
-        } else {
+        str = g_key_file_to_data (key_file, len, &error);
+        if (str == NULL) {
                 g_warning ("Couldn't construct state file: %s", error->message);
                 g_error_free (error);
+        } else if (restore_data != NULL) {
+                g_hash_table_foreach (manager->priv->leaders, (GHFunc) dump_secrets_leader_iter, key_file);
+                *restore_data = g_key_file_to_data (key_file, restore_len, NULL);
         }
+        g_key_file_free (key_file);
 
-        ret = TRUE;
-
-out:
-        g_free (str);
-        return ret;
+        return str;
 }
 
-static void
-ck_manager_dump (CkManager *manager)
+/* Runs on the writer thread, so it must not touch the manager */
+static gboolean
+write_database (const char  *filename,
+                mode_t       mode,
+                const gchar *str,
+                gsize        str_len)
 {
         int         fd;
         int         res;
-        const char *filename = RUNDIR "/ConsoleKit/database";
-        const char *filename_tmp = RUNDIR "/ConsoleKit/database~";
-
-        if (manager == NULL) {
-                g_warning ("ck_manager_dump: manager == NULL");
-                return;
-        }
+        ssize_t     written;
+        gboolean    ret = FALSE;
+        char       *filename_tmp;
 
         /* always make sure we have a directory */
         errno = 0;
@@ -393,27 +539,33 @@ ck_manager_dump (CkManager *manager)
                 g_warning ("Unable to create directory %s (%s)",
                            RUNDIR "/ConsoleKit",
                            g_strerror (errno));
-                return;
+                return FALSE;
         }
 
-        g_debug ("ck_manager_dump: %s/ConsoleKit folder created", RUNDIR);
+        filename_tmp = g_strconcat (filename, "~", NULL);
 
-        fd = g_open (filename_tmp, O_CREAT | O_WRONLY, 0644);
+        fd = g_open (filename_tmp, O_CREAT | O_WRONLY | O_TRUNC, mode);
         if (fd == -1) {
                 g_warning ("Cannot create file %s: %s", filename_tmp, g_strerror (errno));
                 goto error;
         }
 
-        g_debug ("ck_manager_dump: %s created", filename_tmp);
-
-        if (! do_dump (manager, fd)) {
-                g_warning ("Cannot write to file %s", filename_tmp);
-                close (fd);
-                goto error;
+        written = 0;
+        while ((size_t)written < str_len) {
+                ssize_t num_written;
+                num_written = write (fd, str + written, str_len - written);
+                if (num_written < 0) {
+                        if (errno == EAGAIN || errno == EINTR) {
+                                continue;
+                        } else {
+                                g_warning ("Error writing state file %s: %s", filename_tmp, strerror (errno));
+                                close (fd);
+                                goto error;
+                        }
+                }
+                written += num_written;
         }
 
-        g_debug ("ck_manager_dump: wrote database to %s", filename_tmp);
-
  again:
         if (close (fd) != 0) {
                 if (errno == EINTR)
@@ -429,15 +581,332 @@ ck_manager_dump (CkManager *manager)
                 goto error;
         }
 
-        g_debug ("ck_manager_dump: renamed %s to %s, operation successful", filename_tmp, filename);
-
-        return;
+        ret = TRUE;
+        goto out;
 error:
         /* For security reasons; unlink the existing file since it
            contains outdated information */
         if (g_unlink (filename) != 0) {
                 g_warning ("Cannot unlink %s: %s", filename, g_strerror (errno));
         }
+out:
+        g_free (filename_tmp);
+        return ret;
+}
+
+static void
+dump_snapshot_free (DumpSnapshot *snapshot)
+{
+        g_free (snapshot->data);
+        g_free (snapshot->restore_data);
+        g_free (snapshot);
+}
+
+/* Writes out a snapshot unless a newer one already made it to disk.
+ * Called from the writer thread or, when flushing, the main thread.
+ */
+static void
+dump_write_snapshot (CkManager    *manager,
+                     DumpSnapshot *snapshot)
+{
+        CkManagerPrivate *priv = manager->priv;
+        gint64            start;
+        gint64            elapsed;
+
+        g_mutex_lock (&priv->dump_lock);
+
+        if (snapshot->serial > priv->dump_written_serial) {
+                start = g_get_monotonic_time ();
+
+                write_database (DATABASE_FILE, 0644, snapshot->data, snapshot->len);
+                if (snapshot->restore_data != NULL) {
+                        write_database (RESTORE_FILE, 0600, snapshot->restore_data, snapshot->restore_len);
+                }
+
+                elapsed = g_get_monotonic_time () - start;
+
+                priv->dump_written_serial = snapshot->serial;
+                priv->dump_writes++;
+                priv->dump_total_usec += elapsed;
+                priv->dump_max_usec = MAX (priv->dump_max_usec, elapsed);
+
+                g_debug ("ck_manager_dump: wrote snapshot %u (%" G_GSIZE_FORMAT " bytes) in %" G_GINT64_FORMAT " us; "
+                         "%u writes, avg %" G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us",
+                         snapshot->serial, snapshot->len, elapsed,
+                         priv->dump_writes,
+                         priv->dump_total_usec / priv->dump_writes,
+                         priv->dump_max_usec);
+        } else {
+                g_debug ("ck_manager_dump: snapshot %u superseded by %u, skipping",
+                         snapshot->serial, priv->dump_written_serial);
+        }
+
+        g_mutex_unlock (&priv->dump_lock);
+
+        dump_snapshot_free (snapshot);
+}
+
+static void
+dump_thread_func (gpointer data,
+                  gpointer user_data)
+{
+        dump_write_snapshot (CK_MANAGER (user_data), data);
+}
+
+static DumpSnapshot *
+dump_take_snapshot (CkManager *manager)
+{
+        DumpSnapshot *snapshot;
+        gchar        *data;
+        gsize         len = 0;
+        gchar        *restore_data = NULL;
+        gsize         restore_len = 0;
+
+        data = dump_to_data (manager, &len, &restore_data, &restore_len);
+        if (data == NULL) {
+                return NULL;
+        }
+
+        snapshot = g_new0 (DumpSnapshot, 1);
+        snapshot->data = data;
+        snapshot->len = len;
+        snapshot->restore_data = restore_data;
+        snapshot->restore_len = restore_len;
+        snapshot->serial = ++manager->priv->dump_serial;
+
+        g_debug ("ck_manager_dump: snapshot %u covers %u requests",
+                 snapshot->serial, manager->priv->dump_requests);
+        manager->priv->dump_requests = 0;
+
+        return snapshot;
+}
+
+/* Writes the current state to disk before returning. Use this when
+ * something is about to read the database, e.g. the run-programs hooks.
+ */
+static void
+ck_manager_dump_flush (CkManager *manager)
+{
+        DumpSnapshot *snapshot;
+
+        if (manager->priv->dump_id != 0) {
+                g_source_remove (manager->priv->dump_id);
+                manager->priv->dump_id = 0;
+        }
+
+        snapshot = dump_take_snapshot (manager);
+        if (snapshot != NULL) {
+                dump_write_snapshot (manager, snapshot);
+        }
+}
+
+static gboolean
+dump_timeout_cb (CkManager *manager)
+{
+        DumpSnapshot *snapshot;
+        GError       *error = NULL;
+
+        manager->priv->dump_id = 0;
+
+        snapshot = dump_take_snapshot (manager);
+        if (snapshot == NULL) {
+                return FALSE;
+        }
+
+        if (manager->priv->dump_pool == NULL ||
+            !g_thread_pool_push (manager->priv->dump_pool, snapshot, &error)) {
+                if (error != NULL) {
+                        g_warning ("Unable to queue database write: %s", error->message);
+                        g_error_free (error);
+                }
+                dump_write_snapshot (manager, snapshot);
+        }
+
+        return FALSE;
+}
+
+/* Marks the state database as dirty. Bursts of changes are coalesced
+ * into a single write, at most one every dump_interval ms, serialized
+ * here and written out on the writer thread. Changes that a hook or a
+ * D-Bus signal announces right away use ck_manager_dump_flush instead,
+ * since whoever reacts to them reads the database.
+ */
+static void
+ck_manager_dump (CkManager *manager)
+{
+        if (manager == NULL) {
+                g_warning ("ck_manager_dump: manager == NULL");
+                return;
+        }
+
+        manager->priv->dump_requests++;
+
+        if (manager->priv->dump_interval == 0) {
+                ck_manager_dump_flush (manager);
+                return;
+        }
+
+        if (manager->priv->dump_id == 0) {
+                manager->priv->dump_id = g_timeout_add (manager->priv->dump_interval,
+                                                        (GSourceFunc) dump_timeout_cb,
+                                                        manager);
+        }
+}
+
+/**
+ * ck_manager_set_dump_interval:
+ * @manager: the @CkManager object
+ * @msec: the minimum time between writes of the state database,
+ *        0 writes it out synchronously on every change.
+ *
+ * A write that is already pending is rescheduled with @msec.
+ **/
+void
+ck_manager_set_dump_interval (CkManager *manager,
+                              guint      msec)
+{
+        g_return_if_fail (CK_IS_MANAGER (manager));
+
+        g_debug ("state database write interval: %u ms", msec);
+
+        manager->priv->dump_interval = msec;
+
+        /* registering the manager already asked for the first write */
+        if (manager->priv->dump_id == 0) {
+                return;
+        }
+
+        if (msec == 0) {
+                ck_manager_dump_flush (manager);
+                return;
+        }
+
+        g_source_remove (manager->priv->dump_id);
+        manager->priv->dump_id = g_timeout_add (msec,
+                                                (GSourceFunc) dump_timeout_cb,
+                                                manager);
+}
+
+static GVariant *
+sessions_changed_list (GHashTable *sessions)
+{
+        GVariantBuilder builder;
+        GHashTableIter  iter;
+        gpointer        ssid;
+        gpointer        path;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(so)"));
+        g_hash_table_iter_init (&iter, sessions);
+        while (g_hash_table_iter_next (&iter, &ssid, &path)) {
+                g_variant_builder_add (&builder, "(so)", ssid, path);
+        }
+        g_hash_table_remove_all (sessions);
+
+        return g_variant_builder_end (&builder);
+}
+
+static gboolean
+sessions_changed_timeout_cb (CkManager *manager)
+{
+        GVariant *added;
+        GVariant *removed;
+
+        manager->priv->sessions_changed_id = 0;
+
+        if (g_hash_table_size (manager->priv->sessions_added) == 0
+            && g_hash_table_size (manager->priv->sessions_removed) == 0) {
+                return FALSE;
+        }
+
+        added = sessions_changed_list (manager->priv->sessions_added);
+        removed = sessions_changed_list (manager->priv->sessions_removed);
+
+        g_debug ("Emitting sessions-changed: %" G_GSIZE_FORMAT " added, %" G_GSIZE_FORMAT " removed",
+                 g_variant_n_children (added), g_variant_n_children (removed));
+        console_kit_manager_emit_sessions_changed (CONSOLE_KIT_MANAGER (manager), added, removed);
+
+        return FALSE;
+}
+
+/* Queues a session for the next SessionsChanged signal. A session that
+ * comes and goes within one batch isn't reported at all.
+ */
+static void
+queue_sessions_changed (CkManager  *manager,
+                        const char *ssid,
+                        const char *path,
+                        gboolean    added)
+{
+        if (added) {
+                g_hash_table_insert (manager->priv->sessions_added, g_strdup (ssid), g_strdup (path));
+        } else if (!g_hash_table_remove (manager->priv->sessions_added, ssid)) {
+                g_hash_table_insert (manager->priv->sessions_removed, g_strdup (ssid), g_strdup (path));
+        }
+
+        if (manager->priv->sessions_changed_interval == 0) {
+                sessions_changed_timeout_cb (manager);
+                return;
+        }
+
+        if (manager->priv->sessions_changed_id == 0) {
+                manager->priv->sessions_changed_id = g_timeout_add (manager->priv->sessions_changed_interval,
+                                                                    (GSourceFunc) sessions_changed_timeout_cb,
+                                                                    manager);
+        }
+}
+
+/**
+ * ck_manager_set_sessions_changed_interval:
+ * @manager: the @CkManager object
+ * @msec: the minimum time between SessionsChanged signals,
+ *        0 emits one for every change.
+ **/
+void
+ck_manager_set_sessions_changed_interval (CkManager *manager,
+                                          guint      msec)
+{
+        g_return_if_fail (CK_IS_MANAGER (manager));
+
+        g_debug ("SessionsChanged interval: %u ms", msec);
+
+        manager->priv->sessions_changed_interval = msec;
+}
+
+/**
+ * ck_manager_set_inhibit_delay_max:
+ * @manager: the @CkManager object
+ * @sec: the longest the delay inhibitors can hold up shutdown or
+ *       sleep, like logind's InhibitDelayMaxSec.
+ **/
+void
+ck_manager_set_inhibit_delay_max (CkManager *manager,
+                                  guint      sec)
+{
+        g_return_if_fail (CK_IS_MANAGER (manager));
+
+        g_debug ("InhibitDelayMaxSec: %u", sec);
+
+        manager->priv->inhibit_delay_max = sec;
+}
+
+/**
+ * ck_manager_set_max_opening:
+ * @manager: the @CkManager object
+ * @max_opening: how many sessions may be opened at the same time,
+ *               0 for no limit.
+ *
+ * Further OpenSession calls wait their turn.
+ **/
+void
+ck_manager_set_max_opening (CkManager *manager,
+                            guint      max_opening)
+{
+        g_return_if_fail (CK_IS_MANAGER (manager));
+
+        g_debug ("Opening at most %u sessions at once", max_opening);
+
+        manager->priv->max_opening = max_opening;
+        open_session_admit_queued (manager);
 }
 
 
@@ -945,14 +1414,15 @@ log_seat_device_removed_event (CkManager   *manager,
         g_free (device_id);
 }
 
-static char *
-get_cookie_for_pid (CkManager *manager,
-                    guint      pid)
+static CkSession *
+resolve_session_for_pid (CkManager *manager,
+                         guint      pid)
 {
-        char            *cookie = NULL;
         gchar           *ssid = NULL;
+        char            *cookie;
         CkProcessGroup  *pgroup;
-        CkSession       *session;
+        CkSession       *session = NULL;
+        CkSessionLeader *leader;
 
         pgroup = ck_process_group_get ();
 
@@ -960,19 +1430,59 @@ get_cookie_for_pid (CkManager *manager,
 
         if (ssid != NULL) {
                 g_debug ("looking for session for ssid %s", ssid);
+                session = g_hash_table_lookup (manager->priv->sessions, ssid);
+                g_free (ssid);
+        }
+
+        if (session == NULL) {
+                cookie = ck_unix_pid_get_env (pid, "XDG_SESSION_COOKIE");
+                if (cookie == NULL) {
+                        return NULL;
+                }
+
+                leader = g_hash_table_lookup (manager->priv->leaders, cookie);
+                if (leader != NULL) {
+                        session = g_hash_table_lookup (manager->priv->sessions,
+                                                       ck_session_leader_peek_session_id (leader));
+                }
+                g_free (cookie);
+        }
+
+        return session;
+}
+
+/* Returns the session @pid belongs to, only going to the process
+ * group backend and /proc the first time a process is seen. */
+static CkSession *
+get_session_for_pid (CkManager *manager,
+                     guint      pid)
+{
+        const char *ssid;
+        CkSession  *session;
+        guint64     start_time;
+
+        ssid = ck_pid_index_lookup (manager->priv->pid_index, pid);
+        if (ssid != NULL) {
                 session = g_hash_table_lookup (manager->priv->sessions, ssid);
                 if (session != NULL) {
-                        g_object_get (session, "cookie", &cookie, NULL);
+                        return session;
                 }
+        }
 
-                g_free (ssid);
+        if (! ck_pid_index_get_start_time (pid, &start_time)) {
+                return NULL;
         }
 
-        if (cookie == NULL) {
-                cookie = ck_unix_pid_get_env (pid, "XDG_SESSION_COOKIE");
+        session = resolve_session_for_pid (manager, pid);
+        if (session != NULL) {
+                char *sid = NULL;
+
+                ck_session_get_id (session, &sid, NULL);
+                ck_pid_index_insert (manager->priv->pid_index, pid, start_time, sid);
+                g_free (sid);
         }
 
-        return cookie;
+        return session;
 }
 
 typedef void (*AuthorizedCallback) (CkManager             *manager,
@@ -1062,175 +1572,315 @@ check_polkit_permissions (CkManager             *manager,
         g_object_unref (subject);
 }
 
-static void
-ready_cb (PolkitAuthority *authority,
-          GAsyncResult    *res,
-          GDBusMethodInvocation *context)
+/* The answer to a Can* query, as the polkit result maps onto it */
+typedef enum
 {
-        PolkitAuthorizationResult *ret;
-        GError *error;
+        POLKIT_DECISION_NO,
+        POLKIT_DECISION_CHALLENGE,
+        POLKIT_DECISION_YES,
+} PolkitDecision;
 
-        error = NULL;
-        ret = polkit_authority_check_authorization_finish (authority, res, &error);
-        if (error != NULL) {
-                throw_error (context, CK_MANAGER_ERROR_FAILED, error->message);
-                g_clear_error (&error);
-        }
-        else if (polkit_authorization_result_get_is_authorized (ret)) {
-                g_dbus_method_invocation_return_value (context, g_variant_new ("(b)", TRUE));
-        }
-        else if (polkit_authorization_result_get_is_challenge (ret)) {
-                g_dbus_method_invocation_return_value (context, g_variant_new ("(b)", TRUE));
-        }
-        else {
-                g_dbus_method_invocation_return_value (context, g_variant_new ("(b)", FALSE));
-        }
+typedef void (* PolkitDecisionReply) (GDBusMethodInvocation *context,
+                                      PolkitDecision         decision);
 
-        g_object_unref (ret);
+static void
+reply_can_boolean (GDBusMethodInvocation *context,
+                   PolkitDecision         decision)
+{
+        g_dbus_method_invocation_return_value (context, g_variant_new ("(b)", decision != POLKIT_DECISION_NO));
 }
 
 /* We use this to avoid breaking API compability with ConsoleKit1 for
  * CanStop and CanRestart, but this method emulates how logind
  * presents it's API */
 static void
-logind_ready_cb (PolkitAuthority *authority,
-                 GAsyncResult    *res,
-                 GDBusMethodInvocation *context)
+reply_can_logind (GDBusMethodInvocation *context,
+                  PolkitDecision         decision)
 {
-        PolkitAuthorizationResult *ret;
-        GError *error;
+        const char *answer;
 
-        error = NULL;
-        ret = polkit_authority_check_authorization_finish (authority, res, &error);
-        if (error != NULL) {
-                throw_error (context, CK_MANAGER_ERROR_FAILED, error->message);
-                g_clear_error (&error);
+        switch (decision) {
+        case POLKIT_DECISION_YES:
+                answer = "yes";
+                break;
+        case POLKIT_DECISION_CHALLENGE:
+                answer = "challenge";
+                break;
+        default:
+                answer = "no";
+                break;
         }
-        else if (polkit_authorization_result_get_is_authorized (ret)) {
-                g_dbus_method_invocation_return_value (context, g_variant_new ("(s)", "yes"));
-        }
-        else if (polkit_authorization_result_get_is_challenge (ret)) {
-                g_dbus_method_invocation_return_value (context, g_variant_new ("(s)", "challenge"));
+
+        g_dbus_method_invocation_return_value (context, g_variant_new ("(s)", answer));
+}
+#endif
+
+/* Continuation for D-Bus handlers that need to know who is calling.
+ * Only runs if the caller's credentials could be resolved, otherwise
+ * the invocation has already been answered with an error.
+ */
+typedef void (* CallerInfoFunc) (CkManager             *manager,
+                                 GDBusMethodInvocation *context,
+                                 uid_t                  calling_uid,
+                                 pid_t                  calling_pid,
+                                 gpointer               data);
+
+typedef struct
+{
+        CkManager             *manager;
+        GDBusMethodInvocation *context;
+        CallerInfoFunc         func;
+        gpointer               data;
+        GDestroyNotify         destroy;
+} CallerInfoData;
+
+static void
+caller_info_ready_cb (CkCallerCache *cache,
+                      const gchar   *sender,
+                      gboolean       success,
+                      uid_t          uid,
+                      pid_t          pid,
+                      gpointer       user_data)
+{
+        CallerInfoData *info = user_data;
+
+        if (success) {
+                info->func (info->manager, info->context, uid, pid, info->data);
+        } else {
+                g_debug ("Unable to get information about the calling process");
+                throw_error (info->context, CK_MANAGER_ERROR_GENERAL, _("Unable to get information about the calling process"));
         }
-        else {
-                g_dbus_method_invocation_return_value (context, g_variant_new ("(s)", "no"));
+
+        if (info->destroy != NULL && info->data != NULL) {
+                info->destroy (info->data);
         }
 
-        g_object_unref (ret);
+        g_object_unref (info->context);
+        g_object_unref (info->manager);
+        g_free (info);
 }
 
-/* We use this to avoid breaking API compability with ConsoleKit1 for
- * CanStop and CanRestart, but this method emulates how logind
- * presents it's API */
+/* Resolves the sender of @context through the caller cache and then
+ * calls @func. This may happen before with_caller_info returns when the
+ * sender is already known, or later from the main loop. @destroy is
+ * called on @data once @func is done with it.
+ */
 static void
-get_polkit_logind_permissions (CkManager   *manager,
-                               const char  *action,
-                               GDBusMethodInvocation *context)
+with_caller_info (CkManager             *manager,
+                  GDBusMethodInvocation *context,
+                  CallerInfoFunc         func,
+                  gpointer               data,
+                  GDestroyNotify         destroy)
+{
+        CallerInfoData *info;
+
+        info = g_new0 (CallerInfoData, 1);
+        info->manager = g_object_ref (manager);
+        info->context = g_object_ref (context);
+        info->func = func;
+        info->data = data;
+        info->destroy = destroy;
+
+        ck_caller_cache_resolve (ck_caller_cache_get (),
+                                 manager->priv->connection,
+                                 g_dbus_method_invocation_get_sender (context),
+                                 caller_info_ready_cb,
+                                 info);
+}
+
+#ifdef HAVE_POLKIT
+/* Can* queries are answered from here for a short while. Entries are
+ * keyed by everything polkit bases the answer on for a given caller:
+ * the user, the action and whether their session is active and local.
+ */
+#define POLKIT_DECISION_TTL             (5 * G_USEC_PER_SEC)
+#define POLKIT_DECISION_MAX_ENTRIES     256
+
+typedef struct
 {
-        const char    *sender;
-        PolkitSubject *subject;
+        PolkitDecision decision;
+        gint64         expires;
+} PolkitDecisionEntry;
 
-        g_debug ("get permissions for action %s", action);
+typedef struct
+{
+        CkManager             *manager;
+        GDBusMethodInvocation *context;
+        char                  *key;
+        PolkitDecisionReply    reply;
+        /* the cache may not be filled if it was flushed since we asked */
+        guint                  generation;
+} PolkitDecisionQuery;
 
-        sender = g_dbus_method_invocation_get_sender (context);
-        subject = polkit_system_bus_name_new (sender);
+typedef struct
+{
+        char                  *action;
+        PolkitDecisionReply    reply;
+} PolkitDecisionRequest;
 
-        polkit_authority_check_authorization (manager->priv->pol_ctx,
-                                              subject,
-                                              action,
-                                              NULL,
-                                              0,
-                                              NULL,
-                                              (GAsyncReadyCallback) logind_ready_cb,
-                                              context);
-        g_object_unref (subject);
+static void
+polkit_decision_request_free (PolkitDecisionRequest *request)
+{
+        g_free (request->action);
+        g_free (request);
 }
 
 static void
-get_polkit_permissions (CkManager   *manager,
-                        const char  *action,
-                        GDBusMethodInvocation *context)
+polkit_decisions_flush (CkManager *manager)
 {
-        const char    *sender;
-        PolkitSubject *subject;
-
-        g_debug ("get permissions for action %s", action);
+        g_debug ("flushing polkit decisions");
 
-        sender = g_dbus_method_invocation_get_sender (context);
-        subject = polkit_system_bus_name_new (sender);
+        manager->priv->polkit_generation++;
+        g_hash_table_remove_all (manager->priv->polkit_decisions);
+}
 
-        polkit_authority_check_authorization (manager->priv->pol_ctx,
-                                              subject,
-                                              action,
-                                              NULL,
-                                              0,
-                                              NULL,
-                                              (GAsyncReadyCallback) ready_cb,
-                                              context);
-        g_object_unref (subject);
+static void
+on_polkit_authority_changed (PolkitAuthority *authority,
+                             CkManager       *manager)
+{
+        polkit_decisions_flush (manager);
 }
-#endif
 
-/* adapted from PolicyKit */
-static gboolean
-get_caller_info (CkManager   *manager,
-                 const char  *sender,
-                 uid_t       *calling_uid,
-                 pid_t       *calling_pid)
+static void
+polkit_decision_ready_cb (PolkitAuthority     *authority,
+                          GAsyncResult        *res,
+                          PolkitDecisionQuery *query)
 {
-        gboolean  res   = FALSE;
-        GVariant *value = NULL;
-        GError   *error = NULL;
+        CkManager                 *manager = query->manager;
+        PolkitAuthorizationResult *result;
+        PolkitDecisionEntry       *entry;
+        GError                    *error;
 
-        if (sender == NULL) {
-                g_debug ("sender == NULL");
+        error = NULL;
+        result = polkit_authority_check_authorization_finish (authority, res, &error);
+        if (error != NULL) {
+                throw_error (query->context, CK_MANAGER_ERROR_FAILED, error->message);
+                g_clear_error (&error);
                 goto out;
         }
 
-        if (manager->priv->bus_proxy == NULL) {
-                g_debug ("manager->priv->bus_proxy == NULL");
-                goto out;
+        entry = g_new0 (PolkitDecisionEntry, 1);
+        entry->expires = g_get_monotonic_time () + POLKIT_DECISION_TTL;
+
+        if (polkit_authorization_result_get_is_authorized (result)) {
+                entry->decision = POLKIT_DECISION_YES;
+        } else if (polkit_authorization_result_get_is_challenge (result)) {
+                entry->decision = POLKIT_DECISION_CHALLENGE;
+        } else {
+                entry->decision = POLKIT_DECISION_NO;
         }
 
-        value = g_dbus_proxy_call_sync (manager->priv->bus_proxy, "GetConnectionUnixUser",
-                                        g_variant_new ("(s)", sender),
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        2000,
-                                        NULL,
-                                        &error);
+        query->reply (query->context, entry->decision);
 
-        if (value == NULL) {
-                g_warning ("GetConnectionUnixUser() failed: %s", error->message);
-                g_error_free (error);
-                goto out;
+        if (query->generation == manager->priv->polkit_generation) {
+                if (g_hash_table_size (manager->priv->polkit_decisions) >= POLKIT_DECISION_MAX_ENTRIES) {
+                        g_hash_table_remove_all (manager->priv->polkit_decisions);
+                }
+                g_hash_table_replace (manager->priv->polkit_decisions, query->key, entry);
+                query->key = NULL;
+        } else {
+                g_free (entry);
         }
-        g_variant_get (value, "(u)", calling_uid);
-        g_variant_unref (value);
 
-        value = g_dbus_proxy_call_sync (manager->priv->bus_proxy, "GetConnectionUnixProcessID",
-                                        g_variant_new ("(s)", sender),
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        2000,
-                                        NULL,
-                                        &error);
+        g_object_unref (result);
+ out:
+        g_free (query->key);
+        g_object_unref (query->manager);
+        g_free (query);
+}
 
-        if (value == NULL) {
-                g_warning ("GetConnectionUnixProcessID() failed: %s", error->message);
-                g_error_free (error);
-                goto out;
+static void
+polkit_decision_for_caller (CkManager             *manager,
+                            GDBusMethodInvocation *context,
+                            uid_t                  calling_uid,
+                            pid_t                  calling_pid,
+                            gpointer               data)
+{
+        PolkitDecisionRequest *request = data;
+        PolkitDecisionEntry   *entry;
+        PolkitDecisionQuery   *query;
+        PolkitSubject         *subject;
+        CkSession             *session;
+        gboolean               active = FALSE;
+        gboolean               local = FALSE;
+        char                  *key;
+
+        session = get_session_for_pid (manager, calling_pid);
+        if (session != NULL) {
+                active = console_kit_session_get_active (CONSOLE_KIT_SESSION (session));
+                local = console_kit_session_get_is_local (CONSOLE_KIT_SESSION (session));
         }
-        g_variant_get (value, "(u)", calling_pid);
-        g_variant_unref (value);
 
-        res = TRUE;
+        key = g_strdup_printf ("%u:%d:%d:%s", (guint) calling_uid, active, local, request->action);
 
-        g_debug ("uid = %d", *calling_uid);
-        g_debug ("pid = %d", *calling_pid);
+        entry = g_hash_table_lookup (manager->priv->polkit_decisions, key);
+        if (entry != NULL && entry->expires > g_get_monotonic_time ()) {
+                g_debug ("using cached polkit decision for %s", key);
+                request->reply (context, entry->decision);
+                g_free (key);
+                return;
+        }
 
-out:
-        return res;
+        g_debug ("get permissions for action %s", request->action);
+
+        query = g_new0 (PolkitDecisionQuery, 1);
+        query->manager = g_object_ref (manager);
+        query->context = context;
+        query->key = key;
+        query->reply = request->reply;
+        query->generation = manager->priv->polkit_generation;
+
+        subject = polkit_system_bus_name_new (g_dbus_method_invocation_get_sender (context));
+
+        polkit_authority_check_authorization (manager->priv->pol_ctx,
+                                              subject,
+                                              request->action,
+                                              NULL,
+                                              0,
+                                              NULL,
+                                              (GAsyncReadyCallback) polkit_decision_ready_cb,
+                                              query);
+        g_object_unref (subject);
+}
+
+/* Answers a non-interactive polkit query for @action through @reply,
+ * from the decision cache when possible. */
+static void
+check_polkit_decision (CkManager             *manager,
+                       GDBusMethodInvocation *context,
+                       const char            *action,
+                       PolkitDecisionReply    reply)
+{
+        PolkitDecisionRequest *request;
+
+        request = g_new0 (PolkitDecisionRequest, 1);
+        request->action = g_strdup (action);
+        request->reply = reply;
+
+        with_caller_info (manager,
+                          context,
+                          polkit_decision_for_caller,
+                          request,
+                          (GDestroyNotify) polkit_decision_request_free);
 }
 
+static void
+get_polkit_logind_permissions (CkManager             *manager,
+                               const char            *action,
+                               GDBusMethodInvocation *context)
+{
+        check_polkit_decision (manager, context, action, reply_can_logind);
+}
+
+static void
+get_polkit_permissions (CkManager             *manager,
+                        const char            *action,
+                        GDBusMethodInvocation *context)
+{
+        check_polkit_decision (manager, context, action, reply_can_boolean);
+}
+#endif
+
 static char *
 get_user_name (uid_t uid)
 {
@@ -1295,70 +1945,332 @@ session_is_real_user (CkSession *session,
 }
 
 static void
-collect_users (const char *ssid,
-               CkSession  *session,
-               GHashTable *hash)
+manager_user_free (CkManagerUser *user)
 {
-        char *username;
-
-        if (session_is_real_user (session, &username)) {
-                if (username != NULL) {
-                        g_hash_table_insert (hash, username, NULL);
-                }
-        }
+        g_hash_table_destroy (user->sessions);
+        g_free (user->runtime_dir);
+        g_free (user);
 }
 
 static guint
 get_system_num_users (CkManager *manager)
 {
-        guint            num_users;
-        GHashTable      *hash;
+        g_debug ("found %u unique users", manager->priv->num_real_users);
+
+        return manager->priv->num_real_users;
+}
+
+static const gchar *
+get_runtime_dir_for_user (CkManager *manager,
+                          guint      unix_user)
+{
+        CkManagerUser *user;
+
+        TRACE ();
+
+        user = g_hash_table_lookup (manager->priv->users, GUINT_TO_POINTER (unix_user));
+
+        if (user != NULL) {
+                g_debug ("Found session for user %d", unix_user);
+                return user->runtime_dir;
+        }
+
+        return NULL;
+}
+
+static void
+session_idle_hint_changed (CkSession  *session,
+                           gboolean    idle_hint,
+                           CkManager  *manager);
+
+static void
+clear_reply (GVariant **reply)
+{
+        if (*reply != NULL) {
+                g_variant_unref (*reply);
+                *reply = NULL;
+        }
+}
 
-        hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+static void
+invalidate_session_replies (CkManager *manager)
+{
+        clear_reply (&manager->priv->get_sessions_reply);
+        clear_reply (&manager->priv->list_sessions_reply);
+}
 
-        g_hash_table_foreach (manager->priv->sessions, (GHFunc)collect_users, hash);
+static void
+invalidate_seat_replies (CkManager *manager)
+{
+        clear_reply (&manager->priv->get_seats_reply);
+        clear_reply (&manager->priv->list_seats_reply);
+}
 
-        num_users = g_hash_table_size (hash);
+/* Adds the session to the per-user and busy-session indexes. The session
+ * must already have its runtime dir set.
+ */
+static void
+manager_index_session (CkManager *manager,
+                       CkSession *session)
+{
+        CkManagerUser *user;
+        guint          unix_user;
+        char          *username;
 
-        g_hash_table_destroy (hash);
+        unix_user = console_kit_session_get_unix_user (CONSOLE_KIT_SESSION (session));
 
-        g_debug ("found %u unique users", num_users);
+        user = g_hash_table_lookup (manager->priv->users, GUINT_TO_POINTER (unix_user));
+        if (user == NULL) {
+                user = g_new0 (CkManagerUser, 1);
+                user->uid = unix_user;
 
-        return num_users;
+                /* only count users we can resolve, and not the DM accounts */
+                username = NULL;
+                user->is_real_user = session_is_real_user (session, &username) && username != NULL;
+                g_free (username);
+
+                user->runtime_dir = g_strdup (ck_session_get_runtime_dir (session));
+                user->sessions = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+                g_hash_table_insert (manager->priv->users, GUINT_TO_POINTER (unix_user), user);
+
+                if (user->is_real_user) {
+                        manager->priv->num_real_users++;
+                }
+        }
+
+        g_hash_table_add (user->sessions, session);
+
+        if (!console_kit_session_get_idle_hint (CONSOLE_KIT_SESSION (session))) {
+                g_hash_table_add (manager->priv->busy_sessions, session);
+        }
+
+        g_signal_connect (CONSOLE_KIT_SESSION (session), "idle-hint-changed",
+                          G_CALLBACK (session_idle_hint_changed),
+                          manager);
+
+        ck_query_server_add_session (manager->priv->query_server, session);
+        invalidate_session_replies (manager);
 }
 
+/* Drops the session from the indexes. Returns TRUE if that was the
+ * user's last session, in which case the caller owns cleaning up the
+ * user's runtime dir.
+ */
 static gboolean
-session_has_user (const char *ssid,
-                  CkSession  *session,
-                  guint      *unix_user)
+manager_unindex_session (CkManager *manager,
+                         CkSession *session)
 {
-        guint session_user;
+        CkManagerUser *user;
+        guint          unix_user;
 
-        session_user = console_kit_session_get_unix_user (CONSOLE_KIT_SESSION (session));
+        g_signal_handlers_disconnect_by_func (session, G_CALLBACK (session_idle_hint_changed), manager);
 
-        if (session_user == *unix_user) {
-                g_debug ("Found session for user %d", *unix_user);
-                return TRUE;
+        ck_query_server_remove_session (manager->priv->query_server, ck_session_get_path (session));
+        invalidate_session_replies (manager);
+
+        g_hash_table_remove (manager->priv->busy_sessions, session);
+
+        unix_user = console_kit_session_get_unix_user (CONSOLE_KIT_SESSION (session));
+
+        user = g_hash_table_lookup (manager->priv->users, GUINT_TO_POINTER (unix_user));
+        if (user == NULL) {
+                g_warning ("No user entry for uid %u, index is out of sync", unix_user);
+                return FALSE;
         }
 
-        return FALSE;
+        g_hash_table_remove (user->sessions, session);
+
+        if (g_hash_table_size (user->sessions) > 0) {
+                return FALSE;
+        }
+
+        if (user->is_real_user) {
+                manager->priv->num_real_users--;
+        }
+
+        g_hash_table_remove (manager->priv->users, GUINT_TO_POINTER (unix_user));
+
+        return TRUE;
 }
 
-static const gchar *
-get_runtime_dir_for_user (CkManager *manager,
-                          guint      unix_user)
+/* The session leaders owned by one unique bus name. Only while a name
+ * owns a leader do we listen for it going away, with a match rule on
+ * arg0 so the bus doesn't wake us up for everybody else's connections.
+ */
+typedef struct
 {
-        gpointer session;
+        GDBusConnection *connection;
+        guint            name_owner_id;
+        /* set of cookies */
+        GHashTable      *cookies;
+} LeaderConnection;
 
-        TRACE ();
+static void
+on_name_owner_notify (GDBusConnection *connection,
+                      const gchar     *sender_name,
+                      const gchar     *object_path,
+                      const gchar     *interface_name,
+                      const gchar     *signal_name,
+                      GVariant        *parameters,
+                      gpointer         user_data)
+{
+        CkManager *manager = CK_MANAGER (user_data);
+        gchar     *service_name, *old_service_name, *new_service_name;
 
-        session = g_hash_table_find (manager->priv->sessions, (GHRFunc)session_has_user, &unix_user);
+        g_variant_get (parameters, "(&s&s&s)", &service_name, &old_service_name, &new_service_name);
 
-        if (session != NULL) {
-                return ck_session_get_runtime_dir (CK_SESSION (session));
+        if (strlen (new_service_name) == 0) {
+                ck_caller_cache_remove (ck_caller_cache_get (), old_service_name);
+                remove_sessions_for_connection (manager, old_service_name);
         }
+}
 
-        return NULL;
+typedef struct
+{
+        CkManager *manager;
+        char      *service_name;
+} NameCheckData;
+
+static void
+name_has_owner_cb (GObject      *source_object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+        NameCheckData *data = user_data;
+        GVariant      *result;
+        gboolean       has_owner = TRUE;
+
+        result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, NULL);
+        if (result != NULL) {
+                g_variant_get (result, "(b)", &has_owner);
+                g_variant_unref (result);
+        }
+
+        /* the leader's connection went away before our match rule
+         * was in place */
+        if (!has_owner) {
+                remove_sessions_for_connection (data->manager, data->service_name);
+        }
+
+        g_object_unref (data->manager);
+        g_free (data->service_name);
+        g_free (data);
+}
+
+static LeaderConnection *
+leader_connection_new (CkManager  *manager,
+                       const char *service_name)
+{
+        LeaderConnection *conn;
+        NameCheckData    *data;
+
+        conn = g_new0 (LeaderConnection, 1);
+        conn->cookies = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        if (manager->priv->connection == NULL) {
+                return conn;
+        }
+
+        conn->connection = g_object_ref (manager->priv->connection);
+        conn->name_owner_id = g_dbus_connection_signal_subscribe (conn->connection,
+                                                                  "org.freedesktop.DBus",
+                                                                  "org.freedesktop.DBus",
+                                                                  "NameOwnerChanged",
+                                                                  "/org/freedesktop/DBus",
+                                                                  service_name,
+                                                                  G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                  on_name_owner_notify,
+                                                                  manager,
+                                                                  NULL);
+
+        /* The AddMatch goes out ahead of this, so the name either
+         * still has an owner or we'll hear about it leaving. This also
+         * covers the leaders restored from a previous instance.
+         */
+        data = g_new0 (NameCheckData, 1);
+        data->manager = g_object_ref (manager);
+        data->service_name = g_strdup (service_name);
+
+        g_dbus_connection_call (conn->connection,
+                                "org.freedesktop.DBus",
+                                "/org/freedesktop/DBus",
+                                "org.freedesktop.DBus",
+                                "NameHasOwner",
+                                g_variant_new ("(s)", service_name),
+                                G_VARIANT_TYPE ("(b)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                NULL,
+                                name_has_owner_cb,
+                                data);
+
+        return conn;
+}
+
+static void
+leader_connection_free (LeaderConnection *conn)
+{
+        if (conn->connection != NULL) {
+                g_dbus_connection_signal_unsubscribe (conn->connection, conn->name_owner_id);
+                g_object_unref (conn->connection);
+        }
+        g_hash_table_destroy (conn->cookies);
+        g_free (conn);
+}
+
+/* Adds @leader to the leaders table and to the index by bus name */
+static void
+manager_add_leader (CkManager       *manager,
+                    CkSessionLeader *leader)
+{
+        LeaderConnection *conn;
+        const char       *service_name;
+        const char       *cookie;
+
+        service_name = ck_session_leader_peek_service_name (leader);
+        cookie = ck_session_leader_peek_cookie (leader);
+
+        g_hash_table_insert (manager->priv->leaders,
+                             g_strdup (cookie),
+                             g_object_ref (leader));
+
+        conn = g_hash_table_lookup (manager->priv->leader_connections, service_name);
+        if (conn == NULL) {
+                conn = leader_connection_new (manager, service_name);
+                g_hash_table_insert (manager->priv->leader_connections,
+                                     g_strdup (service_name),
+                                     conn);
+        }
+
+        g_hash_table_add (conn->cookies, g_strdup (cookie));
+}
+
+static void
+manager_remove_leader (CkManager  *manager,
+                       const char *cookie)
+{
+        CkSessionLeader  *leader;
+        LeaderConnection *conn;
+        const char       *service_name;
+
+        leader = g_hash_table_lookup (manager->priv->leaders, cookie);
+        if (leader == NULL) {
+                return;
+        }
+
+        service_name = ck_session_leader_peek_service_name (leader);
+        conn = g_hash_table_lookup (manager->priv->leader_connections, service_name);
+        if (conn != NULL) {
+                g_hash_table_remove (conn->cookies, cookie);
+
+                /* nothing left to watch the name for */
+                if (g_hash_table_size (conn->cookies) == 0) {
+                        g_hash_table_remove (manager->priv->leader_connections, service_name);
+                }
+        }
+
+        g_hash_table_remove (manager->priv->leaders, cookie);
 }
 
 #ifdef ENABLE_RBAC_SHUTDOWN
@@ -1376,10 +2288,11 @@ check_rbac_permissions (CkManager             *manager,
 
         username = NULL;
         sender   = g_dbus_method_invocation_get_sender (context);
-        res      = get_caller_info (manager,
-                                    sender,
-                                    &uid,
-                                    &pid);
+        res      = ck_caller_cache_resolve_sync (ck_caller_cache_get (),
+                                                 manager->priv->connection,
+                                                 sender,
+                                                 &uid,
+                                                 &pid);
         if (!res) {
                 goto out;
         }
@@ -1455,91 +2368,215 @@ check_can_action (CkManager             *manager,
         } else {
                 g_dbus_method_invocation_return_value (context, g_variant_new ("(s)","no"));
         }
-#else
-        /* neither polkit or rbac. assumed single user system */
-        g_dbus_method_invocation_return_value (context, g_variant_new ("(s)", "yes"));
-#endif
+#else
+        /* neither polkit or rbac. assumed single user system */
+        g_dbus_method_invocation_return_value (context, g_variant_new ("(s)", "yes"));
+#endif
+}
+
+static void
+system_action_data_finish (SystemActionData *data)
+{
+        /* the action is done and we're awake again, or it failed.
+         * Either way we can signal to the apps */
+        switch (data->signal) {
+        case PREPARE_FOR_SHUTDOWN:
+                console_kit_manager_emit_prepare_for_shutdown (CONSOLE_KIT_MANAGER (data->manager), FALSE);
+                break;
+        case PREPARE_FOR_SLEEP:
+                console_kit_manager_emit_prepare_for_sleep (CONSOLE_KIT_MANAGER (data->manager), FALSE);
+                break;
+        default:
+                g_error ("system_action_data_finish, unknown signal for command %s", data->command);
+        }
+
+        g_free (data);
+}
+
+static void
+system_action_child_exited (GPid              pid,
+                            gint              status,
+                            SystemActionData *data)
+{
+        GError *error = NULL;
+
+        TRACE ();
+
+        data->manager->priv->system_action_child_id = 0;
+        g_spawn_close_pid (pid);
+
+        /* As with the synchronous spawn this used to be, only failing
+         * to run the command is reported back to the caller */
+        if (!g_spawn_check_exit_status (status, &error)) {
+                g_warning ("%s command %s failed: %s", data->description, data->command, error->message);
+                g_clear_error (&error);
+        }
+
+        g_debug ("%s done", data->description);
+
+        g_dbus_method_invocation_return_value (data->context, NULL);
+
+        system_action_data_finish (data);
 }
 
-/* Logs the event and performs the system call such as ck-system-restart.
- * returns an error message over dbus to the user if needed, otherwise returns
- * success (also over dbus).
+/* Logs the event and starts the command such as ck-system-restart. The
+ * reply to the caller goes out once it exits, so the daemon keeps
+ * answering while the system is going down or to sleep and right as
+ * it wakes up. Returns FALSE, after replying with the error, if the
+ * command couldn't be started.
  */
-static void
-do_system_action (CkManager             *manager,
-                  GDBusMethodInvocation *context,
-                  const gchar           *command,
-                  CkLogEventType         event_type,
-                  const gchar           *description)
+static gboolean
+do_system_action (SystemActionData *data)
 {
-        GError *error;
-        gboolean res;
+        CkManager *manager = data->manager;
+        GError    *error;
+        gchar    **argv;
+        GPid       pid;
+        gboolean   res;
+
+        TRACE ();
 
-        g_debug ("ConsoleKit preforming %s", description);
+        g_debug ("ConsoleKit preforming %s", data->description);
 
-        log_system_action_event (manager, event_type);
+        log_system_action_event (manager, data->event_type);
 
-        g_debug ("command is %s", command);
+        g_debug ("command is %s", data->command);
 
         error = NULL;
-        res = g_spawn_command_line_sync (command, NULL, NULL, NULL, &error);
+        argv = NULL;
+        res = g_shell_parse_argv (data->command, NULL, &argv, &error);
+        if (res) {
+                res = g_spawn_async (NULL,
+                                     argv,
+                                     NULL,
+                                     G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                     NULL,
+                                     NULL,
+                                     &pid,
+                                     &error);
+        }
+        g_strfreev (argv);
 
         if (! res) {
-                g_warning ("Unable to %s system: %s", description, error->message);
+                g_warning ("Unable to %s system: %s", data->description, error->message);
 
-                throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Unable to %s system: %s"), description, error->message);
+                throw_error (data->context, CK_MANAGER_ERROR_GENERAL, _("Unable to %s system: %s"), data->description, error->message);
 
                 g_clear_error (&error);
-        } else {
-                g_dbus_method_invocation_return_value (context, NULL);
+                return FALSE;
         }
+
+        manager->priv->system_action_child_id = g_child_watch_add (pid,
+                                                                   (GChildWatchFunc) system_action_child_exited,
+                                                                   data);
+
+        return TRUE;
 }
 
 static gboolean
 system_action_idle_cb(SystemActionData *data)
 {
-        g_return_val_if_fail (data != NULL, FALSE);
+        CkManagerPrivate *priv;
+        gint64            waited;
 
-        /* Perform the action, it will handle the g_dbus_method_return */
-        do_system_action (data->manager,
-                          data->context,
-                          data->command,
-                          data->event_type,
-                          data->description);
+        g_return_val_if_fail (data != NULL, FALSE);
 
-        /* If we got here the sleep/shutdown action is done and we're awake again
-         * or the operation failed. Either way we can signal to the apps */
-        switch (data->signal) {
-        case PREPARE_FOR_SHUTDOWN:
-                console_kit_manager_emit_prepare_for_shutdown (CONSOLE_KIT_MANAGER (data->manager), FALSE);
-                break;
-        case PREPARE_FOR_SLEEP:
-                console_kit_manager_emit_prepare_for_sleep (CONSOLE_KIT_MANAGER (data->manager), FALSE);
-                break;
-        default:
-                g_error ("system_action_idle_cb, unknown signal for command %s", data->command);
-        }
+        priv = data->manager->priv;
 
         /* reset this since we'll return FALSE here and kill the cb */
-        data->manager->priv->system_action_idle_id = 0;
-        /* set this to NULL as we've processed this event and are about
-         * to free the data */
-        data->manager->priv->system_action_data = NULL;
+        priv->system_action_idle_id = 0;
+        /* set this to NULL as the delay is over, from here on the
+         * child watch owns the data */
+        priv->system_action_data = NULL;
 
-        g_free (data);
+        waited = g_get_monotonic_time () - data->delay_start;
+        priv->system_action_delays++;
+        priv->system_action_delay_usec += waited;
+        priv->system_action_delay_max_usec = MAX (priv->system_action_delay_max_usec, waited);
+
+        g_debug ("%s waited %" G_GINT64_FORMAT " us for delay inhibitors", data->description, waited);
+
+        /* Start the action, it will handle the g_dbus_method_return */
+        if (!do_system_action (data)) {
+                system_action_data_finish (data);
+        }
 
         return FALSE;
 }
 
+/* TRUE from the PrepareFor* signal until the command carrying out the
+ * action has exited */
+static gboolean
+system_action_in_progress (CkManager *manager)
+{
+        return manager->priv->system_action_idle_id != 0
+                || manager->priv->system_action_child_id != 0;
+}
+
+/* The inhibitor event that can hold up @data */
+static CkInhibitEvent
+system_action_inhibit_event (SystemActionData *data)
+{
+        return data->signal == PREPARE_FOR_SLEEP ? CK_INHIBIT_EVENT_SUSPEND : CK_INHIBIT_EVENT_SHUTDOWN;
+}
+
+static gboolean
+system_action_delay_timeout_cb (SystemActionData *data)
+{
+        g_warning ("%s: delay inhibitors still held after %u s, going ahead",
+                   data->description, data->manager->priv->inhibit_delay_max);
+
+        data->manager->priv->system_action_delay_timeouts++;
+
+        return system_action_idle_cb (data);
+}
+
+/* Called right after the PrepareFor signal. With no delay inhibitor
+ * for the action held, it is carried out as soon as the signal is on
+ * its way. Otherwise it waits for on_inhibit_manager_changed_event to
+ * see the last of them released, or for inhibit_delay_max to pass.
+ */
+static void
+system_action_wait_for_delayers (CkManager        *manager,
+                                 SystemActionData *data)
+{
+        CkManagerPrivate *priv = manager->priv;
+        gboolean          delayed;
+
+        data->delay_start = g_get_monotonic_time ();
+
+        if (system_action_inhibit_event (data) == CK_INHIBIT_EVENT_SUSPEND) {
+                delayed = ck_inhibit_manager_is_suspend_delayed (priv->inhibit_manager);
+        } else {
+                delayed = ck_inhibit_manager_is_shutdown_delayed (priv->inhibit_manager);
+        }
+
+        if (!delayed) {
+                priv->system_action_idle_id = g_idle_add ((GSourceFunc)system_action_idle_cb,
+                                                          data);
+                return;
+        }
+
+        g_debug ("%s is delayed, waiting up to %u s for the inhibitors",
+                 data->description, priv->inhibit_delay_max);
+
+        /* We need to keep a pointer to the system action data because
+         * the inhibit lock can be lifted before the timeout
+         */
+        priv->system_action_data = data;
+        priv->system_action_idle_id = g_timeout_add_seconds (priv->inhibit_delay_max,
+                                                             (GSourceFunc)system_action_delay_timeout_cb,
+                                                             data);
+}
+
 static void
 do_restart (CkManager             *manager,
             GDBusMethodInvocation *context)
 {
         SystemActionData *data;
-        guint             delay_time;
 
         /* Don't allow multiple system actions at the same time */
-        if (manager->priv->system_action_idle_id != 0) {
+        if (system_action_in_progress (manager)) {
                 throw_error (context, CK_MANAGER_ERROR_BUSY, _("Attempting to perform a system action while one is in progress"));
                 return;
         }
@@ -1563,20 +2600,7 @@ do_restart (CkManager             *manager,
         data->description = "Restart";
         data->signal = PREPARE_FOR_SHUTDOWN;
 
-        if (ck_inhibit_manager_is_shutdown_delayed (manager->priv->inhibit_manager)) {
-                delay_time = manager->priv->system_action_idle_inhibited_delay;
-                /* We need to keep a pointer to the system action data because
-                 * the inhibit lock can be lifted before the timeout
-                 */
-                manager->priv->system_action_data = data;
-        } else {
-                delay_time = manager->priv->system_action_idle_delay;
-        }
-
-        /* Sleep so user applications have time to respond */
-        manager->priv->system_action_idle_id = g_timeout_add (delay_time,
-                                                              (GSourceFunc)system_action_idle_cb,
-                                                              data);
+        system_action_wait_for_delayers (manager, data);
 }
 
 /*
@@ -1643,10 +2667,9 @@ do_stop (CkManager             *manager,
          GDBusMethodInvocation *context)
 {
         SystemActionData *data;
-        guint             delay_time;
 
         /* Don't allow multiple system actions at the same time */
-        if (manager->priv->system_action_idle_id != 0) {
+        if (system_action_in_progress (manager)) {
                 throw_error (context, CK_MANAGER_ERROR_BUSY, _("Attempting to perform a system action while one is in progress"));
                 return;
         }
@@ -1670,20 +2693,7 @@ do_stop (CkManager             *manager,
         data->description = "Stop";
         data->signal = PREPARE_FOR_SHUTDOWN;
 
-        if (ck_inhibit_manager_is_shutdown_delayed (manager->priv->inhibit_manager)) {
-                delay_time = manager->priv->system_action_idle_inhibited_delay;
-                /* We need to keep a pointer to the system action data because
-                 * the inhibit lock can be lifted before the timeout
-                 */
-                manager->priv->system_action_data = data;
-        } else {
-                delay_time = manager->priv->system_action_idle_delay;
-        }
-
-        /* Sleep so user applications have time to respond */
-        manager->priv->system_action_idle_id = g_timeout_add (delay_time,
-                                                              (GSourceFunc)system_action_idle_cb,
-                                                              data);
+        system_action_wait_for_delayers (manager, data);
 }
 
 static gboolean
@@ -1898,10 +2908,9 @@ do_suspend (CkManager             *manager,
             GDBusMethodInvocation *context)
 {
         SystemActionData *data;
-        guint             delay_time;
 
         /* Don't allow multiple system actions at the same time */
-        if (manager->priv->system_action_idle_id != 0) {
+        if (system_action_in_progress (manager)) {
                 throw_error (context, CK_MANAGER_ERROR_BUSY, _("Attempting to perform a system action while one is in progress"));
                 return;
         }
@@ -1925,20 +2934,7 @@ do_suspend (CkManager             *manager,
         data->description = "Suspend";
         data->signal = PREPARE_FOR_SLEEP;
 
-        if (ck_inhibit_manager_is_suspend_delayed (manager->priv->inhibit_manager)) {
-                delay_time = manager->priv->system_action_idle_inhibited_delay;
-                /* We need to keep a pointer to the system action data because
-                 * the inhibit lock can be lifted before the timeout
-                 */
-                manager->priv->system_action_data = data;
-        } else {
-                delay_time = manager->priv->system_action_idle_delay;
-        }
-
-        /* Sleep so user applications have time to respond */
-        manager->priv->system_action_idle_id = g_timeout_add (delay_time,
-                                                              (GSourceFunc)system_action_idle_cb,
-                                                              data);
+        system_action_wait_for_delayers (manager, data);
 }
 
 /*
@@ -2015,7 +3011,7 @@ dbus_can_suspend (ConsoleKitManager     *ckmanager,
                 action = "org.freedesktop.consolekit.system.suspend";
         }
 
-        if (ck_system_can_suspend ()) {
+        if (manager->priv->sleep_caps.can_suspend) {
                 check_can_action (manager, context, action);
         } else {
                 /* not supported by system (or consolekit backend) */
@@ -2025,15 +3021,104 @@ dbus_can_suspend (ConsoleKitManager     *ckmanager,
         return TRUE;
 }
 
+static void
+probe_sleep_capabilities (SleepCapabilities *caps)
+{
+        caps->can_suspend = ck_system_can_suspend ();
+        caps->can_hibernate = ck_system_can_hibernate ();
+        caps->can_hybrid_sleep = ck_system_can_hybrid_sleep ();
+
+        g_debug ("sleep capabilities: suspend %d hibernate %d hybrid-sleep %d",
+                 caps->can_suspend,
+                 caps->can_hibernate,
+                 caps->can_hybrid_sleep);
+}
+
+static void
+sleep_probe_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+        SleepCapabilities *caps;
+
+        caps = g_new0 (SleepCapabilities, 1);
+        probe_sleep_capabilities (caps);
+
+        g_task_return_pointer (task, caps, g_free);
+}
+
+static void refresh_sleep_capabilities (CkManager *manager);
+
+static void
+sleep_probe_done (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+        CkManager         *manager = CK_MANAGER (source_object);
+        SleepCapabilities *caps;
+
+        manager->priv->sleep_probe_running = FALSE;
+
+        caps = g_task_propagate_pointer (G_TASK (res), NULL);
+        if (caps != NULL) {
+                manager->priv->sleep_caps = *caps;
+                g_free (caps);
+        }
+
+        if (manager->priv->sleep_probe_again) {
+                manager->priv->sleep_probe_again = FALSE;
+                refresh_sleep_capabilities (manager);
+        }
+}
+
+/* Probes the sleep capabilities again off the main loop. Requests that
+ * come in while a probe is running are folded into one more probe. */
+static void
+refresh_sleep_capabilities (CkManager *manager)
+{
+        GTask *task;
+
+        if (manager->priv->sleep_probe_running) {
+                manager->priv->sleep_probe_again = TRUE;
+                return;
+        }
+
+        manager->priv->sleep_probe_running = TRUE;
+
+        task = g_task_new (manager, NULL, sleep_probe_done, NULL);
+        g_task_run_in_thread (task, sleep_probe_thread);
+        g_object_unref (task);
+}
+
+static gboolean
+sleep_probe_timeout_cb (CkManager *manager)
+{
+        refresh_sleep_capabilities (manager);
+
+        return TRUE;
+}
+
+static gboolean
+on_swaps_changed (gint          fd,
+                  GIOCondition  condition,
+                  CkManager    *manager)
+{
+        g_debug ("swap configuration changed");
+
+        refresh_sleep_capabilities (manager);
+
+        return TRUE;
+}
+
 static void
 do_hibernate (CkManager             *manager,
               GDBusMethodInvocation *context)
 {
         SystemActionData *data;
-        guint             delay_time;
 
         /* Don't allow multiple system actions at the same time */
-        if (manager->priv->system_action_idle_id != 0) {
+        if (system_action_in_progress (manager)) {
                 throw_error (context, CK_MANAGER_ERROR_BUSY, _("Attempting to perform a system action while one is in progress"));
                 return;
         }
@@ -2057,20 +3142,7 @@ do_hibernate (CkManager             *manager,
         data->description = "Hibernate";
         data->signal = PREPARE_FOR_SLEEP;
 
-        if (ck_inhibit_manager_is_suspend_delayed (manager->priv->inhibit_manager)) {
-                delay_time = manager->priv->system_action_idle_inhibited_delay;
-                /* We need to keep a pointer to the system action data because
-                 * the inhibit lock can be lifted before the timeout
-                 */
-                manager->priv->system_action_data = data;
-        } else {
-                delay_time = manager->priv->system_action_idle_delay;
-        }
-
-        /* Sleep so user applications have time to respond */
-        manager->priv->system_action_idle_id = g_timeout_add (delay_time,
-                                                              (GSourceFunc)system_action_idle_cb,
-                                                              data);
+        system_action_wait_for_delayers (manager, data);
 }
 
 /*
@@ -2147,7 +3219,7 @@ dbus_can_hibernate (ConsoleKitManager     *ckmanager,
                 action = "org.freedesktop.consolekit.system.hibernate";
         }
 
-        if (ck_system_can_hibernate ()) {
+        if (manager->priv->sleep_caps.can_hibernate) {
                 check_can_action (manager, context, action);
         } else {
                 /* not supported by system (or consolekit backend) */
@@ -2162,10 +3234,9 @@ do_hybrid_sleep (CkManager             *manager,
                  GDBusMethodInvocation *context)
 {
         SystemActionData *data;
-        guint             delay_time;
 
         /* Don't allow multiple system actions at the same time */
-        if (manager->priv->system_action_idle_id != 0) {
+        if (system_action_in_progress (manager)) {
                 throw_error (context, CK_MANAGER_ERROR_BUSY, _("Attempting to perform a system action while one is in progress"));
                 return;
         }
@@ -2189,20 +3260,7 @@ do_hybrid_sleep (CkManager             *manager,
         data->description = "Hybrid Sleep";
         data->signal = PREPARE_FOR_SLEEP;
 
-        if (ck_inhibit_manager_is_suspend_delayed (manager->priv->inhibit_manager)) {
-                delay_time = manager->priv->system_action_idle_inhibited_delay;
-                /* We need to keep a pointer to the system action data because
-                 * the inhibit lock can be lifted before the timeout
-                 */
-                manager->priv->system_action_data = data;
-        } else {
-                delay_time = manager->priv->system_action_idle_delay;
-        }
-
-        /* Sleep so user applications have time to respond */
-        manager->priv->system_action_idle_id = g_timeout_add (delay_time,
-                                                              (GSourceFunc)system_action_idle_cb,
-                                                              data);
+        system_action_wait_for_delayers (manager, data);
 }
 
 /*
@@ -2279,7 +3337,7 @@ dbus_can_hybrid_sleep (ConsoleKitManager     *ckmanager,
                 action = "org.freedesktop.consolekit.system.hybridsleep";
         }
 
-        if (ck_system_can_hybrid_sleep ()) {
+        if (manager->priv->sleep_caps.can_hybrid_sleep) {
                 check_can_action (manager, context, action);
         } else {
                 /* not supported by system (or consolekit backend) */
@@ -2289,45 +3347,33 @@ dbus_can_hybrid_sleep (ConsoleKitManager     *ckmanager,
         return TRUE;
 }
 
-static gboolean
-dbus_inhibit (ConsoleKitManager     *ckmanager,
-              GDBusMethodInvocation *context,
-              GUnixFDList *fd_list,
-              const gchar *what,
-              const gchar *who,
-              const gchar *why,
-              const gchar *mode)
+static void
+inhibit_for_caller (CkManager             *manager,
+                    GDBusMethodInvocation *context,
+                    uid_t                  uid,
+                    pid_t                  pid,
+                    gpointer               data)
 {
         CkManagerPrivate *priv;
         gint              fd = -1;
         GUnixFDList      *out_fd_list = NULL;
-        const gchar      *sender;
-        uid_t             uid = 0;
-        pid_t             pid = 0;
-        gint              res;
-
-        TRACE ();
-
-        g_return_val_if_fail (CK_IS_MANAGER (ckmanager), FALSE);
+        const gchar      *what;
+        const gchar      *who;
+        const gchar      *why;
+        const gchar      *mode;
 
-        priv = CK_MANAGER_GET_PRIVATE (CK_MANAGER (ckmanager));
-
-        sender   = g_dbus_method_invocation_get_sender (context);
-        res      = get_caller_info (CK_MANAGER (ckmanager),
-                                    sender,
-                                    &uid,
-                                    &pid);
-
-        if (!res) {
-                throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Error creating the inhibit lock"));
-                return TRUE;
-        }
+        priv = CK_MANAGER_GET_PRIVATE (manager);
 
         if (priv->inhibit_manager == NULL) {
                 throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Inhibit manager failed to initialize"));
-                return TRUE;
+                return;
         }
 
+        /* The arguments are still in the message, no need to copy them */
+        g_variant_get (g_dbus_method_invocation_get_parameters (context),
+                       "(&s&s&s&s)",
+                       &what, &who, &why, &mode);
+
         fd = ck_inhibit_manager_create_lock (priv->inhibit_manager,
                                              who,
                                              what,
@@ -2341,20 +3387,36 @@ dbus_inhibit (ConsoleKitManager     *ckmanager,
                 switch (fd) {
                 case CK_INHIBIT_ERROR_INVALID_INPUT:
                         throw_error (context, CK_MANAGER_ERROR_INVALID_INPUT, _("Invalid input when creating inhibit lock"));
-                        return TRUE;
+                        return;
                 case CK_INHIBIT_ERROR_OOM:
                         throw_error (context, CK_MANAGER_ERROR_OOM, _("Unable to create inhibit lock, insufficient memory"));
-                        return TRUE;
+                        return;
                 default:
                         throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Error creating the inhibit lock"));
-                        return TRUE;
+                        return;
                 }
         }
 
         out_fd_list = g_unix_fd_list_new_from_array (&fd, 1);
 
-        console_kit_manager_complete_inhibit (ckmanager, context, out_fd_list, g_variant_new_handle (0));
+        console_kit_manager_complete_inhibit (CONSOLE_KIT_MANAGER (manager), context, out_fd_list, g_variant_new_handle (0));
         g_clear_object (&out_fd_list);
+}
+
+static gboolean
+dbus_inhibit (ConsoleKitManager     *ckmanager,
+              GDBusMethodInvocation *context,
+              GUnixFDList *fd_list,
+              const gchar *what,
+              const gchar *who,
+              const gchar *why,
+              const gchar *mode)
+{
+        TRACE ();
+
+        g_return_val_if_fail (CK_IS_MANAGER (ckmanager), FALSE);
+
+        with_caller_info (CK_MANAGER (ckmanager), context, inhibit_for_caller, NULL, NULL);
         return TRUE;
 }
 
@@ -2378,6 +3440,7 @@ dbus_list_inhibitors (ConsoleKitManager     *ckmanager,
         GVariantBuilder   inhibitor_builder;
         GVariant         *inhibitor;
         GList            *l, *inhibit_list;
+        guint             serial;
 
         TRACE ();
 
@@ -2397,7 +3460,13 @@ dbus_list_inhibitors (ConsoleKitManager     *ckmanager,
                 return TRUE;
         }
 
-        g_variant_builder_init (&inhibitor_builder, G_VARIANT_TYPE_ARRAY);
+        serial = ck_inhibit_manager_get_serial (priv->inhibit_manager);
+        if (priv->list_inhibitors_reply != NULL && priv->list_inhibitors_serial == serial) {
+                g_dbus_method_invocation_return_value (context, priv->list_inhibitors_reply);
+                return TRUE;
+        }
+
+        g_variant_builder_init (&inhibitor_builder, G_VARIANT_TYPE ("a(ssssuu)"));
 
         for (l = inhibit_list; l != NULL; l = g_list_next (l)) {
                 g_debug ("what %s", ck_inhibit_get_what (CK_INHIBIT (l->data)));
@@ -2416,7 +3485,11 @@ dbus_list_inhibitors (ConsoleKitManager     *ckmanager,
                 g_variant_builder_add_value (&inhibitor_builder, inhibitor);
         }
 
-        console_kit_manager_complete_list_inhibitors(ckmanager, context, g_variant_builder_end (&inhibitor_builder));
+        clear_reply (&priv->list_inhibitors_reply);
+        priv->list_inhibitors_reply = g_variant_ref_sink (g_variant_new ("(a(ssssuu))", &inhibitor_builder));
+        priv->list_inhibitors_serial = serial;
+
+        g_dbus_method_invocation_return_value (context, priv->list_inhibitors_reply);
         return TRUE;
 }
 
@@ -2432,7 +3505,13 @@ on_seat_active_session_changed_full (CkSeat     *seat,
                 ck_session_get_id (session, &ssid, NULL);
         }
 
-        ck_manager_dump (manager);
+        /* udev-acl reads the database from this hook */
+        ck_manager_dump_flush (manager);
+
+#ifdef HAVE_POLKIT
+        /* polkit answers depend on which session is active */
+        polkit_decisions_flush (manager);
+#endif
         ck_seat_run_programs (seat, old_session, session, "seat_active_session_changed");
 
         log_seat_active_session_changed_event (manager, seat, ssid);
@@ -2449,7 +3528,7 @@ on_seat_session_added_full (CkSeat     *seat,
 
         ck_session_get_id (session, &ssid, NULL);
 
-        ck_manager_dump (manager);
+        ck_manager_dump_flush (manager);
         ck_session_run_programs (session, "session_added");
 
         log_seat_session_added_event (manager, seat, ssid);
@@ -2466,7 +3545,7 @@ on_seat_session_removed_full (CkSeat     *seat,
 
         ck_session_get_id (session, &ssid, NULL);
 
-        ck_manager_dump (manager);
+        ck_manager_dump_flush (manager);
         ck_session_run_programs (session, "session_removed");
 
         log_seat_session_removed_event (manager, seat, ssid);
@@ -2547,10 +3626,13 @@ add_new_seat (CkManager *manager,
         }
 
         g_hash_table_insert (manager->priv->seats, sid, seat);
+        manager_export_object (manager, ck_seat_get_path (seat), G_DBUS_INTERFACE_SKELETON (seat));
+        ck_query_server_add_seat (manager->priv->query_server, ck_seat_get_path (seat));
+        invalidate_seat_replies (manager);
 
         g_debug ("Added seat: %s kind:%d", sid, kind);
 
-        ck_manager_dump (manager);
+        ck_manager_dump_flush (manager);
         ck_seat_run_programs (seat, NULL, NULL, "seat_added");
 
         g_debug ("Emitting seat-added: %s", ck_seat_get_path (seat));
@@ -2593,9 +3675,13 @@ remove_seat (CkManager *manager,
                 g_hash_table_remove (manager->priv->seats, sid);
         }
 
-        ck_manager_dump (manager);
+        ck_manager_dump_flush (manager);
         ck_seat_run_programs (seat, NULL, NULL, "seat_removed");
 
+        ck_query_server_remove_seat (manager->priv->query_server, ck_seat_get_path (orig_seat));
+        invalidate_seat_replies (manager);
+        manager_unexport_object (manager, ck_seat_get_path (orig_seat));
+
         g_debug ("Emitting seat-removed: %s", ck_seat_get_path (orig_seat));
         console_kit_manager_emit_seat_removed (CONSOLE_KIT_MANAGER (manager), ck_seat_get_path (orig_seat));
 
@@ -2687,6 +3773,10 @@ manager_set_system_idle_hint (CkManager *manager,
                 /* FIXME: can we get a time from the dbus message? */
                 g_get_current_time (&manager->priv->system_idle_since_hint);
 
+                ck_query_server_set_system_idle_hint (manager->priv->query_server,
+                                                      idle_hint,
+                                                      &manager->priv->system_idle_since_hint);
+
                 g_debug ("Emitting system-idle-hint-changed: %d", idle_hint);
                 console_kit_manager_emit_system_idle_hint_changed (CONSOLE_KIT_MANAGER (manager), idle_hint);
         }
@@ -2694,26 +3784,13 @@ manager_set_system_idle_hint (CkManager *manager,
         return TRUE;
 }
 
-static gboolean
-is_session_busy (char      *id,
-                 CkSession *session,
-                 gpointer   data)
-{
-        /* return TRUE to stop search */
-        return !console_kit_session_get_idle_hint (CONSOLE_KIT_SESSION (session));
-}
-
 static void
 manager_update_system_idle_hint (CkManager *manager)
 {
-        CkSession *session;
         gboolean   system_idle;
 
-        /* just look for any session that doesn't have the idle-hint set */
-        session = g_hash_table_find (manager->priv->sessions, (GHRFunc)is_session_busy, NULL);
-
         /* if there aren't any busy sessions then the system is idle */
-        system_idle = (session == NULL);
+        system_idle = (g_hash_table_size (manager->priv->busy_sessions) == 0);
 
         manager_set_system_idle_hint (manager, system_idle);
 }
@@ -2723,6 +3800,12 @@ session_idle_hint_changed (CkSession  *session,
                            gboolean    idle_hint,
                            CkManager  *manager)
 {
+        if (idle_hint) {
+                g_hash_table_remove (manager->priv->busy_sessions, session);
+        } else {
+                g_hash_table_add (manager->priv->busy_sessions, session);
+        }
+
         manager_update_system_idle_hint (manager);
 }
 
@@ -2764,65 +3847,264 @@ dbus_get_system_idle_since_hint (ConsoleKitManager     *ckmanager,
                 date_str = g_strdup ("");
         }
 
-        console_kit_manager_complete_get_system_idle_since_hint (ckmanager, context, date_str);
-        g_free (date_str);
-        return TRUE;
+        console_kit_manager_complete_get_system_idle_since_hint (ckmanager, context, date_str);
+        g_free (date_str);
+        return TRUE;
+}
+
+static const char *open_stage_names[OPEN_STAGE_LAST] = {
+        "runtime-dir",
+        "process-group",
+        "attach",
+};
+
+typedef struct
+{
+        CkManager             *manager;
+        CkSessionLeader       *leader;
+        CkSession             *session;
+        GDBusMethodInvocation *context;
+        CkProcessGroup        *pgroup;
+        gboolean               is_local;
+        guint                  unix_user;
+        OpenSessionStage       stage;
+        gint64                 start;
+        gint64                 stage_start;
+        gint64                 stage_usec[OPEN_STAGE_LAST];
+} OpenSessionData;
+
+/* Runtime dir of a user while sessions for them are being opened. It
+ * stays around until the last of those is done, so concurrent opens
+ * share one directory and closing an older session can't remove it
+ * from under them.
+ */
+typedef struct
+{
+        char    *runtime_dir;
+        gboolean provisioned;
+        GList   *waiting;       /* OpenSessionData */
+        guint    n_opening;
+} OpeningUser;
+
+static void open_session_advance (OpenSessionData *data);
+static void open_session_release (CkManager       *manager,
+                                  CkSessionLeader *leader);
+
+static void
+opening_user_free (OpeningUser *user)
+{
+        g_assert (user->waiting == NULL);
+
+        g_free (user->runtime_dir);
+        g_free (user);
+}
+
+static void
+open_session_data_free (OpenSessionData *data)
+{
+        OpeningUser *user;
+
+        user = g_hash_table_lookup (data->manager->priv->opening_users, GUINT_TO_POINTER (data->unix_user));
+        if (user != NULL && --user->n_opening == 0) {
+                /* Closing the user's last session skipped removing the
+                 * runtime dir while we were opening. If none of the
+                 * opens worked out either, it's on us to remove it. */
+                if (user->runtime_dir != NULL
+                    && get_runtime_dir_for_user (data->manager, data->unix_user) == NULL) {
+                        ck_remove_runtime_dir_for_user (data->unix_user);
+                }
+
+                g_hash_table_remove (data->manager->priv->opening_users, GUINT_TO_POINTER (data->unix_user));
+        }
+
+        open_session_release (data->manager, data->leader);
+
+        g_object_unref (data->session);
+        g_object_unref (data->leader);
+        g_object_unref (data->manager);
+        g_free (data);
+}
+
+static void
+runtime_dir_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+        g_task_return_pointer (task,
+                               ck_generate_runtime_dir_for_user (GPOINTER_TO_UINT (task_data)),
+                               g_free);
+}
+
+static void runtime_dir_start (CkManager *manager,
+                               guint      unix_user);
+
+static void
+runtime_dir_done (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+        CkManager       *manager = CK_MANAGER (source_object);
+        OpeningUser     *user;
+        OpenSessionData *first;
+        GList           *waiting;
+        GList           *l;
+        guint            unix_user;
+
+        unix_user = GPOINTER_TO_UINT (g_task_get_task_data (G_TASK (res)));
+
+        user = g_hash_table_lookup (manager->priv->opening_users, GUINT_TO_POINTER (unix_user));
+        g_assert (user != NULL);
+
+        user->runtime_dir = g_task_propagate_pointer (G_TASK (res), NULL);
+
+        if (user->runtime_dir == NULL) {
+                /* Only the open the attempt was made for goes on without
+                 * a runtime dir, the others each get an attempt of their
+                 * own rather than sharing the failure */
+                first = user->waiting->data;
+                user->waiting = g_list_delete_link (user->waiting, user->waiting);
+
+                g_warning ("Unable to create a runtime dir for user %u", unix_user);
+
+                if (user->waiting != NULL) {
+                        runtime_dir_start (manager, unix_user);
+                }
+
+                open_session_advance (first);
+                return;
+        }
+
+        user->provisioned = TRUE;
+
+        g_debug ("XDG_RUNTIME_DIR is %s", user->runtime_dir);
+
+        waiting = user->waiting;
+        user->waiting = NULL;
+        for (l = waiting; l != NULL; l = l->next) {
+                OpenSessionData *data = l->data;
+
+                ck_session_set_runtime_dir (data->session, user->runtime_dir);
+                open_session_advance (data);
+        }
+        g_list_free (waiting);
+}
+
+static void
+runtime_dir_start (CkManager *manager,
+                   guint      unix_user)
+{
+        GTask *task;
+
+        task = g_task_new (manager, NULL, runtime_dir_done, NULL);
+        g_task_set_task_data (task, GUINT_TO_POINTER (unix_user), NULL);
+        g_task_run_in_thread (task, runtime_dir_thread);
+        g_object_unref (task);
 }
 
 static void
-open_session_for_leader (CkManager             *manager,
-                         CkSessionLeader       *leader,
-                         const GVariant        *parameters,
-                         gboolean               is_local,
-                         GDBusMethodInvocation *context)
+open_session_runtime_dir (OpenSessionData *data)
 {
-        CkProcessGroup *pgroup;
-        CkSession      *session;
-        CkSeat         *seat;
-        const char     *ssid;
-        const char     *cookie;
-        char           *runtime_dir;
-        guint           unix_user;
+        CkManager   *manager = data->manager;
+        OpeningUser *user;
+        const char  *runtime_dir;
 
-        ssid = ck_session_leader_peek_session_id (leader);
-        cookie = ck_session_leader_peek_cookie (leader);
+        user = g_hash_table_lookup (manager->priv->opening_users, GUINT_TO_POINTER (data->unix_user));
+        if (user == NULL) {
+                user = g_new0 (OpeningUser, 1);
+                g_hash_table_insert (manager->priv->opening_users, GUINT_TO_POINTER (data->unix_user), user);
+        }
+        user->n_opening++;
 
-        session = ck_session_new_with_parameters (ssid,
-                                                  cookie,
-                                                  parameters,
-                                                  manager->priv->connection);
+        /* If the user is already logged in, continue to use the same runtime dir. */
+        runtime_dir = get_runtime_dir_for_user (manager, data->unix_user);
+        if (runtime_dir != NULL && !user->provisioned) {
+                user->runtime_dir = g_strdup (runtime_dir);
+                user->provisioned = TRUE;
+        }
 
-        if (session == NULL) {
-                throw_error (context, CK_MANAGER_ERROR_GENERAL, "Unable to create new session");
+        if (user->provisioned) {
+                ck_session_set_runtime_dir (data->session, user->runtime_dir);
+                open_session_advance (data);
                 return;
         }
 
-        unix_user = console_kit_session_get_unix_user (CONSOLE_KIT_SESSION (session));
+        /* otherwise generate a new one, once for all the sessions
+         * that are waiting for it */
+        user->waiting = g_list_append (user->waiting, data);
+        if (user->waiting->next != NULL) {
+                return;
+        }
 
-        /* If the user is already logged in, continue to use the same runtime dir.
-         * We need to do this before adding the session to the manager's table. */
-        runtime_dir = g_strdup (get_runtime_dir_for_user (manager, unix_user));
+        runtime_dir_start (manager, data->unix_user);
+}
 
-        /* otherwise generate a new one */
-        if (runtime_dir == NULL) {
-                runtime_dir = ck_generate_runtime_dir_for_user (unix_user);
-        }
+static void
+process_group_thread (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+        OpenSessionData *data = task_data;
+
+        /* CkProcessGroup serializes the backend calls itself */
+        ck_process_group_create (data->pgroup,
+                                 ck_session_leader_get_pid (data->leader),
+                                 ck_session_leader_peek_session_id (data->leader),
+                                 data->unix_user);
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+process_group_done (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+        open_session_advance (user_data);
+}
 
-        g_debug ("XDG_RUNTIME_DIR is %s", runtime_dir);
-        ck_session_set_runtime_dir (session, runtime_dir);
+static void
+open_session_process_group (OpenSessionData *data)
+{
+        GTask *task;
 
         /* If supported, add the session leader to a process group so we
          * can track it with something better than an environment variable */
-        pgroup = ck_process_group_get ();
-        ck_process_group_create (pgroup,
-                                 ck_session_leader_get_pid (leader),
-                                 ssid,
-                                 unix_user);
+        data->pgroup = ck_process_group_get ();
+
+        task = g_task_new (data->manager, NULL, process_group_done, data);
+        g_task_set_task_data (task, data, NULL);
+        g_task_run_in_thread (task, process_group_thread);
+        g_object_unref (task);
+}
+
+static void
+open_session_attach (OpenSessionData *data)
+{
+        CkManager  *manager = data->manager;
+        CkSession  *session = data->session;
+        CkSeat     *seat;
+        const char *ssid;
+        const char *cookie;
+
+        ssid = ck_session_leader_peek_session_id (data->leader);
+        cookie = ck_session_leader_peek_cookie (data->leader);
+
+        /* the caller may have disconnected in the meantime */
+        if (g_hash_table_lookup (manager->priv->leaders, cookie) != data->leader) {
+                g_debug ("Leader of %s went away while opening the session", ssid);
+                throw_error (data->context, CK_MANAGER_ERROR_GENERAL, "Session leader went away");
+                return;
+        }
 
         g_hash_table_insert (manager->priv->sessions,
                              g_strdup (ssid),
                              g_object_ref (session));
 
+        /* the seat announces the session, it has to be on the bus by then */
+        manager_export_object (manager, ck_session_get_path (session), G_DBUS_INTERFACE_SKELETON (session));
+
         /* Add to seat */
         seat = find_seat_for_session (manager, session);
         if (seat == NULL) {
@@ -2833,21 +4115,94 @@ open_session_for_leader (CkManager             *manager,
         ck_seat_add_session (seat, session, NULL);
 
         /* set the is_local flag for the session */
-        g_debug ("setting session %s is_local %s", ssid, is_local ? "TRUE" : "FALSE");
-        ck_session_set_is_local (session, is_local, NULL);
+        g_debug ("setting session %s is_local %s", ssid, data->is_local ? "TRUE" : "FALSE");
+        ck_session_set_is_local (session, data->is_local, NULL);
 
+        manager_index_session (manager, session);
         manager_update_system_idle_hint (manager);
-        g_signal_connect (CONSOLE_KIT_SESSION (session), "idle-hint-changed",
-                          G_CALLBACK (session_idle_hint_changed),
-                          manager);
 
         /* let consumers know of the new session */
         console_kit_manager_emit_session_new (CONSOLE_KIT_MANAGER (manager), ssid, ck_session_get_path (session));
+        queue_sessions_changed (manager, ssid, ck_session_get_path (session), TRUE);
+
+        g_dbus_method_invocation_return_value (data->context, g_variant_new ("(s)", cookie));
+}
+
+/* Closes the stage that just finished and starts the next one */
+static void
+open_session_advance (OpenSessionData *data)
+{
+        CkManagerPrivate *priv = data->manager->priv;
+        gint64            now;
+        guint             i;
+
+        now = g_get_monotonic_time ();
+        data->stage_usec[data->stage] = now - data->stage_start;
+        priv->open_stage_usec[data->stage] += data->stage_usec[data->stage];
+        data->stage++;
+        data->stage_start = now;
+
+        switch (data->stage) {
+        case OPEN_STAGE_PROCESS_GROUP:
+                open_session_process_group (data);
+                return;
+        case OPEN_STAGE_ATTACH:
+                open_session_attach (data);
+                open_session_advance (data);
+                return;
+        default:
+                break;
+        }
+
+        priv->opens++;
+
+        for (i = 0; i < OPEN_STAGE_LAST; i++) {
+                g_debug ("open %s: %s took %" G_GINT64_FORMAT " us (avg %" G_GINT64_FORMAT " us)",
+                         ck_session_leader_peek_session_id (data->leader),
+                         open_stage_names[i],
+                         data->stage_usec[i],
+                         priv->open_stage_usec[i] / priv->opens);
+        }
+        g_debug ("open %s: done in %" G_GINT64_FORMAT " us",
+                 ck_session_leader_peek_session_id (data->leader),
+                 now - data->start);
+
+        open_session_data_free (data);
+}
+
+static void
+open_session_for_leader (CkManager             *manager,
+                         CkSessionLeader       *leader,
+                         const GVariant        *parameters,
+                         gboolean               is_local,
+                         GDBusMethodInvocation *context)
+{
+        OpenSessionData *data;
+        CkSession       *session;
+
+        session = ck_session_new_with_parameters (ck_session_leader_peek_session_id (leader),
+                                                  ck_session_leader_peek_cookie (leader),
+                                                  parameters,
+                                                  manager->priv->connection);
+
+        if (session == NULL) {
+                throw_error (context, CK_MANAGER_ERROR_GENERAL, "Unable to create new session");
+                open_session_release (manager, leader);
+                return;
+        }
 
-        g_object_unref (session);
-        g_free (runtime_dir);
+        data = g_new0 (OpenSessionData, 1);
+        data->manager = g_object_ref (manager);
+        data->leader = g_object_ref (leader);
+        data->session = session;
+        data->context = context;
+        data->is_local = is_local;
+        data->unix_user = console_kit_session_get_unix_user (CONSOLE_KIT_SESSION (session));
+        data->stage = OPEN_STAGE_RUNTIME_DIR;
+        data->start = g_get_monotonic_time ();
+        data->stage_start = data->start;
 
-        g_dbus_method_invocation_return_value (context , g_variant_new ("(s)", cookie));
+        open_session_runtime_dir (data);
 }
 
 
@@ -2936,6 +4291,7 @@ collect_parameters_cb (CkSessionLeader       *leader,
 {
         if (parameters == NULL) {
                 throw_error (context, CK_MANAGER_ERROR_GENERAL, "Unable to get information about the calling process");
+                open_session_release (manager, leader);
                 return;
         }
 
@@ -2958,32 +4314,205 @@ generate_session_for_leader (CkManager             *manager,
                                                     manager);
         if (! res) {
                 throw_error (context, CK_MANAGER_ERROR_GENERAL, "Unable to get information about the calling process");
+                open_session_release (manager, leader);
         }
 }
 
-static gboolean
-create_session_for_sender (CkManager             *manager,
-                           const char            *sender,
-                           const GVariant        *parameters,
-                           GDBusMethodInvocation *context)
+/* A request to open a session, waiting for its turn */
+typedef struct
+{
+        CkSessionLeader       *leader;
+        GDBusMethodInvocation *context;
+        gint64                 queued;
+} QueuedOpen;
+
+static void
+queued_open_free (QueuedOpen *open)
+{
+        g_object_unref (open->leader);
+        g_free (open);
+}
+
+static void
+open_queue_free (GQueue *queue)
+{
+        g_queue_free_full (queue, (GDestroyNotify) queued_open_free);
+}
+
+/* Takes the next request, going round the users so that one of them
+ * opening many sessions can't hold up everybody else.
+ */
+static QueuedOpen *
+open_session_dequeue (CkManager *manager)
+{
+        CkManagerPrivate *priv = manager->priv;
+        QueuedOpen       *open;
+        GQueue           *queue;
+        gpointer          uid;
+
+        uid = g_queue_pop_head (&priv->open_queue_uids);
+        queue = g_hash_table_lookup (priv->open_queues, uid);
+        g_assert (queue != NULL);
+
+        open = g_queue_pop_head (queue);
+        if (g_queue_is_empty (queue)) {
+                g_hash_table_remove (priv->open_queues, uid);
+        } else {
+                g_queue_push_tail (&priv->open_queue_uids, uid);
+        }
+        priv->open_queued--;
+
+        return open;
+}
+
+static void
+open_session_admit (CkManager             *manager,
+                    CkSessionLeader       *leader,
+                    GDBusMethodInvocation *context,
+                    gint64                 wait)
+{
+        CkManagerPrivate *priv = manager->priv;
+
+        priv->open_admissions++;
+        priv->open_wait_usec += wait;
+        priv->open_wait_max_usec = MAX (priv->open_wait_max_usec, wait);
+
+        g_hash_table_add (priv->open_admitted, g_object_ref (leader));
+
+        generate_session_for_leader (manager, leader, context);
+}
+
+/* Starts the queued requests there is room for */
+static void
+open_session_admit_queued (CkManager *manager)
+{
+        CkManagerPrivate *priv = manager->priv;
+        QueuedOpen       *open;
+        const char       *cookie;
+
+        /* releases from within open_session_admit are picked up by
+         * the loop below */
+        if (priv->open_admitting) {
+                return;
+        }
+        priv->open_admitting = TRUE;
+
+        while (priv->open_queued > 0
+               && (priv->max_opening == 0 || g_hash_table_size (priv->open_admitted) < priv->max_opening)) {
+                open = open_session_dequeue (manager);
+                cookie = ck_session_leader_peek_cookie (open->leader);
+
+                if (g_hash_table_lookup (priv->leaders, cookie) != open->leader) {
+                        g_debug ("Leader of %s went away while waiting to open the session",
+                                 ck_session_leader_peek_session_id (open->leader));
+                        throw_error (open->context, CK_MANAGER_ERROR_GENERAL, "Session leader went away");
+                } else {
+                        open_session_admit (manager,
+                                            open->leader,
+                                            open->context,
+                                            g_get_monotonic_time () - open->queued);
+                }
+
+                queued_open_free (open);
+        }
+
+        priv->open_admitting = FALSE;
+}
+
+/* Called once @leader's session is opened, or failed to. Safe to call
+ * more than once, and for leaders that were never admitted.
+ */
+static void
+open_session_release (CkManager       *manager,
+                      CkSessionLeader *leader)
+{
+        if (g_hash_table_remove (manager->priv->open_admitted, leader)) {
+                open_session_admit_queued (manager);
+        }
+}
+
+/* Opening a session may fork the helper and takes a couple of trips
+ * to the thread pool, so only max_opening of them run at once. The
+ * others wait in a queue per user and are let in round robin.
+ */
+static void
+open_session_enqueue (CkManager             *manager,
+                      CkSessionLeader       *leader,
+                      GDBusMethodInvocation *context,
+                      guint                  unix_user)
+{
+        CkManagerPrivate *priv = manager->priv;
+        QueuedOpen       *open;
+        GQueue           *queue;
+
+        if (priv->open_queued == 0
+            && (priv->max_opening == 0 || g_hash_table_size (priv->open_admitted) < priv->max_opening)) {
+                open_session_admit (manager, leader, context, 0);
+                return;
+        }
+
+        open = g_new0 (QueuedOpen, 1);
+        open->leader = g_object_ref (leader);
+        open->context = context;
+        open->queued = g_get_monotonic_time ();
+
+        queue = g_hash_table_lookup (priv->open_queues, GUINT_TO_POINTER (unix_user));
+        if (queue == NULL) {
+                queue = g_queue_new ();
+                g_hash_table_insert (priv->open_queues, GUINT_TO_POINTER (unix_user), queue);
+                g_queue_push_tail (&priv->open_queue_uids, GUINT_TO_POINTER (unix_user));
+        }
+        g_queue_push_tail (queue, open);
+
+        priv->open_queued++;
+        priv->open_queued_max = MAX (priv->open_queued_max, priv->open_queued);
+
+        g_debug ("Opening of %s deferred, %u sessions waiting",
+                 ck_session_leader_peek_session_id (leader), priv->open_queued);
+}
+
+/* The user a session is opened for, to share the queue out by */
+static guint
+open_session_queue_uid (GVariant *parameters,
+                        uid_t     uid)
+{
+        GVariant *value;
+        guint     unix_user = uid;
+
+        if (parameters == NULL) {
+                return unix_user;
+        }
+
+        value = g_variant_lookup_value (parameters, "unix-user", G_VARIANT_TYPE_INT32);
+        if (value != NULL) {
+                unix_user = g_variant_get_int32 (value);
+                g_variant_unref (value);
+        }
+
+        return unix_user;
+}
+
+static void
+create_session_for_caller (CkManager             *manager,
+                           GDBusMethodInvocation *context,
+                           uid_t                  uid,
+                           pid_t                  pid,
+                           gpointer               data)
 {
-        pid_t           pid = 0;
-        uid_t           uid = 0;
-        gboolean        res;
+        GVariant        *parameters = data;
+        const char      *sender;
         char            *cookie;
         char            *ssid;
         CkSessionLeader *leader;
+        guint64          start_time = 0;
 
-        g_debug ("CkManager: create session for sender: %s", sender);
+        sender = g_dbus_method_invocation_get_sender (context);
 
-        res = get_caller_info (manager,
-                               sender,
-                               &uid,
-                               &pid);
-        if (! res) {
-                g_debug ("Unable to get information about the calling process");
-                throw_error (context, CK_MANAGER_ERROR_GENERAL, "Unable to get information about the calling process");
-                return FALSE;
+        if (manager->priv->open_queued >= MAX_QUEUED_OPENS) {
+                g_debug ("Too many sessions waiting to be opened, refusing %s", sender);
+                manager->priv->open_rejected++;
+                throw_error (context, CK_MANAGER_ERROR_BUSY, "Too many sessions are being opened, try again later");
+                return;
         }
 
         cookie = generate_session_cookie (manager);
@@ -2994,23 +4523,40 @@ create_session_for_sender (CkManager             *manager,
         leader = ck_session_leader_new ();
         ck_session_leader_set_uid (leader, uid);
         ck_session_leader_set_pid (leader, pid);
+        if (ck_pid_index_get_start_time (pid, &start_time)) {
+                ck_session_leader_set_start_time (leader, start_time);
+        }
         ck_session_leader_set_service_name (leader, sender);
         ck_session_leader_set_session_id (leader, ssid);
         ck_session_leader_set_cookie (leader, cookie);
         ck_session_leader_set_override_parameters (leader, parameters);
 
         /* need to store the leader info first so the pending request can be revoked */
-        g_hash_table_insert (manager->priv->leaders,
-                             g_strdup (cookie),
-                             g_object_ref (leader));
+        manager_add_leader (manager, leader);
 
-        generate_session_for_leader (manager,
-                                     leader,
-                                     context);
+        open_session_enqueue (manager,
+                              leader,
+                              context,
+                              open_session_queue_uid (parameters, uid));
 
         g_free (cookie);
         g_free (ssid);
         g_object_unref (leader);
+}
+
+static gboolean
+create_session_for_sender (CkManager             *manager,
+                           const char            *sender,
+                           const GVariant        *parameters,
+                           GDBusMethodInvocation *context)
+{
+        g_debug ("CkManager: create session for sender: %s", sender);
+
+        with_caller_info (manager,
+                          context,
+                          create_session_for_caller,
+                          parameters != NULL ? g_variant_ref ((GVariant *)parameters) : NULL,
+                          (GDestroyNotify) g_variant_unref);
 
         return TRUE;
 }
@@ -3051,16 +4597,15 @@ dbus_get_session (ConsoleKitManager     *ckmanager,
   /org/freedesktop/ConsoleKit/Manager \
   org.freedesktop.ConsoleKit.Manager.GetSessionForCookie string:$XDG_SESSION_COOKIE
 */
-static gboolean
-dbus_get_session_for_cookie (ConsoleKitManager     *ckmanager,
-                             GDBusMethodInvocation *context,
-                             const char            *cookie)
+static void
+get_session_for_cookie_for_caller (CkManager             *manager,
+                                   GDBusMethodInvocation *context,
+                                   uid_t                  calling_uid,
+                                   pid_t                  calling_pid,
+                                   gpointer               data)
 {
-        CkManager       *manager;
+        const char      *cookie = data;
         gboolean         res;
-        const char      *sender;
-        uid_t            calling_uid = 0;
-        pid_t            calling_pid = 0;
         CkProcessStat   *stat;
         char            *ssid;
         CkSession       *session;
@@ -3068,22 +4613,6 @@ dbus_get_session_for_cookie (ConsoleKitManager     *ckmanager,
         GError          *local_error;
 
         ssid = NULL;
-        manager = CK_MANAGER (ckmanager);
-
-        TRACE ();
-
-        sender = g_dbus_method_invocation_get_sender (context);
-
-        res = get_caller_info (manager,
-                               sender,
-                               &calling_uid,
-                               &calling_pid);
-
-        if (! res) {
-                g_debug ("CkManager: Unable to lookup caller info - failing");
-                throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Unable to get information about the calling process"));
-                return TRUE;
-        }
 
         local_error = NULL;
         res = ck_process_stat_new_for_unix_pid (calling_pid, &stat, &local_error);
@@ -3096,7 +4625,7 @@ dbus_get_session_for_cookie (ConsoleKitManager     *ckmanager,
                 g_debug ("CkManager: Unable to lookup info for caller - failing");
 
                 throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Unable to lookup information about calling process '%d'"), calling_pid);
-                return TRUE;
+                return;
         }
 
         /* FIXME: should we restrict this by uid? */
@@ -3107,23 +4636,37 @@ dbus_get_session_for_cookie (ConsoleKitManager     *ckmanager,
         if (leader == NULL) {
                 g_debug ("CkManager: Unable to lookup cookie for caller - failing");
                 throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Unable to find session for cookie"));
-                return TRUE;
+                return;
         }
 
         session = g_hash_table_lookup (manager->priv->sessions, ck_session_leader_peek_session_id (leader));
         if (session == NULL) {
                 g_debug ("CkManager: Unable to lookup session for cookie - failing");
                 throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Unable to find session for cookie"));
-                return TRUE;
+                return;
         }
 
         ck_session_get_id (session, &ssid, NULL);
 
         g_debug ("CkManager: Found session '%s'", ssid);
 
-        console_kit_manager_complete_get_session_for_cookie (ckmanager, context, ck_session_get_path (session));
+        console_kit_manager_complete_get_session_for_cookie (CONSOLE_KIT_MANAGER (manager), context, ck_session_get_path (session));
 
         g_free (ssid);
+}
+
+static gboolean
+dbus_get_session_for_cookie (ConsoleKitManager     *ckmanager,
+                             GDBusMethodInvocation *context,
+                             const char            *cookie)
+{
+        TRACE ();
+
+        with_caller_info (CK_MANAGER (ckmanager),
+                          context,
+                          get_session_for_cookie_for_caller,
+                          g_strdup (cookie),
+                          g_free);
 
         return TRUE;
 }
@@ -3135,50 +4678,47 @@ dbus_get_session_for_cookie (ConsoleKitManager     *ckmanager,
   /org/freedesktop/ConsoleKit/Manager \
   org.freedesktop.ConsoleKit.Manager.GetSessionForUnixProcess uint32:`/sbin/pidof -s bash`
 */
+static void
+get_session_for_unix_process_for_caller (CkManager             *manager,
+                                         GDBusMethodInvocation *context,
+                                         uid_t                  calling_uid,
+                                         pid_t                  calling_pid,
+                                         gpointer               data)
+{
+        guint          pid = GPOINTER_TO_UINT (data);
+        CkSession     *session;
+
+        session = get_session_for_pid (manager, pid);
+        if (session == NULL) {
+                g_debug ("CkManager: unable to lookup session for unix process: %u", pid);
+
+                throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Unable to lookup session information for process '%d'"), pid);
+                return;
+        }
+
+        g_debug ("CkManager: Found session '%s'", ck_session_get_path (session));
+
+        console_kit_manager_complete_get_session_for_unix_process (CONSOLE_KIT_MANAGER (manager), context, ck_session_get_path (session));
+}
+
 static gboolean
 dbus_get_session_for_unix_process (ConsoleKitManager     *ckmanager,
                                    GDBusMethodInvocation *context,
                                    guint                  pid)
 {
-        CkManager     *manager;
-        gboolean       res;
-        const char    *sender;
-        uid_t          calling_uid = 0;
-        pid_t          calling_pid = 0;
-        char          *cookie;
-
         if (pid <= 1 || pid >= UINT_MAX) {
                 throw_error (context, CK_MANAGER_ERROR_INVALID_INPUT, _("pid must be > 1"));
                 return TRUE;
         }
 
-        manager = CK_MANAGER (ckmanager);
-
-        sender = g_dbus_method_invocation_get_sender (context);
-
         TRACE ();
         g_debug ("pid: %u", pid);
 
-        res = get_caller_info (manager,
-                               sender,
-                               &calling_uid,
-                               &calling_pid);
-
-        if (! res) {
-                throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Unable to get information about the calling process"));
-                return TRUE;
-        }
-
-        cookie = get_cookie_for_pid (manager, pid);
-        if (cookie == NULL) {
-                g_debug ("CkManager: unable to lookup session for unix process: %u", pid);
-
-                throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Unable to lookup session information for process '%d'"), pid);
-                return TRUE;
-        }
-
-        dbus_get_session_for_cookie (ckmanager, context, cookie);
-        g_free (cookie);
+        with_caller_info (CK_MANAGER (ckmanager),
+                          context,
+                          get_session_for_unix_process_for_caller,
+                          GUINT_TO_POINTER (pid),
+                          NULL);
 
         return TRUE;
 }
@@ -3199,34 +4739,29 @@ dbus_get_session_by_pid (ConsoleKitManager     *ckmanager,
   /org/freedesktop/ConsoleKit/Manager \
   org.freedesktop.ConsoleKit.Manager.GetCurrentSession
 */
+static void
+get_current_session_for_caller (CkManager             *manager,
+                                GDBusMethodInvocation *context,
+                                uid_t                  calling_uid,
+                                pid_t                  calling_pid,
+                                gpointer               data)
+{
+        dbus_get_session_for_unix_process (CONSOLE_KIT_MANAGER (manager), context, calling_pid);
+}
+
 static gboolean
 dbus_get_current_session (ConsoleKitManager     *ckmanager,
                           GDBusMethodInvocation *context)
 {
-        CkManager  *manager;
-        gboolean    res;
-        const char *sender;
-        uid_t       calling_uid = 0;
-        pid_t       calling_pid = 0;
-
-        TRACE ();
-
-        manager = CK_MANAGER (ckmanager);
-        sender = g_dbus_method_invocation_get_sender (context);
+        TRACE ();
 
         g_debug ("CkManager: get current session");
 
-        res = get_caller_info (manager,
-                               sender,
-                               &calling_uid,
-                               &calling_pid);
-
-        if (! res) {
-                throw_error (context, CK_MANAGER_ERROR_GENERAL, _("Unable to get information about the calling process"));
-                return TRUE;
-        }
-
-        dbus_get_session_for_unix_process (ckmanager, context, calling_pid);
+        with_caller_info (CK_MANAGER (ckmanager),
+                          context,
+                          get_current_session_for_caller,
+                          NULL,
+                          NULL);
 
         return TRUE;
 }
@@ -3273,6 +4808,7 @@ remove_session_for_cookie (CkManager  *manager,
         guint            unix_user;
         gboolean         res;
         gboolean         ret;
+        gboolean         last_session;
 
         ret = FALSE;
         orig_ssid = NULL;
@@ -3343,18 +4879,26 @@ remove_session_for_cookie (CkManager  *manager,
         g_hash_table_steal (manager->priv->sessions,
                             ck_session_leader_peek_session_id (leader));
 
+        last_session = manager_unindex_session (manager, orig_session);
+        ck_pid_index_remove_session (manager->priv->pid_index, orig_ssid);
+
         ck_manager_dump (manager);
 
         manager_update_system_idle_hint (manager);
 
+        manager_unexport_object (manager, ck_session_get_path (orig_session));
+
         /* let consumers know the session is gone */
         console_kit_manager_emit_session_removed (CONSOLE_KIT_MANAGER (manager),
                                                   orig_ssid,
                                                   ck_session_get_path (orig_session));
+        queue_sessions_changed (manager, orig_ssid, ck_session_get_path (orig_session), FALSE);
 
-        if (get_runtime_dir_for_user (manager, unix_user) == NULL) {
+        if (last_session
+            && g_hash_table_lookup (manager->priv->opening_users, GUINT_TO_POINTER (unix_user)) == NULL) {
                 /* We removed the session and now there's no runtime dir
-                 * associated with that user.
+                 * associated with that user, nor is another session of
+                 * theirs being opened.
                  * Remove the runtime dir from the system.
                  */
                 ck_remove_runtime_dir_for_user (unix_user);
@@ -3418,42 +4962,24 @@ paranoia_check_is_cookie_owner (CkManager  *manager,
         return TRUE;
 }
 
-static gboolean
-dbus_close_session (ConsoleKitManager     *ckmanager,
-                    GDBusMethodInvocation *context,
-                    const char            *cookie)
+static void
+close_session_for_caller (CkManager             *manager,
+                          GDBusMethodInvocation *context,
+                          uid_t                  calling_uid,
+                          pid_t                  calling_pid,
+                          gpointer               data)
 {
-        CkManager  *manager;
+        const char *cookie = data;
         gboolean    res;
-        const char *sender;
-        uid_t       calling_uid = 0;
-        pid_t       calling_pid = 0;
         GError     *error;
 
-        TRACE ();
-
-        g_debug ("Closing session for cookie: %s", cookie);
-
-        manager = CK_MANAGER (ckmanager);
-
-        sender = g_dbus_method_invocation_get_sender (context);
-        res = get_caller_info (manager,
-                               sender,
-                               &calling_uid,
-                               &calling_pid);
-
-        if (! res) {
-                throw_error (context, CK_MANAGER_ERROR_FAILED, _("Unable to lookup information about calling process '%d'"), calling_pid);
-                return TRUE;
-        }
-
         error = NULL;
         res = paranoia_check_is_cookie_owner (manager, cookie, calling_uid, calling_pid, &error);
         if (! res) {
                 throw_error (context, CK_MANAGER_ERROR_FAILED, "%s", error->message);
                 g_error_free (error);
 
-                return TRUE;
+                return;
         }
 
         error = NULL;
@@ -3461,84 +4987,276 @@ dbus_close_session (ConsoleKitManager     *ckmanager,
         if (! res) {
                 throw_error (context, CK_MANAGER_ERROR_FAILED, "%s", error->message);
                 g_clear_error (&error);
-                return TRUE;
+                return;
         } else {
-                g_hash_table_remove (manager->priv->leaders, cookie);
+                manager_remove_leader (manager, cookie);
         }
 
-        console_kit_manager_complete_close_session (ckmanager, context, TRUE);
+        console_kit_manager_complete_close_session (CONSOLE_KIT_MANAGER (manager), context, TRUE);
+}
+
+static gboolean
+dbus_close_session (ConsoleKitManager     *ckmanager,
+                    GDBusMethodInvocation *context,
+                    const char            *cookie)
+{
+        TRACE ();
+
+        g_debug ("Closing session for cookie: %s", cookie);
+
+        with_caller_info (CK_MANAGER (ckmanager),
+                          context,
+                          close_session_for_caller,
+                          g_strdup (cookie),
+                          g_free);
+
         return TRUE;
 }
 
-typedef struct {
-    CkManager *manager;
-    const char *cookie;
-    CkSessionLeader *leader;
-} RemoveEntity;
+static void
+remove_sessions_for_connection (CkManager   *manager,
+                                const gchar *service_name)
+{
+        LeaderConnection *conn;
+        GHashTableIter    iter;
+        gpointer          name;
+        gpointer          cookie;
+        CkSessionLeader  *leader;
 
-typedef struct {
-        const char *service_name;
-        CkManager *manager;
-        GPtrArray *entities;
-} RemoveLeaderData;
+        if (!g_hash_table_lookup_extended (manager->priv->leader_connections,
+                                           service_name,
+                                           &name,
+                                           (gpointer *) &conn)) {
+                return;
+        }
 
-static gboolean
-remove_leader_for_connection (const char       *cookie,
-                              CkSessionLeader  *leader,
-                              RemoveLeaderData *data)
-{
-        const char *name;
-
-        g_assert (leader != NULL);
-        g_assert (data->service_name != NULL);
-
-        name = ck_session_leader_peek_service_name (leader);
-        if (strcmp (name, data->service_name) == 0) {
-                RemoveEntity *entity = g_malloc(sizeof(*entity));
-                if (entity) {
-                    entity->manager = data->manager;
-                    entity->cookie = cookie;
-                    entity->leader = leader;
-                    g_ptr_array_add(data->entities, entity);
-                    return TRUE;
+        g_debug ("Removing sessions for service name: %s", service_name);
+
+        g_hash_table_steal (manager->priv->leader_connections, name);
+
+        g_hash_table_iter_init (&iter, conn->cookies);
+        while (g_hash_table_iter_next (&iter, &cookie, NULL)) {
+                leader = g_hash_table_lookup (manager->priv->leaders, cookie);
+                if (leader == NULL) {
+                        continue;
                 }
+
+                g_object_ref (leader);
+                g_hash_table_remove (manager->priv->leaders, cookie);
+
+                remove_session_for_cookie (manager, cookie, leader, NULL);
+                ck_session_leader_cancel (leader);
+                /* its collect job won't report back */
+                open_session_release (manager, leader);
+                g_object_unref (leader);
         }
 
-        return FALSE;
+        leader_connection_free (conn);
+        g_free (name);
 }
 
-static void
-destroy_entity(gpointer data)
+static GKeyFile *
+load_restore_file (void)
 {
-    RemoveEntity *ent = data;
+        GKeyFile *key_file;
+        GError   *error = NULL;
+
+        key_file = g_key_file_new ();
+        if (!g_key_file_load_from_file (key_file, RESTORE_FILE, G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+                        g_warning ("Unable to load %s: %s", RESTORE_FILE, error->message);
+                }
+                g_error_free (error);
+                g_key_file_free (key_file);
+                return NULL;
+        }
 
-    remove_session_for_cookie (ent->manager, ent->cookie, ent->leader, NULL);
-    ck_session_leader_cancel (ent->leader);
-    g_object_unref(ent->leader);
-    g_free(ent);
+        return key_file;
 }
 
-static void
-remove_sessions_for_connection (CkManager   *manager,
-                                const gchar *service_name)
-{
-        RemoveLeaderData data;
-        guint n;
+/* Brings back the session described by the "SessionLeader" @group of
+ * the restore file, provided its leader is still running. Unlike
+ * OpenSession this doesn't spawn the collector, everything it would
+ * tell us is already in the file.
+ */
+static gboolean
+restore_session_for_leader (CkManager  *manager,
+                            GKeyFile   *key_file,
+                            const char *group,
+                            uid_t      *uid)
+{
+        CkSessionLeader *leader = NULL;
+        CkSession       *session = NULL;
+        CkSeat          *seat;
+        char            *ssid;
+        char            *cookie;
+        char            *service_name;
+        char            *start_time_str;
+        char            *session_group = NULL;
+        pid_t            pid;
+        guint64          start_time;
+        guint64          current_start_time;
+        guint32          serial;
+        gboolean         is_local;
+        gboolean         ret = FALSE;
+
+        ssid = g_key_file_get_string (key_file, group, "session", NULL);
+        cookie = g_key_file_get_string (key_file, group, "cookie", NULL);
+        service_name = g_key_file_get_string (key_file, group, "service_name", NULL);
+        start_time_str = g_key_file_get_string (key_file, group, "start_time", NULL);
+        pid = g_key_file_get_integer (key_file, group, "pid", NULL);
+        *uid = g_key_file_get_integer (key_file, group, "uid", NULL);
+
+        if (ssid == NULL || cookie == NULL || service_name == NULL || pid <= 1) {
+                g_debug ("Skipping incomplete %s", group);
+                goto out;
+        }
 
-        g_debug ("Removing sessions for service name: %s", service_name);
+        if (g_hash_table_lookup (manager->priv->sessions, ssid) != NULL
+            || g_hash_table_lookup (manager->priv->leaders, cookie) != NULL) {
+                g_debug ("Skipping duplicate %s", group);
+                goto out;
+        }
+
+        /* The leader has to be the very process that opened the
+         * session, not just something that got its pid since. Without
+         * a start time to compare there's no telling them apart. */
+        start_time = start_time_str != NULL ? g_ascii_strtoull (start_time_str, NULL, 10) : 0;
+        if (start_time == 0) {
+                g_debug ("No start time for leader %d of %s, not restoring it", pid, ssid);
+                goto out;
+        }
+
+        if (!ck_pid_index_get_start_time (pid, &current_start_time)
+            || start_time != current_start_time) {
+                g_debug ("Leader %d of %s is gone, not restoring it", pid, ssid);
+                goto out;
+        }
+
+        session = ck_session_new_from_key_file (ssid, cookie, key_file, manager->priv->connection);
+        if (session == NULL) {
+                g_warning ("Unable to restore session %s", ssid);
+                goto out;
+        }
+
+        if (ck_session_get_runtime_dir (session) == NULL) {
+                char *runtime_dir;
+
+                runtime_dir = g_strdup (get_runtime_dir_for_user (manager, *uid));
+                if (runtime_dir == NULL) {
+                        runtime_dir = ck_generate_runtime_dir_for_user (*uid);
+                }
+                ck_session_set_runtime_dir (session, runtime_dir);
+                g_free (runtime_dir);
+        }
+
+        leader = ck_session_leader_new ();
+        ck_session_leader_set_uid (leader, *uid);
+        ck_session_leader_set_pid (leader, pid);
+        ck_session_leader_set_start_time (leader, current_start_time);
+        ck_session_leader_set_service_name (leader, service_name);
+        ck_session_leader_set_session_id (leader, ssid);
+        ck_session_leader_set_cookie (leader, cookie);
+
+        manager_add_leader (manager, leader);
+        g_hash_table_insert (manager->priv->sessions,
+                             g_strdup (ssid),
+                             g_object_ref (session));
+
+        manager_export_object (manager, ck_session_get_path (session), G_DBUS_INTERFACE_SKELETON (session));
+
+        seat = find_seat_for_session (manager, session);
+        if (seat == NULL) {
+                seat = add_new_seat (manager, CK_SEAT_KIND_DYNAMIC);
+        }
+
+        ck_seat_add_session (seat, session, NULL);
+
+        session_group = g_strdup_printf ("Session %s", ssid);
+        is_local = g_key_file_get_boolean (key_file, session_group, "is_local", NULL);
+        ck_session_set_is_local (session, is_local, NULL);
+
+        manager_index_session (manager, session);
+        ck_pid_index_insert (manager->priv->pid_index, pid, current_start_time, ssid);
+
+        /* don't hand out the restored ids again */
+        if (sscanf (ssid, "Session%u", &serial) == 1 && serial >= manager->priv->session_serial) {
+                manager->priv->session_serial = serial + 1;
+        }
+
+        g_debug ("Restored %s for leader %d", ssid, pid);
+
+        ret = TRUE;
+ out:
+        if (session != NULL) {
+                g_object_unref (session);
+        }
+        if (leader != NULL) {
+                g_object_unref (leader);
+        }
+        g_free (session_group);
+        g_free (start_time_str);
+        g_free (service_name);
+        g_free (cookie);
+        g_free (ssid);
+
+        return ret;
+}
+
+/* Rebuilds the sessions a previous instance of the daemon left in
+ * RESTORE_FILE, so restarting it doesn't log everybody out. Must run
+ * after the static seats are created and the manager is on the bus,
+ * manager_add_leader checks the leaders are still connected.
+ */
+static void
+restore_sessions (CkManager *manager,
+                  GKeyFile  *key_file)
+{
+        GHashTable     *dropped_users;
+        GHashTableIter  iter;
+        gpointer        key;
+        gchar         **groups;
+        gint64          start;
+        guint           n_restored = 0;
+        guint           n_dropped = 0;
+        uid_t           uid;
+        guint           i;
+
+        start = g_get_monotonic_time ();
+
+        dropped_users = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+        groups = g_key_file_get_groups (key_file, NULL);
+        for (i = 0; groups[i] != NULL; i++) {
+                if (!g_str_has_prefix (groups[i], "SessionLeader ")) {
+                        continue;
+                }
 
-        data.manager = manager;
-        data.service_name = service_name;
-        data.entities = g_ptr_array_new_with_free_func(destroy_entity);
+                if (restore_session_for_leader (manager, key_file, groups[i], &uid)) {
+                        n_restored++;
+                } else {
+                        g_hash_table_add (dropped_users, GUINT_TO_POINTER (uid));
+                        n_dropped++;
+                }
+        }
+        g_strfreev (groups);
 
-        n = g_hash_table_foreach_steal (manager->priv->leaders,
-                                        (GHRFunc)remove_leader_for_connection,
-                                        &data);
-        while (n-- > 0) {
-            g_ptr_array_remove_index_fast (data.entities, 0);
+        /* Runtime dirs of users who have no sessions left would
+         * otherwise never be cleaned up */
+        g_hash_table_iter_init (&iter, dropped_users);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                if (get_runtime_dir_for_user (manager, GPOINTER_TO_UINT (key)) == NULL) {
+                        ck_remove_runtime_dir_for_user (GPOINTER_TO_UINT (key));
+                }
         }
-        g_assert (data.entities->len == 0);
-        g_ptr_array_free (data.entities, TRUE);
+
+        g_hash_table_destroy (dropped_users);
+
+        manager_update_system_idle_hint (manager);
+        ck_manager_dump (manager);
+
+        g_debug ("Restored %u sessions (%u dropped) in %" G_GINT64_FORMAT " us",
+                 n_restored, n_dropped, g_get_monotonic_time () - start);
 }
 
 #ifdef HAVE_POLKIT
@@ -3550,33 +5268,182 @@ polkit_authority_get_cb (GObject *source_object,
         CkManager *manager = CK_MANAGER (user_data);
 
         manager->priv->pol_ctx = polkit_authority_get_finish (res, NULL);
+
+        if (manager->priv->pol_ctx != NULL) {
+                g_signal_connect (manager->priv->pol_ctx,
+                                  "changed",
+                                  G_CALLBACK (on_polkit_authority_changed),
+                                  manager);
+        }
 }
 #endif
 
 
 static void
-on_name_owner_notify (GDBusConnection *connection,
-                      const gchar     *sender_name,
-                      const gchar     *object_path,
-                      const gchar     *interface_name,
-                      const gchar     *signal_name,
-                      GVariant        *parameters,
-                      gpointer         user_data)
+manager_export_object (CkManager              *manager,
+                       const char             *path,
+                       GDBusInterfaceSkeleton *skeleton)
 {
-        CkManager *manager = CK_MANAGER (user_data);
-        gchar     *service_name, *old_service_name, *new_service_name;
+        GDBusObjectSkeleton *object;
 
-        g_variant_get (parameters, "(&s&s&s)", &service_name, &old_service_name, &new_service_name);
+        g_debug ("exporting path %s", path);
 
-        if (strlen (new_service_name) == 0) {
-                remove_sessions_for_connection (manager, old_service_name);
+        object = g_dbus_object_skeleton_new (path);
+        g_dbus_object_skeleton_add_interface (object, skeleton);
+        g_dbus_object_manager_server_export (manager->priv->object_manager, object);
+        g_object_unref (object);
+}
+
+static void
+manager_unexport_object (CkManager  *manager,
+                         const char *path)
+{
+        g_debug ("unexporting path %s", path);
+
+        g_dbus_object_manager_server_unexport (manager->priv->object_manager, path);
+}
+
+static void
+add_leader_jobs (const char      *cookie,
+                 CkSessionLeader *leader,
+                 guint           *n_jobs)
+{
+        *n_jobs += ck_session_leader_get_n_pending_jobs (leader);
+}
+
+static void
+add_statistics_counters (CkStatistics    *statistics,
+                         GVariantBuilder *builder,
+                         CkManager       *manager)
+{
+        CkManagerPrivate *priv = manager->priv;
+        guint             entries;
+        guint             hits;
+        guint             misses;
+        guint             n_jobs;
+        gint64            max_usec;
+        gsize             bytes;
+        gsize             bytes_saved;
+        guint             pauses;
+        guint             pause_timeouts;
+        gint64            pause_avg_usec;
+        gint64            pause_max_usec;
+        gint64            vt_stage_usec[CK_SEAT_VT_SWITCH_LAST] = { 0, };
+        guint             vt_switches;
+        guint             seat_switches;
+        GHashTableIter    iter;
+        gpointer          seat;
+        guint             i;
+
+#define ADD_UINT32(name, value) g_variant_builder_add (builder, "{sv}", name, g_variant_new_uint32 (value))
+#define ADD_INT64(name, value)  g_variant_builder_add (builder, "{sv}", name, g_variant_new_int64 (value))
+
+        ADD_UINT32 ("sessions", g_hash_table_size (priv->sessions));
+        ADD_UINT32 ("session-leaders", g_hash_table_size (priv->leaders));
+        ADD_UINT32 ("leader-connections", g_hash_table_size (priv->leader_connections));
+        ADD_UINT32 ("seats", g_hash_table_size (priv->seats));
+        ADD_UINT32 ("users", g_hash_table_size (priv->users));
+        ADD_UINT32 ("inhibitors", ck_inhibit_manager_get_n_inhibitors (priv->inhibit_manager));
+
+        n_jobs = 0;
+        g_hash_table_foreach (priv->leaders, (GHFunc) add_leader_jobs, &n_jobs);
+        ADD_UINT32 ("pending-jobs", n_jobs);
+        ADD_UINT32 ("opening-users", g_hash_table_size (priv->opening_users));
+
+        if (priv->logger != NULL) {
+                ADD_UINT32 ("event-logger-queue", ck_event_logger_get_queue_length (priv->logger));
+        }
+
+        ck_pid_index_get_stats (priv->pid_index, &entries, &hits, &misses);
+        ADD_UINT32 ("pid-index-entries", entries);
+        ADD_UINT32 ("pid-index-hits", hits);
+        ADD_UINT32 ("pid-index-misses", misses);
+
+        ck_caller_cache_get_stats (ck_caller_cache_get (), &entries, &hits, &misses);
+        ADD_UINT32 ("caller-cache-entries", entries);
+        ADD_UINT32 ("caller-cache-hits", hits);
+        ADD_UINT32 ("caller-cache-misses", misses);
+
+        ck_string_pool_get_stats (&entries, &bytes, &bytes_saved);
+        ADD_UINT32 ("string-pool-entries", entries);
+        ADD_UINT32 ("string-pool-bytes", bytes);
+        ADD_UINT32 ("string-pool-bytes-saved", bytes_saved);
+
+        ck_query_server_get_stats (priv->query_server, &entries, &hits, &misses);
+        ADD_UINT32 ("query-server-states", entries);
+        ADD_UINT32 ("query-server-served", hits);
+        ADD_UINT32 ("query-server-passed", misses);
+
+        g_mutex_lock (&priv->dump_lock);
+        ADD_UINT32 ("database-writes", priv->dump_writes);
+        ADD_INT64 ("database-write-avg-usec", priv->dump_writes > 0 ? priv->dump_total_usec / priv->dump_writes : 0);
+        ADD_INT64 ("database-write-max-usec", priv->dump_max_usec);
+        g_mutex_unlock (&priv->dump_lock);
+
+        ck_watchdog_get_stats (&entries, &max_usec);
+        ADD_UINT32 ("main-loop-stalls", entries);
+        ADD_INT64 ("main-loop-max-stall-usec", max_usec);
+
+        ADD_UINT32 ("sessions-opened", priv->opens);
+        ADD_UINT32 ("open-admitted", g_hash_table_size (priv->open_admitted));
+        ADD_UINT32 ("open-queue-depth", priv->open_queued);
+        ADD_UINT32 ("open-queue-max-depth", priv->open_queued_max);
+        ADD_UINT32 ("open-queue-rejected", priv->open_rejected);
+        ADD_INT64 ("open-queue-wait-avg-usec",
+                   priv->open_admissions > 0 ? priv->open_wait_usec / priv->open_admissions : 0);
+        ADD_INT64 ("open-queue-wait-max-usec", priv->open_wait_max_usec);
+        ADD_UINT32 ("system-action-delays", priv->system_action_delays);
+        ADD_UINT32 ("system-action-delay-timeouts", priv->system_action_delay_timeouts);
+        ADD_INT64 ("system-action-delay-avg-usec",
+                   priv->system_action_delays > 0 ? priv->system_action_delay_usec / priv->system_action_delays : 0);
+        ADD_INT64 ("system-action-delay-max-usec", priv->system_action_delay_max_usec);
+        for (i = 0; i < OPEN_STAGE_LAST; i++) {
+                char *name;
+
+                name = g_strdup_printf ("open-%s-avg-usec", open_stage_names[i]);
+                ADD_INT64 (name, priv->opens > 0 ? priv->open_stage_usec[i] / priv->opens : 0);
+                g_free (name);
+        }
+
+        ck_session_get_pause_stats (&pauses, &pause_timeouts, &pause_avg_usec, &pause_max_usec);
+        ADD_UINT32 ("device-pauses", pauses);
+        ADD_UINT32 ("device-pause-timeouts", pause_timeouts);
+        ADD_INT64 ("device-pause-avg-usec", pause_avg_usec);
+        ADD_INT64 ("device-pause-max-usec", pause_max_usec);
+
+        vt_switches = 0;
+        max_usec = 0;
+        g_hash_table_iter_init (&iter, priv->seats);
+        while (g_hash_table_iter_next (&iter, NULL, &seat)) {
+                gint64 stage_usec[CK_SEAT_VT_SWITCH_LAST];
+                gint64 seat_max_usec;
+
+                ck_seat_get_vt_switch_stats (CK_SEAT (seat), &seat_switches, stage_usec, &seat_max_usec);
+                vt_switches += seat_switches;
+                for (i = 0; i < CK_SEAT_VT_SWITCH_LAST; i++) {
+                        vt_stage_usec[i] += stage_usec[i];
+                }
+                max_usec = MAX (max_usec, seat_max_usec);
+        }
+        ADD_UINT32 ("vt-switches", vt_switches);
+        ADD_INT64 ("vt-switch-max-usec", max_usec);
+        for (i = 0; i < CK_SEAT_VT_SWITCH_LAST; i++) {
+                char *name;
+
+                name = g_strdup_printf ("vt-switch-%s-avg-usec", ck_seat_get_vt_switch_stage_name (i));
+                ADD_INT64 (name, vt_switches > 0 ? vt_stage_usec[i] / vt_switches : 0);
+                g_free (name);
         }
+
+#undef ADD_UINT32
+#undef ADD_INT64
 }
 
 static gboolean
 register_manager (CkManager *manager, GDBusConnection *connection)
 {
-        GError *error = NULL;
+        GError   *error = NULL;
+        GKeyFile *restore;
 
         manager->priv->connection = connection;
 
@@ -3597,36 +5464,31 @@ register_manager (CkManager *manager, GDBusConnection *connection)
 
         g_debug ("exported on %s", g_dbus_interface_skeleton_get_object_path (G_DBUS_INTERFACE_SKELETON (CONSOLE_KIT_MANAGER (manager))));
 
-        /* connect to DBus for get_caller_info */
-        manager->priv->bus_proxy = g_dbus_proxy_new_sync (manager->priv->connection,
-                                                          G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
-                                                          G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
-                                                          NULL,
-                                                          "org.freedesktop.DBus",
-                                                          "/org/freedesktop/DBus/Bus",
-                                                          "org.freedesktop.DBus",
-                                                          NULL,
-                                                          &error);
-        if (manager->priv->bus_proxy == NULL) {
-                g_warning ("cannot connect to DBus: %s", error->message);
+        manager->priv->object_manager = g_dbus_object_manager_server_new (CK_DBUS_PATH);
+        g_dbus_object_manager_server_set_connection (manager->priv->object_manager, manager->priv->connection);
+
+        /* ahead of the query server so its filter sees what that answers */
+        if (!ck_statistics_register (manager->priv->statistics,
+                                     manager->priv->connection,
+                                     CK_MANAGER_DBUS_PATH,
+                                     &error)) {
+                g_warning ("error exporting statistics interface: %s", error->message);
                 g_clear_error (&error);
-                return FALSE;
         }
 
-        manager->priv->name_owner_id = g_dbus_connection_signal_subscribe (manager->priv->connection,
-                                                                           "org.freedesktop.DBus",
-                                                                           "org.freedesktop.DBus",
-                                                                           "NameOwnerChanged",
-                                                                           "/org/freedesktop/DBus",
-                                                                           NULL,
-                                                                           G_DBUS_SIGNAL_FLAGS_NONE,
-                                                                           on_name_owner_notify,
-                                                                           manager,
-                                                                           NULL);
+        ck_query_server_attach (manager->priv->query_server, manager->priv->connection);
+
+        /* read it before creating the seats rewrites it */
+        restore = load_restore_file ();
 
         /* create the seats after we've registered on the manager on the bus */
         create_seats (manager);
 
+        if (restore != NULL) {
+                restore_sessions (manager, restore);
+                g_key_file_free (restore);
+        }
+
         return TRUE;
 }
 
@@ -3640,33 +5502,17 @@ ck_manager_class_init (CkManagerClass *klass)
         g_type_class_add_private (klass, sizeof (CkManagerPrivate));
 }
 
-typedef struct {
-        guint       uid;
-        GHashTable *hash;
-} GetSessionsData;
-
-static void
-collect_sessions_for_user (char            *ssid,
-                           CkSession       *session,
-                           GetSessionsData *data)
-{
-        guint    uid;
-
-        uid = console_kit_session_get_unix_user (CONSOLE_KIT_SESSION(session));
-
-        if (uid == data->uid) {
-                g_hash_table_add (data->hash, g_strdup (ck_session_get_path (session)));
-        }
-}
-
 static gboolean
 dbus_get_sessions_for_unix_user (ConsoleKitManager     *ckmanager,
                                  GDBusMethodInvocation *context,
                                  guint                  uid)
 {
         CkManager        *manager;
-        GetSessionsData  *data;
+        CkManagerUser    *user;
+        GHashTableIter    iter;
+        gpointer          session;
         const gchar     **sessions;
+        guint             i;
 
         TRACE ();
 
@@ -3674,28 +5520,25 @@ dbus_get_sessions_for_unix_user (ConsoleKitManager     *ckmanager,
 
         g_return_val_if_fail (CK_IS_MANAGER (manager), FALSE);
 
-        data = g_new0 (GetSessionsData, 1);
-        data->uid = uid;
-
-        /* Create a new hash table that we can fill with the ssids that belong to the user */
-        data->hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-
-        g_hash_table_foreach (manager->priv->sessions, (GHFunc)collect_sessions_for_user, data);
-
-        /* pull out the session ids in a format gdbus likes */
-        sessions = (const gchar**)g_hash_table_get_keys_as_array (data->hash, NULL);
+        user = g_hash_table_lookup (manager->priv->users, GUINT_TO_POINTER (uid));
 
         /* gdbus/gvariant requires that we throw an error to return NULL */
-        if (sessions == NULL) {
+        if (user == NULL) {
                 throw_error (context, CK_MANAGER_ERROR_NO_SESSIONS, _("User has no sessions"));
-                g_hash_table_destroy (data->hash);
-                g_free (data);
                 return TRUE;
         }
 
+        /* pull out the session paths in a format gdbus likes */
+        sessions = g_new0 (const gchar *, g_hash_table_size (user->sessions) + 1);
+
+        i = 0;
+        g_hash_table_iter_init (&iter, user->sessions);
+        while (g_hash_table_iter_next (&iter, &session, NULL)) {
+                sessions[i++] = ck_session_get_path (CK_SESSION (session));
+        }
+
         console_kit_manager_complete_get_sessions_for_unix_user (ckmanager, context, sessions);
-        g_hash_table_destroy (data->hash);
-        g_free (data);
+        g_free (sessions);
         return TRUE;
 }
 
@@ -3888,7 +5731,12 @@ dbus_list_sessions (ConsoleKitManager     *ckmanager,
                 return TRUE;
         }
 
-        g_variant_builder_init (&session_builder, G_VARIANT_TYPE_ARRAY);
+        if (manager->priv->list_sessions_reply != NULL) {
+                g_dbus_method_invocation_return_value (context, manager->priv->list_sessions_reply);
+                return TRUE;
+        }
+
+        g_variant_builder_init (&session_builder, G_VARIANT_TYPE ("a(susso)"));
 
         g_hash_table_iter_init (&session_iter, manager->priv->sessions);
         while (g_hash_table_iter_next (&session_iter,  (gpointer *)&key,  (gpointer *)&value)) {
@@ -3909,7 +5757,9 @@ dbus_list_sessions (ConsoleKitManager     *ckmanager,
                 g_free (sid);
         }
 
-        console_kit_manager_complete_list_sessions (ckmanager, context, g_variant_builder_end (&session_builder));
+        manager->priv->list_sessions_reply = g_variant_ref_sink (g_variant_new ("(a(susso))", &session_builder));
+
+        g_dbus_method_invocation_return_value (context, manager->priv->list_sessions_reply);
         return TRUE;
 }
 
@@ -3936,7 +5786,12 @@ dbus_list_seats (ConsoleKitManager     *ckmanager,
                 return TRUE;
         }
 
-        g_variant_builder_init (&seat_builder, G_VARIANT_TYPE_ARRAY);
+        if (manager->priv->list_seats_reply != NULL) {
+                g_dbus_method_invocation_return_value (context, manager->priv->list_seats_reply);
+                return TRUE;
+        }
+
+        g_variant_builder_init (&seat_builder, G_VARIANT_TYPE ("a(so)"));
 
         g_hash_table_iter_init (&seat_iter, manager->priv->seats);
         while (g_hash_table_iter_next (&seat_iter,  (gpointer *)&key,  (gpointer *)&value)) {
@@ -3947,7 +5802,9 @@ dbus_list_seats (ConsoleKitManager     *ckmanager,
                 g_variant_builder_add_value (&seat_builder, seat);
         }
 
-        console_kit_manager_complete_list_seats (ckmanager, context, g_variant_builder_end (&seat_builder));
+        manager->priv->list_seats_reply = g_variant_ref_sink (g_variant_new ("(a(so))", &seat_builder));
+
+        g_dbus_method_invocation_return_value (context, manager->priv->list_seats_reply);
         return TRUE;
 }
 
@@ -3955,8 +5812,10 @@ static gboolean
 dbus_get_seats (ConsoleKitManager     *ckmanager,
                 GDBusMethodInvocation *context)
 {
-        CkManager    *manager;
-        GPtrArray    *seats;
+        CkManager      *manager;
+        GVariantBuilder seats;
+        GHashTableIter  iter;
+        gpointer        value;
 
         TRACE ();
 
@@ -3964,22 +5823,24 @@ dbus_get_seats (ConsoleKitManager     *ckmanager,
 
         g_return_val_if_fail (CK_IS_MANAGER (manager), FALSE);
 
-        seats = g_hash_table_get_values_as_ptr_array (manager->priv->seats);
-
         /* gdbus/gvariant requires that we throw an error to return NULL */
-        if (seats->len == 0) {
+        if (g_hash_table_size (manager->priv->seats) == 0) {
                 throw_error (context, CK_MANAGER_ERROR_NO_SEATS, _("User has no seats"));
                 return TRUE;
         }
 
-        /* replace each session with its path */
-        for (guint i = 0; i < seats->len; i++) {
-                seats->pdata[i] = (gpointer) ck_seat_get_path ( CK_SEAT(seats->pdata[i]) );
+        if (manager->priv->get_seats_reply == NULL) {
+                g_variant_builder_init (&seats, G_VARIANT_TYPE ("ao"));
+
+                g_hash_table_iter_init (&iter, manager->priv->seats);
+                while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                        g_variant_builder_add (&seats, "o", ck_seat_get_path (CK_SEAT (value)));
+                }
+
+                manager->priv->get_seats_reply = g_variant_ref_sink (g_variant_new ("(ao)", &seats));
         }
 
-        g_ptr_array_add (seats, NULL);
-        console_kit_manager_complete_get_seats (ckmanager, context, (const gchar**)seats->pdata);
-        g_ptr_array_unref (seats);
+        g_dbus_method_invocation_return_value (context, manager->priv->get_seats_reply);
         return TRUE;
 }
 
@@ -3987,8 +5848,10 @@ static gboolean
 dbus_get_sessions (ConsoleKitManager     *ckmanager,
                    GDBusMethodInvocation *context)
 {
-        CkManager    *manager;
-        GPtrArray    *sessions;
+        CkManager      *manager;
+        GVariantBuilder sessions;
+        GHashTableIter  iter;
+        gpointer        value;
 
         TRACE ();
 
@@ -3996,22 +5859,50 @@ dbus_get_sessions (ConsoleKitManager     *ckmanager,
 
         g_return_val_if_fail (CK_IS_MANAGER (manager), FALSE);
 
-        sessions = g_hash_table_get_values_as_ptr_array (manager->priv->sessions);
-
         /* gdbus/gvariant requires that we throw an error to return NULL */
-        if (sessions->len == 0) {
+        if (g_hash_table_size (manager->priv->sessions) == 0) {
                 throw_error (context, CK_MANAGER_ERROR_NO_SESSIONS, _("There are no sessions"));
                 return TRUE;
         }
 
-        /* replace each session with its path */
-        for (guint i = 0; i < sessions->len; i++) {
-                sessions->pdata[i] = (gpointer)ck_session_get_path ( CK_SESSION(sessions->pdata[i]) );
+        if (manager->priv->get_sessions_reply == NULL) {
+                g_variant_builder_init (&sessions, G_VARIANT_TYPE ("ao"));
+
+                g_hash_table_iter_init (&iter, manager->priv->sessions);
+                while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                        g_variant_builder_add (&sessions, "o", ck_session_get_path (CK_SESSION (value)));
+                }
+
+                manager->priv->get_sessions_reply = g_variant_ref_sink (g_variant_new ("(ao)", &sessions));
+        }
+
+        g_dbus_method_invocation_return_value (context, manager->priv->get_sessions_reply);
+        return TRUE;
+}
+
+static gboolean
+dbus_get_sessions_snapshot (ConsoleKitManager     *ckmanager,
+                            GDBusMethodInvocation *context)
+{
+        CkManager      *manager;
+        GVariantBuilder sessions;
+        GHashTableIter  iter;
+        gpointer        value;
+
+        TRACE ();
+
+        manager = CK_MANAGER (ckmanager);
+
+        g_return_val_if_fail (CK_IS_MANAGER (manager), FALSE);
+
+        g_variant_builder_init (&sessions, G_VARIANT_TYPE ("a(oa{sv})"));
+
+        g_hash_table_iter_init (&iter, manager->priv->sessions);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                ck_session_add_to_snapshot (CK_SESSION (value), &sessions);
         }
 
-        g_ptr_array_add (sessions, NULL);
-        console_kit_manager_complete_get_sessions (ckmanager, context, (const gchar**)sessions->pdata);
-        g_ptr_array_unref (sessions);
+        console_kit_manager_complete_get_sessions_snapshot (ckmanager, context, g_variant_builder_end (&sessions));
 
         return TRUE;
 }
@@ -4041,10 +5932,13 @@ add_seat_for_file (CkManager  *manager,
         }
 
         g_hash_table_insert (manager->priv->seats, sid, seat);
+        manager_export_object (manager, ck_seat_get_path (seat), G_DBUS_INTERFACE_SKELETON (seat));
+        ck_query_server_add_seat (manager->priv->query_server, ck_seat_get_path (seat));
+        invalidate_seat_replies (manager);
 
         g_debug ("Added seat: %s", sid);
 
-        ck_manager_dump (manager);
+        ck_manager_dump_flush (manager);
         ck_seat_run_programs (seat, NULL, NULL, "seat_added");
 
         g_debug ("Emitting seat-added: %s", ck_seat_get_path (seat));
@@ -4115,8 +6009,8 @@ on_inhibit_manager_changed_event (CkInhibitManager *manager, gint inhibit_mode,
                 return;
         }
 
-        /* the inhibit change must be for sleep or shutdown */
-        if (event != CK_INHIBIT_EVENT_SUSPEND && event != CK_INHIBIT_EVENT_SHUTDOWN) {
+        /* the inhibit change must be for the event of this action */
+        if (event != system_action_inhibit_event (priv->system_action_data)) {
                 return;
         }
 
@@ -4130,7 +6024,7 @@ on_inhibit_manager_changed_event (CkInhibitManager *manager, gint inhibit_mode,
                 return;
         }
 
-        /* The inhibit lock for this action was removed.
+        /* The last inhibit lock for this action was removed.
          * Stop the timeout and call the system action now.
          */
         g_source_remove (priv->system_action_idle_id);
@@ -4150,6 +6044,18 @@ ck_manager_init (CkManager *manager)
 
         manager->priv->system_idle_hint = TRUE;
 
+        probe_sleep_capabilities (&manager->priv->sleep_caps);
+        manager->priv->sleep_probe_id = g_timeout_add_seconds (SLEEP_PROBE_INTERVAL,
+                                                               (GSourceFunc) sleep_probe_timeout_cb,
+                                                               manager);
+        manager->priv->sleep_swap_fd = ck_open_swap_monitor_fd ();
+        if (manager->priv->sleep_swap_fd >= 0) {
+                manager->priv->sleep_swap_watch_id = g_unix_fd_add (manager->priv->sleep_swap_fd,
+                                                                    G_IO_PRI | G_IO_ERR,
+                                                                    (GUnixFDSourceFunc) on_swaps_changed,
+                                                                    manager);
+        }
+
         manager->priv->seats = g_hash_table_new_full (g_str_hash,
                                                       g_str_equal,
                                                       g_free,
@@ -4162,16 +6068,65 @@ ck_manager_init (CkManager *manager)
                                                         g_str_equal,
                                                         g_free,
                                                         (GDestroyNotify) g_object_unref);
+        manager->priv->leader_connections = g_hash_table_new_full (g_str_hash,
+                                                                   g_str_equal,
+                                                                   g_free,
+                                                                   (GDestroyNotify) leader_connection_free);
+        manager->priv->users = g_hash_table_new_full (g_direct_hash,
+                                                      g_direct_equal,
+                                                      NULL,
+                                                      (GDestroyNotify) manager_user_free);
+        manager->priv->busy_sessions = g_hash_table_new (g_direct_hash,
+                                                         g_direct_equal);
+        manager->priv->opening_users = g_hash_table_new_full (g_direct_hash,
+                                                              g_direct_equal,
+                                                              NULL,
+                                                              (GDestroyNotify) opening_user_free);
+        manager->priv->max_opening = CK_MANAGER_DEFAULT_MAX_OPENING;
+        manager->priv->open_admitted = g_hash_table_new_full (g_direct_hash,
+                                                              g_direct_equal,
+                                                              g_object_unref,
+                                                              NULL);
+        manager->priv->open_queues = g_hash_table_new_full (g_direct_hash,
+                                                            g_direct_equal,
+                                                            NULL,
+                                                            (GDestroyNotify) open_queue_free);
+        g_queue_init (&manager->priv->open_queue_uids);
+        manager->priv->pid_index = ck_pid_index_new ();
+        manager->priv->query_server = ck_query_server_new ();
+        ck_query_server_set_system_idle_hint (manager->priv->query_server,
+                                              manager->priv->system_idle_hint,
+                                              &manager->priv->system_idle_since_hint);
+        manager->priv->statistics = ck_statistics_new ();
+        ck_statistics_set_counters_func (manager->priv->statistics,
+                                         (CkStatisticsCountersFunc) add_statistics_counters,
+                                         manager);
+#ifdef HAVE_POLKIT
+        manager->priv->polkit_decisions = g_hash_table_new_full (g_str_hash,
+                                                                 g_str_equal,
+                                                                 g_free,
+                                                                 g_free);
+#endif
 
         manager->priv->logger = ck_event_logger_new (LOG_FILE);
 
+        g_mutex_init (&manager->priv->dump_lock);
+        manager->priv->dump_interval = CK_MANAGER_DEFAULT_DUMP_INTERVAL;
+        manager->priv->sessions_changed_interval = CK_MANAGER_DEFAULT_SESSIONS_CHANGED_INTERVAL;
+        manager->priv->sessions_added = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+        manager->priv->sessions_removed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+        manager->priv->dump_pool = g_thread_pool_new (dump_thread_func,
+                                                      manager,
+                                                      1,
+                                                      FALSE,
+                                                      NULL);
+
         manager->priv->inhibit_manager = ck_inhibit_manager_get ();
         if (manager->priv->inhibit_manager) {
                 g_signal_connect (manager->priv->inhibit_manager, "changed-event", G_CALLBACK (on_inhibit_manager_changed_event), manager);
         }
 
-        manager->priv->system_action_idle_delay = 2 * 1000;
-        manager->priv->system_action_idle_inhibited_delay = 8 * 1000;
+        manager->priv->inhibit_delay_max = CK_MANAGER_DEFAULT_INHIBIT_DELAY_MAX;
         manager->priv->system_action_idle_id = 0;
 }
 
@@ -4189,18 +6144,52 @@ ck_manager_finalize (GObject *object)
 
         g_return_if_fail (manager->priv != NULL);
 
+        /* write out anything still pending while we have the tables */
+        if (manager->priv->dump_id != 0) {
+                ck_manager_dump_flush (manager);
+        }
+
+        if (manager->priv->dump_pool != NULL) {
+                /* waits for queued writes to finish */
+                g_thread_pool_free (manager->priv->dump_pool, FALSE, TRUE);
+        }
+        g_mutex_clear (&manager->priv->dump_lock);
+
+        if (manager->priv->sessions_changed_id != 0) {
+                g_source_remove (manager->priv->sessions_changed_id);
+        }
+        g_hash_table_destroy (manager->priv->sessions_added);
+        g_hash_table_destroy (manager->priv->sessions_removed);
+
+        if (manager->priv->object_manager != NULL) {
+                g_object_unref (manager->priv->object_manager);
+        }
+
         g_hash_table_destroy (manager->priv->seats);
         g_hash_table_destroy (manager->priv->sessions);
         g_hash_table_destroy (manager->priv->leaders);
-
-        if (manager->priv->name_owner_id > 0 && manager->priv->connection) {
-                g_dbus_connection_signal_unsubscribe (manager->priv->connection, manager->priv->name_owner_id);
-                manager->priv->name_owner_id = 0;
+        g_hash_table_destroy (manager->priv->users);
+        g_hash_table_destroy (manager->priv->busy_sessions);
+        g_hash_table_destroy (manager->priv->opening_users);
+        g_hash_table_destroy (manager->priv->open_admitted);
+        g_hash_table_destroy (manager->priv->open_queues);
+        g_queue_clear (&manager->priv->open_queue_uids);
+        g_object_unref (manager->priv->pid_index);
+        g_object_unref (manager->priv->query_server);
+        g_object_unref (manager->priv->statistics);
+        invalidate_session_replies (manager);
+        invalidate_seat_replies (manager);
+        clear_reply (&manager->priv->list_inhibitors_reply);
+#ifdef HAVE_POLKIT
+        if (manager->priv->pol_ctx != NULL) {
+                g_signal_handlers_disconnect_by_func (manager->priv->pol_ctx,
+                                                      on_polkit_authority_changed,
+                                                      manager);
         }
+        g_hash_table_destroy (manager->priv->polkit_decisions);
+#endif
 
-        if (manager->priv->bus_proxy != NULL) {
-                g_object_unref (manager->priv->bus_proxy);
-        }
+        g_hash_table_destroy (manager->priv->leader_connections);
 
         if (manager->priv->logger != NULL) {
                 g_object_unref (manager->priv->logger);
@@ -4214,6 +6203,20 @@ ck_manager_finalize (GObject *object)
                 g_source_remove (manager->priv->system_action_idle_id);
         }
 
+        if (manager->priv->system_action_child_id != 0) {
+                g_source_remove (manager->priv->system_action_child_id);
+        }
+
+        if (manager->priv->sleep_probe_id != 0) {
+                g_source_remove (manager->priv->sleep_probe_id);
+        }
+        if (manager->priv->sleep_swap_watch_id != 0) {
+                g_source_remove (manager->priv->sleep_swap_watch_id);
+        }
+        if (manager->priv->sleep_swap_fd >= 0) {
+                close (manager->priv->sleep_swap_fd);
+        }
+
         G_OBJECT_CLASS (ck_manager_parent_class)->finalize (object);
 }
 
@@ -4262,6 +6265,7 @@ ck_manager_iface_init (ConsoleKitManagerIface *iface)
         iface->handle_list_seats                   = dbus_list_seats;
         iface->handle_get_seats                    = dbus_get_seats;
         iface->handle_get_sessions                 = dbus_get_sessions;
+        iface->handle_get_sessions_snapshot        = dbus_get_sessions_snapshot;
         iface->handle_get_sessions_for_unix_user   = dbus_get_sessions_for_unix_user;
         iface->handle_get_sessions_for_user        = dbus_get_sessions_for_user;
         iface->handle_get_session                  = dbus_get_session;
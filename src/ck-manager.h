@@ -33,6 +33,15 @@
 #define DBUS_SESSION_INTERFACE DBUS_NAME ".Session"
 #define DBUS_MANAGER_INTERFACE DBUS_NAME ".Manager"
 
+/* Default minimum time between state database writes, in ms */
+#define CK_MANAGER_DEFAULT_DUMP_INTERVAL 500
+/* Default minimum time between SessionsChanged signals, in ms */
+#define CK_MANAGER_DEFAULT_SESSIONS_CHANGED_INTERVAL 250
+/* Default number of sessions opened concurrently */
+#define CK_MANAGER_DEFAULT_MAX_OPENING 16
+/* Default longest wait for the delay inhibitors of a system action, in s */
+#define CK_MANAGER_DEFAULT_INHIBIT_DELAY_MAX 8
+
 G_BEGIN_DECLS
 
 #define CK_TYPE_MANAGER         (ck_manager_get_type ())
@@ -82,6 +91,15 @@ GType               ck_manager_get_type                       (void);
 
 CkManager         * ck_manager_new                            (GDBusConnection *connection);
 
+void                ck_manager_set_dump_interval              (CkManager       *manager,
+                                                               guint            msec);
+void                ck_manager_set_sessions_changed_interval  (CkManager       *manager,
+                                                               guint            msec);
+void                ck_manager_set_max_opening                (CkManager       *manager,
+                                                               guint            max_opening);
+void                ck_manager_set_inhibit_delay_max          (CkManager       *manager,
+                                                               guint            sec);
+
 
 G_END_DECLS
 
@@ -0,0 +1,360 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Maps processes to the session they belong to. Resolving a pid the slow
+ * way means asking the process group backend and then scanning the
+ * process environment, so the answer is remembered per (pid, start time)
+ * pair. Where the platform can notify us of the process exiting the
+ * entry is dropped right then and a hit costs no /proc access at all,
+ * otherwise the start time is checked again on every hit so a reused
+ * pid is never mistaken for the process we resolved.
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+#include <poll.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <glib-object.h>
+
+#include "ck-sysdeps.h"
+
+#include "ck-pid-index.h"
+
+#define CK_PID_INDEX_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CK_TYPE_PID_INDEX, CkPidIndexPrivate))
+
+/* Every entry may hold an open exit descriptor, keep well below the
+ * default open file limit.
+ */
+#define MAX_ENTRIES     256
+
+typedef struct
+{
+        CkPidIndex *pid_index;
+        pid_t       pid;
+        guint64     start_time;
+        char       *ssid;
+        int         exit_fd;
+        guint       watch_id;
+} PidEntry;
+
+struct CkPidIndexPrivate
+{
+        /* pid -> PidEntry */
+        GHashTable *entries;
+
+        guint       hits;
+        guint       misses;
+        guint       exits;
+};
+
+static void     ck_pid_index_finalize    (GObject            *object);
+
+G_DEFINE_TYPE (CkPidIndex, ck_pid_index, G_TYPE_OBJECT)
+
+
+static void
+pid_entry_free (PidEntry *entry)
+{
+        if (entry->watch_id != 0) {
+                g_source_remove (entry->watch_id);
+        }
+        if (entry->exit_fd >= 0) {
+                close (entry->exit_fd);
+        }
+        g_free (entry->ssid);
+        g_free (entry);
+}
+
+static void
+ck_pid_index_class_init (CkPidIndexClass *klass)
+{
+        GObjectClass   *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = ck_pid_index_finalize;
+
+        g_type_class_add_private (klass, sizeof (CkPidIndexPrivate));
+}
+
+static void
+ck_pid_index_init (CkPidIndex *pid_index)
+{
+        pid_index->priv = CK_PID_INDEX_GET_PRIVATE (pid_index);
+
+        pid_index->priv->entries = g_hash_table_new_full (g_direct_hash,
+                                                          g_direct_equal,
+                                                          NULL,
+                                                          (GDestroyNotify) pid_entry_free);
+}
+
+static void
+ck_pid_index_finalize (GObject *object)
+{
+        CkPidIndex *pid_index;
+
+        g_return_if_fail (CK_IS_PID_INDEX (object));
+
+        pid_index = CK_PID_INDEX (object);
+
+        g_hash_table_destroy (pid_index->priv->entries);
+
+        G_OBJECT_CLASS (ck_pid_index_parent_class)->finalize (object);
+}
+
+CkPidIndex *
+ck_pid_index_new (void)
+{
+        return CK_PID_INDEX (g_object_new (CK_TYPE_PID_INDEX, NULL));
+}
+
+/**
+ * ck_pid_index_get_start_time:
+ * @pid: the process to look at
+ * @start_time: (out): when the process started, in platform units
+ *
+ * Return value: FALSE if the process can't be inspected
+ **/
+gboolean
+ck_pid_index_get_start_time (pid_t    pid,
+                             guint64 *start_time)
+{
+        CkProcessStat *stat;
+        GError        *error;
+
+        error = NULL;
+        if (! ck_process_stat_new_for_unix_pid (pid, &stat, &error)) {
+                if (error != NULL) {
+                        g_debug ("stat on pid %d failed: %s", pid, error->message);
+                        g_error_free (error);
+                }
+                return FALSE;
+        }
+
+        *start_time = ck_process_stat_get_start_time (stat);
+        ck_process_stat_free (stat);
+
+        return TRUE;
+}
+
+static gboolean
+pid_entry_is_current (PidEntry *entry)
+{
+        guint64 start_time;
+
+        if (entry->exit_fd >= 0) {
+                struct pollfd pfd;
+
+                /* the exit watch may not have been dispatched yet */
+                pfd.fd = entry->exit_fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+
+                return poll (&pfd, 1, 0) == 0;
+        }
+
+        /* a backend that can't tell start times apart can't tell
+         * a reused pid apart either */
+        if (entry->start_time == 0) {
+                return FALSE;
+        }
+
+        if (! ck_pid_index_get_start_time (entry->pid, &start_time)) {
+                return FALSE;
+        }
+
+        return start_time == entry->start_time;
+}
+
+static gboolean
+on_process_exited (gint          fd,
+                   GIOCondition  condition,
+                   PidEntry     *entry)
+{
+        CkPidIndex *pid_index = entry->pid_index;
+
+        g_debug ("pid index: process %d exited", entry->pid);
+
+        /* the source goes away when we return */
+        entry->watch_id = 0;
+
+        pid_index->priv->exits++;
+        g_hash_table_remove (pid_index->priv->entries, GINT_TO_POINTER (entry->pid));
+
+        return FALSE;
+}
+
+/**
+ * ck_pid_index_lookup:
+ * @pid_index: a #CkPidIndex
+ * @pid: the process to look up
+ *
+ * Return value: the id of the session @pid was resolved to, or NULL
+ *               when it has to be resolved again. [transfer: none]
+ **/
+const char *
+ck_pid_index_lookup (CkPidIndex *pid_index,
+                     pid_t       pid)
+{
+        PidEntry *entry;
+
+        g_return_val_if_fail (CK_IS_PID_INDEX (pid_index), NULL);
+
+        entry = g_hash_table_lookup (pid_index->priv->entries, GINT_TO_POINTER (pid));
+        if (entry != NULL && ! pid_entry_is_current (entry)) {
+                g_debug ("pid index: dropping stale entry for %d", pid);
+                g_hash_table_remove (pid_index->priv->entries, GINT_TO_POINTER (pid));
+                entry = NULL;
+        }
+
+        if (entry == NULL) {
+                pid_index->priv->misses++;
+                return NULL;
+        }
+
+        pid_index->priv->hits++;
+
+        return entry->ssid;
+}
+
+/**
+ * ck_pid_index_insert:
+ * @pid_index: a #CkPidIndex
+ * @pid: the process that was resolved
+ * @start_time: the start time of @pid, read before it was resolved
+ * @ssid: the session @pid belongs to
+ *
+ * Remembers that @pid belongs to @ssid. Nothing is recorded if @pid is
+ * no longer the process that started at @start_time, or if the start
+ * time is unknown (0).
+ **/
+void
+ck_pid_index_insert (CkPidIndex *pid_index,
+                     pid_t       pid,
+                     guint64     start_time,
+                     const char *ssid)
+{
+        PidEntry *entry;
+        guint64   current_start_time;
+        int       exit_fd;
+
+        g_return_if_fail (CK_IS_PID_INDEX (pid_index));
+        g_return_if_fail (ssid != NULL);
+
+        /* 0 means the backend doesn't know, a reused pid would match */
+        if (start_time == 0) {
+                return;
+        }
+
+        if (g_hash_table_size (pid_index->priv->entries) >= MAX_ENTRIES) {
+                g_debug ("pid index: too many entries, flushing");
+                g_hash_table_remove_all (pid_index->priv->entries);
+        }
+
+        /* Open the exit descriptor before checking the start time again,
+         * that way it can't refer to a process that reused the pid. */
+        exit_fd = ck_unix_pid_open_exit_fd (pid);
+
+        if (! ck_pid_index_get_start_time (pid, &current_start_time)
+            || current_start_time != start_time) {
+                g_debug ("pid index: process %d went away while resolving it", pid);
+                if (exit_fd >= 0) {
+                        close (exit_fd);
+                }
+                return;
+        }
+
+        entry = g_new0 (PidEntry, 1);
+        entry->pid_index = pid_index;
+        entry->pid = pid;
+        entry->start_time = start_time;
+        entry->ssid = g_strdup (ssid);
+        entry->exit_fd = exit_fd;
+
+        if (exit_fd >= 0) {
+                entry->watch_id = g_unix_fd_add (exit_fd,
+                                                 G_IO_IN,
+                                                 (GUnixFDSourceFunc) on_process_exited,
+                                                 entry);
+        }
+
+        g_hash_table_replace (pid_index->priv->entries, GINT_TO_POINTER (pid), entry);
+
+        g_debug ("pid index: %u entries, %u hits, %u misses, %u exits",
+                 g_hash_table_size (pid_index->priv->entries),
+                 pid_index->priv->hits,
+                 pid_index->priv->misses,
+                 pid_index->priv->exits);
+}
+
+static gboolean
+entry_has_session (gpointer    key,
+                   PidEntry   *entry,
+                   const char *ssid)
+{
+        return g_strcmp0 (entry->ssid, ssid) == 0;
+}
+
+/**
+ * ck_pid_index_remove_session:
+ * @pid_index: a #CkPidIndex
+ * @ssid: a session that is going away
+ *
+ * Forgets every process that was resolved to @ssid.
+ **/
+void
+ck_pid_index_remove_session (CkPidIndex *pid_index,
+                             const char *ssid)
+{
+        g_return_if_fail (CK_IS_PID_INDEX (pid_index));
+
+        g_hash_table_foreach_remove (pid_index->priv->entries,
+                                     (GHRFunc) entry_has_session,
+                                     (gpointer) ssid);
+}
+
+void
+ck_pid_index_get_stats (CkPidIndex *pid_index,
+                        guint      *entries,
+                        guint      *hits,
+                        guint      *misses)
+{
+        g_return_if_fail (CK_IS_PID_INDEX (pid_index));
+
+        if (entries != NULL) {
+                *entries = g_hash_table_size (pid_index->priv->entries);
+        }
+        if (hits != NULL) {
+                *hits = pid_index->priv->hits;
+        }
+        if (misses != NULL) {
+                *misses = pid_index->priv->misses;
+        }
+}
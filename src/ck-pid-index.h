@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CK_PID_INDEX_H_
+#define __CK_PID_INDEX_H_
+
+#include <sys/types.h>
+#include <glib-object.h>
+
+#define CK_TYPE_PID_INDEX           (ck_pid_index_get_type ())
+#define CK_PID_INDEX(o)             (G_TYPE_CHECK_INSTANCE_CAST ((o), CK_TYPE_PID_INDEX, CkPidIndex))
+#define CK_PID_INDEX_CLASS(k)       (G_TYPE_CHECK_CLASS_CAST((k), CK_TYPE_PID_INDEX, CkPidIndexClass))
+#define CK_IS_PID_INDEX(o)          (G_TYPE_CHECK_INSTANCE_TYPE ((o), CK_TYPE_PID_INDEX))
+#define CK_IS_PID_INDEX_CLASS(k)    (G_TYPE_CHECK_CLASS_TYPE ((k), CK_TYPE_PID_INDEX))
+#define CK_PID_INDEX_GET_CLASS(o)   (G_TYPE_INSTANCE_GET_CLASS ((o), CK_TYPE_PID_INDEX, CkPidIndexClass))
+
+typedef struct CkPidIndexPrivate CkPidIndexPrivate;
+
+typedef struct
+{
+        GObject            parent;
+        CkPidIndexPrivate *priv;
+} CkPidIndex;
+
+typedef struct
+{
+        GObjectClass parent_class;
+} CkPidIndexClass;
+
+
+GType             ck_pid_index_get_type             (void);
+
+CkPidIndex       *ck_pid_index_new                  (void);
+
+gboolean          ck_pid_index_get_start_time       (pid_t              pid,
+                                                     guint64           *start_time);
+
+const char       *ck_pid_index_lookup               (CkPidIndex        *pid_index,
+                                                     pid_t              pid);
+
+void              ck_pid_index_insert               (CkPidIndex        *pid_index,
+                                                     pid_t              pid,
+                                                     guint64            start_time,
+                                                     const char        *ssid);
+
+void              ck_pid_index_remove_session       (CkPidIndex        *pid_index,
+                                                     const char        *ssid);
+
+void              ck_pid_index_get_stats            (CkPidIndex        *pid_index,
+                                                     guint             *entries,
+                                                     guint             *hits,
+                                                     guint             *misses);
+
+#endif /* __CK_PID_INDEX_H_ */
@@ -63,6 +63,9 @@
 struct CkProcessGroupPrivate
 {
         gint          unused;
+        /* the cgmanager proxy isn't thread safe and the manager creates
+         * groups from worker threads, so every call goes through this */
+        GMutex        lock;
 #ifdef HAVE_CGMANAGER
         NihDBusProxy *cgmanager_proxy;
 #endif
@@ -170,6 +173,7 @@ static void
 ck_process_group_init (CkProcessGroup *pgroup)
 {
         pgroup->priv = CK_PROCESS_GROUP_GET_PRIVATE (pgroup);
+        g_mutex_init (&pgroup->priv->lock);
 }
 
 static void
@@ -188,6 +192,8 @@ ck_process_group_finalize (GObject *object)
         priv->cgmanager_proxy = NULL;
 #endif
 
+        g_mutex_clear (&CK_PROCESS_GROUP_GET_PRIVATE (object)->lock);
+
         G_OBJECT_CLASS (ck_process_group_parent_class)->finalize (object);
 }
 
@@ -212,7 +218,8 @@ ck_process_group_create (CkProcessGroup *pgroup,
         CkProcessGroupPrivate *priv = CK_PROCESS_GROUP_GET_PRIVATE (pgroup);
         gint                   ret;
         gint32                 existed;
-        struct passwd         *pwent;
+        guint                  gid;
+        gboolean               res = FALSE;
 
         TRACE ();
 
@@ -221,6 +228,13 @@ ck_process_group_create (CkProcessGroup *pgroup,
                 return FALSE;
         }
 
+        /* we may be called from a worker thread */
+        if (!ck_get_primary_gid (unix_user, &gid)) {
+                return FALSE;
+        }
+
+        g_mutex_lock (&priv->lock);
+
         /* Create the cgroup, move the pid into it, and then tell cgmanager
          * to clean up the cgroup after all the processes are gone which
          * will happen when the user logs out.
@@ -232,24 +246,17 @@ ck_process_group_create (CkProcessGroup *pgroup,
                  * cgmanager.
                  */
                 throw_nih_warning (_("Failed to create cgroup, the error was: %s"));
-                return FALSE;
+                goto out;
         }
 
-        errno = 0;
-        pwent = getpwuid (unix_user);
-        if (pwent == NULL) {
-                g_warning ("Unable to lookup UID: %s", g_strerror (errno));
-                return FALSE;
-        }
-
-        ret = cgmanager_chown_sync(NULL, priv->cgmanager_proxy, "all", ssid, pwent->pw_uid, pwent->pw_gid);
+        ret = cgmanager_chown_sync(NULL, priv->cgmanager_proxy, "all", ssid, unix_user, gid);
         if (ret != 0) {
                 /* TRANSLATORS: Please ensure you keep the %s in the
                  * string somewhere. It's the detailed error message from
                  * cgmanager.
                  */
                 throw_nih_warning (_("Failed to change owner of the new cgroup to owner of the session leader, the error was: %s"));
-                return FALSE;
+                goto out;
         }
 
         ret = cgmanager_move_pid_abs_sync (NULL, priv->cgmanager_proxy, "all", ssid, process);
@@ -271,7 +278,11 @@ ck_process_group_create (CkProcessGroup *pgroup,
                 }
         }
 
-        return TRUE;
+        res = TRUE;
+
+out:
+        g_mutex_unlock (&priv->lock);
+        return res;
 #endif
         return FALSE;
 }
@@ -300,6 +311,7 @@ ck_process_group_get_ssid (CkProcessGroup *pgroup,
                 return NULL;
         }
 
+        g_mutex_lock (&priv->lock);
         ret = cgmanager_get_pid_cgroup_abs_sync (NULL, priv->cgmanager_proxy, "cpuacct", process, &nih_ssid);
         if (ret != 0) {
                 /* TRANSLATORS: Please ensure you keep the %s in the
@@ -307,6 +319,7 @@ ck_process_group_get_ssid (CkProcessGroup *pgroup,
                  * cgmanager.
                  */
                 throw_nih_warning (_("Failed to get the session id from cgmanager, the error was: %s"));
+                g_mutex_unlock (&priv->lock);
                 return NULL;
         }
 
@@ -317,6 +330,7 @@ ck_process_group_get_ssid (CkProcessGroup *pgroup,
 
                 nih_free (nih_ssid);
         }
+        g_mutex_unlock (&priv->lock);
 
         /* ignore the unknown/root cgroup */
         if (g_strcmp0 (g_ssid, "/") == 0) {
@@ -0,0 +1,915 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Answers the read-only queries straight from the GDBus worker thread.
+ * Every change the manager makes is published as a new immutable State;
+ * the message filter takes a reference to whatever State is current and
+ * replies from it, so none of these calls wait behind a slow handler on
+ * the main loop. Anything the State can't answer exactly the way the
+ * skeleton would, errors included, is passed on to the main loop.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <pwd.h>
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "ck-manager.h"
+#include "ck-query-server.h"
+
+#define CK_QUERY_SERVER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CK_TYPE_QUERY_SERVER, CkQueryServerPrivate))
+
+/* What is known about a session once it is open. None of it changes
+ * for the lifetime of the session, so entries are shared between
+ * States.
+ */
+typedef struct
+{
+        gint     ref_count;
+        char    *id;
+        char    *path;
+        char    *seat_id;
+        char    *seat_path;
+        char    *user_name;
+        char    *session_service;
+        char    *session_type;
+        char    *session_class;
+        char    *runtime_dir;
+        char    *x11_display;
+        char    *x11_display_device;
+        char    *display_device;
+        char    *remote_host_name;
+        char    *login_session_id;
+        char    *creation_time;
+        guint    uid;
+        guint    vtnr;
+        gboolean is_local;
+} SessionEntry;
+
+typedef struct
+{
+        gint        ref_count;
+        /* object path -> SessionEntry */
+        GHashTable *sessions;
+        /* object paths */
+        GPtrArray  *seats;
+        gboolean    system_idle_hint;
+        char       *system_idle_since_hint;
+
+        /* Replies built from this State the first time they are asked
+         * for. Set with a compare-and-exchange so the State stays safe
+         * to share even if the filter ever runs on more than one thread.
+         */
+        GVariant   *get_sessions_reply;
+        GVariant   *list_sessions_reply;
+        GVariant   *get_seats_reply;
+} State;
+
+/* What the filter uses. It can still be running on the worker thread
+ * after the filter was removed, so it holds its own reference that
+ * GDBus drops once the filter is really gone.
+ */
+typedef struct
+{
+        gint             ref_count;
+
+        /* Only written from the main thread, lock held for the swap */
+        GMutex           lock;
+        State           *state;
+
+        gint             served;        /* atomic */
+        gint             passed;        /* atomic */
+} FilterData;
+
+struct CkQueryServerPrivate
+{
+        GDBusConnection *connection;
+        guint            filter_id;
+        FilterData      *data;
+
+        guint            published;
+};
+
+typedef GVariant * (* ManagerQueryFunc) (State *state, GVariant *body);
+typedef GVariant * (* SessionQueryFunc) (SessionEntry *entry);
+
+static void     ck_query_server_finalize    (GObject            *object);
+
+G_DEFINE_TYPE (CkQueryServer, ck_query_server, G_TYPE_OBJECT)
+
+
+static SessionEntry *
+session_entry_ref (SessionEntry *entry)
+{
+        g_atomic_int_inc (&entry->ref_count);
+        return entry;
+}
+
+static void
+session_entry_unref (SessionEntry *entry)
+{
+        if (!g_atomic_int_dec_and_test (&entry->ref_count)) {
+                return;
+        }
+
+        g_free (entry->id);
+        g_free (entry->path);
+        g_free (entry->seat_id);
+        g_free (entry->seat_path);
+        g_free (entry->user_name);
+        g_free (entry->session_service);
+        g_free (entry->session_type);
+        g_free (entry->session_class);
+        g_free (entry->runtime_dir);
+        g_free (entry->x11_display);
+        g_free (entry->x11_display_device);
+        g_free (entry->display_device);
+        g_free (entry->remote_host_name);
+        g_free (entry->login_session_id);
+        g_free (entry->creation_time);
+        g_free (entry);
+}
+
+static SessionEntry *
+session_entry_new (CkSession *session)
+{
+        ConsoleKitSession *cksession = CONSOLE_KIT_SESSION (session);
+        SessionEntry      *entry;
+        GVariant          *seat;
+        struct passwd     *pwent;
+
+        entry = g_new0 (SessionEntry, 1);
+        entry->ref_count = 1;
+
+        ck_session_get_id (session, &entry->id, NULL);
+        entry->path = g_strdup (ck_session_get_path (session));
+        ck_session_get_seat_id (session, &entry->seat_id, NULL);
+        seat = console_kit_session_get_seat (cksession);
+        if (seat != NULL && entry->seat_id != NULL) {
+                g_variant_get (seat, "(so)", NULL, &entry->seat_path);
+        }
+
+        entry->uid = console_kit_session_get_unix_user (cksession);
+        pwent = getpwuid (entry->uid);
+        entry->user_name = g_strdup (pwent != NULL ? pwent->pw_name : "");
+
+        entry->session_service = g_strdup (console_kit_session_get_session_service (cksession));
+        entry->session_type = g_strdup (console_kit_session_get_session_type (cksession));
+        entry->session_class = g_strdup (console_kit_session_get_session_class (cksession));
+        entry->runtime_dir = g_strdup (ck_session_get_runtime_dir (session));
+        entry->x11_display = g_strdup (console_kit_session_get_x11_display (cksession));
+        entry->x11_display_device = g_strdup (console_kit_session_get_x11_display_device (cksession));
+        entry->display_device = g_strdup (console_kit_session_get_display_device (cksession));
+        entry->remote_host_name = g_strdup (console_kit_session_get_remote_host_name (cksession));
+        g_object_get (session, "login-session-id", &entry->login_session_id, NULL);
+        ck_session_get_creation_time (session, &entry->creation_time, NULL);
+        entry->vtnr = console_kit_session_get_vtnr (cksession);
+        entry->is_local = console_kit_session_get_is_local (cksession);
+
+        return entry;
+}
+
+static State *
+state_ref (State *state)
+{
+        g_atomic_int_inc (&state->ref_count);
+        return state;
+}
+
+static void
+state_unref (State *state)
+{
+        if (!g_atomic_int_dec_and_test (&state->ref_count)) {
+                return;
+        }
+
+        g_hash_table_destroy (state->sessions);
+        g_ptr_array_unref (state->seats);
+        g_free (state->system_idle_since_hint);
+        if (state->get_sessions_reply != NULL) {
+                g_variant_unref (state->get_sessions_reply);
+        }
+        if (state->list_sessions_reply != NULL) {
+                g_variant_unref (state->list_sessions_reply);
+        }
+        if (state->get_seats_reply != NULL) {
+                g_variant_unref (state->get_seats_reply);
+        }
+        g_free (state);
+}
+
+static State *
+state_copy (State *orig)
+{
+        State         *state;
+        GHashTableIter iter;
+        gpointer       key;
+        gpointer       value;
+        guint          i;
+
+        state = g_new0 (State, 1);
+        state->ref_count = 1;
+        state->sessions = g_hash_table_new_full (g_str_hash,
+                                                 g_str_equal,
+                                                 NULL,
+                                                 (GDestroyNotify) session_entry_unref);
+        state->seats = g_ptr_array_new_with_free_func (g_free);
+
+        if (orig == NULL) {
+                state->system_idle_since_hint = g_strdup ("");
+                return state;
+        }
+
+        g_hash_table_iter_init (&iter, orig->sessions);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                g_hash_table_insert (state->sessions, key, session_entry_ref (value));
+        }
+
+        for (i = 0; i < orig->seats->len; i++) {
+                g_ptr_array_add (state->seats, g_strdup (g_ptr_array_index (orig->seats, i)));
+        }
+
+        state->system_idle_hint = orig->system_idle_hint;
+        state->system_idle_since_hint = g_strdup (orig->system_idle_since_hint);
+
+        return state;
+}
+
+static FilterData *
+filter_data_new (void)
+{
+        FilterData *data;
+
+        data = g_new0 (FilterData, 1);
+        data->ref_count = 1;
+        g_mutex_init (&data->lock);
+        data->state = state_copy (NULL);
+
+        return data;
+}
+
+static FilterData *
+filter_data_ref (FilterData *data)
+{
+        g_atomic_int_inc (&data->ref_count);
+        return data;
+}
+
+static void
+filter_data_unref (FilterData *data)
+{
+        if (!g_atomic_int_dec_and_test (&data->ref_count)) {
+                return;
+        }
+
+        state_unref (data->state);
+        g_mutex_clear (&data->lock);
+        g_free (data);
+}
+
+/* Makes @state the one queries are answered from; takes the reference */
+static void
+publish_state (CkQueryServer *server,
+               State         *state)
+{
+        FilterData *data = server->priv->data;
+        State      *old;
+
+        g_mutex_lock (&data->lock);
+        old = data->state;
+        data->state = state;
+        g_mutex_unlock (&data->lock);
+
+        state_unref (old);
+
+        server->priv->published++;
+}
+
+/* Returns a reference to the reply cached in @slot, storing @reply
+ * there first if nothing is yet. Takes @reply, which may be NULL.
+ */
+static GVariant *
+cache_reply (GVariant **slot,
+             GVariant  *reply)
+{
+        GVariant *cached;
+
+        if (reply != NULL) {
+                g_variant_ref_sink (reply);
+                if (!g_atomic_pointer_compare_and_exchange (slot, NULL, reply)) {
+                        g_variant_unref (reply);
+                }
+        }
+
+        cached = g_atomic_pointer_get (slot);
+        return cached != NULL ? g_variant_ref (cached) : NULL;
+}
+
+static GVariant *
+build_get_sessions (State *state)
+{
+        GVariantBuilder builder;
+        GHashTableIter  iter;
+        gpointer        key;
+
+        /* the skeleton reports that as an error */
+        if (g_hash_table_size (state->sessions) == 0) {
+                return NULL;
+        }
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
+        g_hash_table_iter_init (&iter, state->sessions);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                g_variant_builder_add (&builder, "o", key);
+        }
+
+        return g_variant_new ("(ao)", &builder);
+}
+
+static GVariant *
+query_get_sessions (State    *state,
+                    GVariant *body)
+{
+        GVariant *reply;
+
+        reply = g_atomic_pointer_get (&state->get_sessions_reply);
+        if (reply != NULL) {
+                return g_variant_ref (reply);
+        }
+
+        return cache_reply (&state->get_sessions_reply, build_get_sessions (state));
+}
+
+static GVariant *
+build_list_sessions (State *state)
+{
+        GVariantBuilder builder;
+        GHashTableIter  iter;
+        gpointer        value;
+
+        if (g_hash_table_size (state->sessions) == 0) {
+                return NULL;
+        }
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(susso)"));
+        g_hash_table_iter_init (&iter, state->sessions);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                SessionEntry *entry = value;
+
+                if (entry->seat_id == NULL) {
+                        g_variant_builder_clear (&builder);
+                        return NULL;
+                }
+
+                g_variant_builder_add (&builder, "(susso)",
+                                       entry->id,
+                                       entry->uid,
+                                       entry->user_name,
+                                       entry->seat_id,
+                                       entry->path);
+        }
+
+        return g_variant_new ("(a(susso))", &builder);
+}
+
+static GVariant *
+query_list_sessions (State    *state,
+                     GVariant *body)
+{
+        GVariant *reply;
+
+        reply = g_atomic_pointer_get (&state->list_sessions_reply);
+        if (reply != NULL) {
+                return g_variant_ref (reply);
+        }
+
+        return cache_reply (&state->list_sessions_reply, build_list_sessions (state));
+}
+
+static GVariant *
+build_get_seats (State *state)
+{
+        GVariantBuilder builder;
+        guint           i;
+
+        if (state->seats->len == 0) {
+                return NULL;
+        }
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
+        for (i = 0; i < state->seats->len; i++) {
+                g_variant_builder_add (&builder, "o", g_ptr_array_index (state->seats, i));
+        }
+
+        return g_variant_new ("(ao)", &builder);
+}
+
+static GVariant *
+query_get_seats (State    *state,
+                 GVariant *body)
+{
+        GVariant *reply;
+
+        reply = g_atomic_pointer_get (&state->get_seats_reply);
+        if (reply != NULL) {
+                return g_variant_ref (reply);
+        }
+
+        return cache_reply (&state->get_seats_reply, build_get_seats (state));
+}
+
+static GVariant *
+query_get_sessions_for_unix_user (State    *state,
+                                  GVariant *body)
+{
+        GVariantBuilder builder;
+        GHashTableIter  iter;
+        gpointer        value;
+        guint           uid;
+        guint           n = 0;
+
+        g_variant_get (body, "(u)", &uid);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
+        g_hash_table_iter_init (&iter, state->sessions);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                SessionEntry *entry = value;
+
+                if (entry->uid == uid) {
+                        g_variant_builder_add (&builder, "o", entry->path);
+                        n++;
+                }
+        }
+
+        if (n == 0) {
+                g_variant_builder_clear (&builder);
+                return NULL;
+        }
+
+        return g_variant_take_ref (g_variant_new ("(ao)", &builder));
+}
+
+static GVariant *
+query_get_system_idle_hint (State    *state,
+                            GVariant *body)
+{
+        return g_variant_take_ref (g_variant_new ("(b)", state->system_idle_hint));
+}
+
+static GVariant *
+query_get_system_idle_since_hint (State    *state,
+                                  GVariant *body)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", state->system_idle_since_hint));
+}
+
+static const struct {
+        const char      *member;
+        const char      *signature;
+        ManagerQueryFunc func;
+} manager_queries[] = {
+        { "GetSessions",              "",  query_get_sessions },
+        { "ListSessions",             "",  query_list_sessions },
+        { "GetSeats",                 "",  query_get_seats },
+        { "GetSessionsForUnixUser",   "u", query_get_sessions_for_unix_user },
+        { "GetSystemIdleHint",        "",  query_get_system_idle_hint },
+        { "GetSystemIdleSinceHint",   "",  query_get_system_idle_since_hint },
+};
+
+static GVariant *
+session_get_id (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(o)", entry->path));
+}
+
+static GVariant *
+session_get_seat_id (SessionEntry *entry)
+{
+        if (entry->seat_path == NULL) {
+                return NULL;
+        }
+
+        return g_variant_take_ref (g_variant_new ("(o)", entry->seat_path));
+}
+
+static GVariant *
+session_get_session_service (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", entry->session_service != NULL ? entry->session_service : "unspecified"));
+}
+
+static GVariant *
+session_get_session_type (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", entry->session_type != NULL ? entry->session_type : "unspecified"));
+}
+
+static GVariant *
+session_get_session_class (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", entry->session_class != NULL ? entry->session_class : "user"));
+}
+
+static GVariant *
+session_get_unix_user (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(u)", entry->uid));
+}
+
+static GVariant *
+session_get_runtime_dir (SessionEntry *entry)
+{
+        if (entry->runtime_dir == NULL) {
+                return NULL;
+        }
+
+        return g_variant_take_ref (g_variant_new ("(s)", entry->runtime_dir));
+}
+
+static GVariant *
+session_get_x11_display (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", entry->x11_display != NULL ? entry->x11_display : ""));
+}
+
+static GVariant *
+session_get_x11_display_device (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", entry->x11_display_device != NULL ? entry->x11_display_device : ""));
+}
+
+static GVariant *
+session_get_display_device (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", entry->display_device != NULL ? entry->display_device : ""));
+}
+
+static GVariant *
+session_get_remote_host_name (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", entry->remote_host_name != NULL ? entry->remote_host_name : ""));
+}
+
+static GVariant *
+session_get_login_session_id (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", entry->login_session_id != NULL ? entry->login_session_id : ""));
+}
+
+static GVariant *
+session_get_vtnr (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(u)", entry->vtnr));
+}
+
+static GVariant *
+session_is_local (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(b)", entry->is_local));
+}
+
+static GVariant *
+session_get_creation_time (SessionEntry *entry)
+{
+        return g_variant_take_ref (g_variant_new ("(s)", entry->creation_time));
+}
+
+/* Only what is fixed once the session is open. Activity, idle and
+ * lock state are answered by the session itself.
+ */
+static const struct {
+        const char      *member;
+        SessionQueryFunc func;
+} session_queries[] = {
+        { "GetId",                session_get_id },
+        { "GetSeatId",            session_get_seat_id },
+        { "GetSessionService",    session_get_session_service },
+        { "GetSessionType",       session_get_session_type },
+        { "GetSessionClass",      session_get_session_class },
+        { "GetUser",              session_get_unix_user },
+        { "GetUnixUser",          session_get_unix_user },
+        { "GetXDGRuntimeDir",     session_get_runtime_dir },
+        { "GetX11Display",        session_get_x11_display },
+        { "GetX11DisplayDevice",  session_get_x11_display_device },
+        { "GetDisplayDevice",     session_get_display_device },
+        { "GetRemoteHostName",    session_get_remote_host_name },
+        { "GetLoginSessionId",    session_get_login_session_id },
+        { "GetVTNr",              session_get_vtnr },
+        { "IsLocal",              session_is_local },
+        { "GetCreationTime",      session_get_creation_time },
+};
+
+/* Returns a reference to the reply body for @message, or NULL to
+ * leave it to the main loop */
+static GVariant *
+answer_query (State        *state,
+              GDBusMessage *message)
+{
+        const char *interface;
+        const char *member;
+        const char *path;
+        const char *signature;
+        guint       i;
+
+        interface = g_dbus_message_get_interface (message);
+        member = g_dbus_message_get_member (message);
+        path = g_dbus_message_get_path (message);
+        signature = g_dbus_message_get_signature (message);
+        if (signature == NULL) {
+                signature = "";
+        }
+
+        if (g_strcmp0 (interface, DBUS_MANAGER_INTERFACE) == 0) {
+                if (g_strcmp0 (path, CK_MANAGER_DBUS_PATH) != 0) {
+                        return NULL;
+                }
+
+                for (i = 0; i < G_N_ELEMENTS (manager_queries); i++) {
+                        if (g_strcmp0 (member, manager_queries[i].member) == 0) {
+                                if (strcmp (signature, manager_queries[i].signature) != 0) {
+                                        return NULL;
+                                }
+                                return manager_queries[i].func (state, g_dbus_message_get_body (message));
+                        }
+                }
+        } else if (g_strcmp0 (interface, DBUS_SESSION_INTERFACE) == 0) {
+                SessionEntry *entry;
+
+                if (signature[0] != '\0' || path == NULL) {
+                        return NULL;
+                }
+
+                entry = g_hash_table_lookup (state->sessions, path);
+                if (entry == NULL) {
+                        return NULL;
+                }
+
+                for (i = 0; i < G_N_ELEMENTS (session_queries); i++) {
+                        if (g_strcmp0 (member, session_queries[i].member) == 0) {
+                                return session_queries[i].func (entry);
+                        }
+                }
+        }
+
+        return NULL;
+}
+
+/* Runs on the GDBus worker thread for every message, keep it cheap */
+static GDBusMessage *
+query_filter (GDBusConnection *connection,
+              GDBusMessage    *message,
+              gboolean         incoming,
+              gpointer         user_data)
+{
+        FilterData   *data = user_data;
+        GDBusMessage *reply;
+        GVariant     *body;
+        State        *state;
+
+        if (!incoming || g_dbus_message_get_message_type (message) != G_DBUS_MESSAGE_TYPE_METHOD_CALL) {
+                return message;
+        }
+
+        g_mutex_lock (&data->lock);
+        state = data->state != NULL ? state_ref (data->state) : NULL;
+        g_mutex_unlock (&data->lock);
+
+        if (state == NULL) {
+                return message;
+        }
+
+        body = answer_query (state, message);
+        state_unref (state);
+
+        if (body == NULL) {
+                g_atomic_int_inc (&data->passed);
+                return message;
+        }
+
+        g_atomic_int_inc (&data->served);
+
+        if (!(g_dbus_message_get_flags (message) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED)) {
+                reply = g_dbus_message_new_method_reply (message);
+                g_dbus_message_set_body (reply, body);
+                g_dbus_connection_send_message (connection, reply, G_DBUS_SEND_MESSAGE_FLAGS_NONE, NULL, NULL);
+                g_object_unref (reply);
+        }
+
+        g_variant_unref (body);
+
+        g_object_unref (message);
+        return NULL;
+}
+
+static void
+ck_query_server_class_init (CkQueryServerClass *klass)
+{
+        GObjectClass   *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = ck_query_server_finalize;
+
+        g_type_class_add_private (klass, sizeof (CkQueryServerPrivate));
+}
+
+static void
+ck_query_server_init (CkQueryServer *server)
+{
+        server->priv = CK_QUERY_SERVER_GET_PRIVATE (server);
+
+        server->priv->data = filter_data_new ();
+}
+
+static void
+ck_query_server_finalize (GObject *object)
+{
+        CkQueryServer *server;
+
+        g_return_if_fail (CK_IS_QUERY_SERVER (object));
+
+        server = CK_QUERY_SERVER (object);
+
+        if (server->priv->filter_id != 0) {
+                g_dbus_connection_remove_filter (server->priv->connection, server->priv->filter_id);
+                g_object_unref (server->priv->connection);
+        }
+
+        filter_data_unref (server->priv->data);
+
+        G_OBJECT_CLASS (ck_query_server_parent_class)->finalize (object);
+}
+
+CkQueryServer *
+ck_query_server_new (void)
+{
+        return CK_QUERY_SERVER (g_object_new (CK_TYPE_QUERY_SERVER, NULL));
+}
+
+/**
+ * ck_query_server_attach:
+ * @server: a #CkQueryServer
+ * @connection: the connection the manager is exported on
+ *
+ * Starts answering queries that arrive on @connection.
+ **/
+void
+ck_query_server_attach (CkQueryServer   *server,
+                        GDBusConnection *connection)
+{
+        g_return_if_fail (CK_IS_QUERY_SERVER (server));
+        g_return_if_fail (server->priv->filter_id == 0);
+
+        server->priv->connection = g_object_ref (connection);
+        server->priv->filter_id = g_dbus_connection_add_filter (connection,
+                                                                query_filter,
+                                                                filter_data_ref (server->priv->data),
+                                                                (GDestroyNotify) filter_data_unref);
+}
+
+/**
+ * ck_query_server_add_session:
+ * @server: a #CkQueryServer
+ * @session: a session that is fully set up and attached to its seat
+ **/
+void
+ck_query_server_add_session (CkQueryServer *server,
+                             CkSession     *session)
+{
+        SessionEntry *entry;
+        State        *state;
+
+        g_return_if_fail (CK_IS_QUERY_SERVER (server));
+
+        entry = session_entry_new (session);
+
+        state = state_copy (server->priv->data->state);
+        g_hash_table_insert (state->sessions, entry->path, entry);
+        publish_state (server, state);
+}
+
+void
+ck_query_server_remove_session (CkQueryServer *server,
+                                const char    *path)
+{
+        State *state;
+
+        g_return_if_fail (CK_IS_QUERY_SERVER (server));
+
+        state = state_copy (server->priv->data->state);
+        g_hash_table_remove (state->sessions, path);
+        publish_state (server, state);
+}
+
+void
+ck_query_server_add_seat (CkQueryServer *server,
+                          const char    *path)
+{
+        State *state;
+
+        g_return_if_fail (CK_IS_QUERY_SERVER (server));
+
+        state = state_copy (server->priv->data->state);
+        g_ptr_array_add (state->seats, g_strdup (path));
+        publish_state (server, state);
+}
+
+void
+ck_query_server_remove_seat (CkQueryServer *server,
+                             const char    *path)
+{
+        State *state;
+        guint  i;
+
+        g_return_if_fail (CK_IS_QUERY_SERVER (server));
+
+        state = state_copy (server->priv->data->state);
+        for (i = 0; i < state->seats->len; i++) {
+                if (g_strcmp0 (g_ptr_array_index (state->seats, i), path) == 0) {
+                        g_ptr_array_remove_index (state->seats, i);
+                        break;
+                }
+        }
+        publish_state (server, state);
+}
+
+/**
+ * ck_query_server_set_system_idle_hint:
+ * @server: a #CkQueryServer
+ * @idle_hint: whether the system is idle
+ * @since: when the hint last changed
+ **/
+void
+ck_query_server_set_system_idle_hint (CkQueryServer  *server,
+                                      gboolean        idle_hint,
+                                      const GTimeVal *since)
+{
+        State *state;
+
+        g_return_if_fail (CK_IS_QUERY_SERVER (server));
+
+        state = state_copy (server->priv->data->state);
+        /* the sessions and seats didn't change */
+        state->get_sessions_reply = cache_reply (&server->priv->data->state->get_sessions_reply, NULL);
+        state->list_sessions_reply = cache_reply (&server->priv->data->state->list_sessions_reply, NULL);
+        state->get_seats_reply = cache_reply (&server->priv->data->state->get_seats_reply, NULL);
+        state->system_idle_hint = idle_hint;
+        g_free (state->system_idle_since_hint);
+        /* matches GetSystemIdleSinceHint on the manager */
+        state->system_idle_since_hint = idle_hint ? g_time_val_to_iso8601 ((GTimeVal *) since) : g_strdup ("");
+        publish_state (server, state);
+}
+
+/**
+ * ck_query_server_get_stats:
+ * @server: a #CkQueryServer
+ * @published: (out) (allow-none): States published so far
+ * @served: (out) (allow-none): queries answered from a State
+ * @passed: (out) (allow-none): method calls left to the main loop
+ **/
+void
+ck_query_server_get_stats (CkQueryServer *server,
+                           guint         *published,
+                           guint         *served,
+                           guint         *passed)
+{
+        g_return_if_fail (CK_IS_QUERY_SERVER (server));
+
+        if (published != NULL) {
+                *published = server->priv->published;
+        }
+        if (served != NULL) {
+                *served = (guint) g_atomic_int_get (&server->priv->data->served);
+        }
+        if (passed != NULL) {
+                *passed = (guint) g_atomic_int_get (&server->priv->data->passed);
+        }
+}
@@ -0,0 +1,83 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CK_QUERY_SERVER_H_
+#define __CK_QUERY_SERVER_H_
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "ck-session.h"
+
+#define CK_TYPE_QUERY_SERVER           (ck_query_server_get_type ())
+#define CK_QUERY_SERVER(o)             (G_TYPE_CHECK_INSTANCE_CAST ((o), CK_TYPE_QUERY_SERVER, CkQueryServer))
+#define CK_QUERY_SERVER_CLASS(k)       (G_TYPE_CHECK_CLASS_CAST((k), CK_TYPE_QUERY_SERVER, CkQueryServerClass))
+#define CK_IS_QUERY_SERVER(o)          (G_TYPE_CHECK_INSTANCE_TYPE ((o), CK_TYPE_QUERY_SERVER))
+#define CK_IS_QUERY_SERVER_CLASS(k)    (G_TYPE_CHECK_CLASS_TYPE ((k), CK_TYPE_QUERY_SERVER))
+#define CK_QUERY_SERVER_GET_CLASS(o)   (G_TYPE_INSTANCE_GET_CLASS ((o), CK_TYPE_QUERY_SERVER, CkQueryServerClass))
+
+typedef struct CkQueryServerPrivate CkQueryServerPrivate;
+
+typedef struct
+{
+        GObject               parent;
+        CkQueryServerPrivate *priv;
+} CkQueryServer;
+
+typedef struct
+{
+        GObjectClass parent_class;
+} CkQueryServerClass;
+
+
+GType             ck_query_server_get_type               (void);
+
+CkQueryServer    *ck_query_server_new                    (void);
+
+void              ck_query_server_attach                 (CkQueryServer   *server,
+                                                          GDBusConnection *connection);
+
+void              ck_query_server_add_session            (CkQueryServer   *server,
+                                                          CkSession       *session);
+void              ck_query_server_remove_session         (CkQueryServer   *server,
+                                                          const char      *path);
+void              ck_query_server_add_seat               (CkQueryServer   *server,
+                                                          const char      *path);
+void              ck_query_server_remove_seat            (CkQueryServer   *server,
+                                                          const char      *path);
+void              ck_query_server_set_system_idle_hint   (CkQueryServer   *server,
+                                                          gboolean         idle_hint,
+                                                          const GTimeVal  *since);
+
+void              ck_query_server_get_stats              (CkQueryServer   *server,
+                                                          guint           *published,
+                                                          guint           *served,
+                                                          guint           *passed);
+
+#endif /* __CK_QUERY_SERVER_H_ */
@@ -34,6 +34,7 @@
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 
+#include "ck-sysdeps.h"
 #include "ck-run-programs.h"
 
 /* The number of wall-clock seconds a program is allowed to run before we kill it */
@@ -139,6 +140,8 @@ ck_run_programs (const char *dirpath,
         g_return_if_fail (dirpath != NULL);
         g_return_if_fail (action != NULL);
 
+        TRACE ();
+
         g_debug ("Running programs in %s for action %s", dirpath, action);
 
         /* Construct an environment consisting of the existing and the given environment */
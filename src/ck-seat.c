@@ -40,6 +40,7 @@
 #include "ck-session.h"
 #include "ck-vt-monitor.h"
 #include "ck-run-programs.h"
+#include "ck-string-pool.h"
 
 #define CK_SEAT_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CK_TYPE_SEAT, CkSeatPrivate))
 
@@ -49,16 +50,28 @@
 
 struct CkSeatPrivate
 {
-        char            *id;
-        char            *path;
+        /* from the string pool, shared with the seat's sessions */
+        const char      *id;
+        const char      *path;
         CkSeatKind       kind;
         GHashTable      *sessions;
         GPtrArray       *devices;
 
+        /* reply to GetSessions, cleared when a session is added or removed */
+        GVariant        *get_sessions_reply;
+
         CkSession       *active_session;
 
         CkVtMonitor     *vt_monitor;
 
+        /* the VT switch being traced, vt_trace[0] is when the kernel
+         * reported it and vt_trace[stage + 1] when that stage ended */
+        gboolean         vt_tracing;
+        gint64           vt_trace[CK_SEAT_VT_SWITCH_LAST + 1];
+        guint            vt_switches;
+        gint64           vt_switch_stage_usec[CK_SEAT_VT_SWITCH_LAST];
+        gint64           vt_switch_max_usec;
+
         GDBusConnection *connection;
 };
 
@@ -307,8 +320,11 @@ ck_seat_activate_session (CkSeat                *seat,
         g_debug ("Attempting to activate VT %u", num);
 
         if (seat->priv->active_session != session && seat->priv->active_session != NULL) {
-                /* let the old session know it's about to change */
-                ck_session_set_active (seat->priv->active_session, FALSE, TRUE);
+                /* let the old session know it's about to change, a
+                 * session holding its VT can take its time to pause
+                 * since the switch waits for it */
+                ck_session_set_active (seat->priv->active_session, FALSE,
+                                       !ck_session_get_holds_vt (seat->priv->active_session));
         }
 
         vt_error = NULL;
@@ -607,6 +623,90 @@ find_session_for_display_device (CkSeat     *seat,
         return session;
 }
 
+static const char *vt_switch_stage_names[CK_SEAT_VT_SWITCH_LAST] = {
+        "dispatch",
+        "pause",
+        "resume",
+        "signal",
+};
+
+static void
+vt_trace_mark (CkSeat             *seat,
+               CkSeatVtSwitchStage stage)
+{
+        if (seat->priv->vt_tracing) {
+                seat->priv->vt_trace[stage + 1] = g_get_monotonic_time ();
+        }
+}
+
+static void
+vt_trace_start (CkSeat *seat,
+                gint64  kernel_time)
+{
+        gint64 release_start = 0;
+
+        memset (seat->priv->vt_trace, 0, sizeof (seat->priv->vt_trace));
+        seat->priv->vt_tracing = TRUE;
+
+        if (seat->priv->active_session != NULL) {
+                release_start = ck_session_get_vt_release_start (seat->priv->active_session);
+        }
+
+        if (release_start > 0) {
+                /* The old session held its VT, so the kernel only
+                 * switched once it had paused. That pause already
+                 * happened and change_active_session has nothing left
+                 * to do for it, count it from when it started. */
+                seat->priv->vt_trace[0] = release_start;
+                seat->priv->vt_trace[CK_SEAT_VT_SWITCH_DISPATCH + 1] = release_start;
+                vt_trace_mark (seat, CK_SEAT_VT_SWITCH_PAUSE);
+                return;
+        }
+
+        vt_trace_mark (seat, CK_SEAT_VT_SWITCH_DISPATCH);
+
+        /* The monitor may not know when the kernel switched */
+        seat->priv->vt_trace[0] = kernel_time > 0 ? kernel_time : seat->priv->vt_trace[1];
+}
+
+static void
+vt_trace_finish (CkSeat *seat,
+                 guint   num)
+{
+        GString *str;
+        gint64   total;
+        guint    i;
+
+        seat->priv->vt_tracing = FALSE;
+
+        str = g_string_new (NULL);
+
+        for (i = 0; i < CK_SEAT_VT_SWITCH_LAST; i++) {
+                gint64 usec;
+
+                /* stages that didn't happen, like pausing when there
+                 * was no active session, took no time */
+                if (seat->priv->vt_trace[i + 1] == 0) {
+                        seat->priv->vt_trace[i + 1] = seat->priv->vt_trace[i];
+                }
+
+                usec = seat->priv->vt_trace[i + 1] - seat->priv->vt_trace[i];
+                seat->priv->vt_switch_stage_usec[i] += usec;
+
+                g_string_append_printf (str, " %s %" G_GINT64_FORMAT,
+                                        vt_switch_stage_names[i], usec);
+        }
+
+        total = seat->priv->vt_trace[CK_SEAT_VT_SWITCH_LAST] - seat->priv->vt_trace[0];
+        seat->priv->vt_switches++;
+        seat->priv->vt_switch_max_usec = MAX (seat->priv->vt_switch_max_usec, total);
+
+        g_debug ("VT switch to %u on %s took %" G_GINT64_FORMAT " us:%s",
+                 num, seat->priv->id, total, str->str);
+
+        g_string_free (str, TRUE);
+}
+
 static void
 change_active_session (CkSeat    *seat,
                        CkSession *session)
@@ -631,6 +731,7 @@ change_active_session (CkSeat    *seat,
                 g_debug ("ckseat: change_active_session: old session %s no longer active", old_ssid ? old_ssid : "(null)");
                 ck_session_set_active (old_session, FALSE, TRUE);
         }
+        vt_trace_mark (seat, CK_SEAT_VT_SWITCH_PAUSE);
 
         seat->priv->active_session = session;
 
@@ -639,6 +740,7 @@ change_active_session (CkSeat    *seat,
                 session_path = ck_session_get_path (session);
                 ck_session_set_active (session, TRUE, TRUE);
         }
+        vt_trace_mark (seat, CK_SEAT_VT_SWITCH_RESUME);
 
         g_debug ("Active session changed: %s", session_path ? session_path : "(null)");
 
@@ -655,6 +757,7 @@ change_active_session (CkSeat    *seat,
                 /* Only emit if we have a valid session_path or GDBus/GVariant gets mad */
                 console_kit_seat_emit_active_session_changed (CONSOLE_KIT_SEAT (seat), session_path);
         }
+        vt_trace_mark (seat, CK_SEAT_VT_SWITCH_SIGNAL);
 
         if (old_session != NULL) {
                 g_object_unref (old_session);
@@ -739,6 +842,7 @@ ck_seat_remove_session (CkSeat         *seat,
         /* Remove the session from the list but don't call
          * unref until the signal is emitted */
         g_hash_table_steal (seat->priv->sessions, ssid);
+        g_clear_pointer (&seat->priv->get_sessions_reply, g_variant_unref);
 
         g_debug ("Emitting session-removed: %s", ssid);
 
@@ -777,6 +881,7 @@ ck_seat_add_session (CkSeat         *seat,
         ck_session_get_id (session, &ssid, NULL);
 
         g_hash_table_insert (seat->priv->sessions, g_strdup (ssid), g_object_ref (session));
+        g_clear_pointer (&seat->priv->get_sessions_reply, g_variant_unref);
 
         ck_session_set_seat_id (session, seat->priv->id, seat->priv->path, NULL);
 
@@ -957,7 +1062,9 @@ active_vt_changed (CkVtMonitor    *vt_monitor,
 {
         g_debug ("Active vt changed: %u", num);
 
+        vt_trace_start (seat, ck_vt_monitor_get_active_changed_time (vt_monitor));
         update_active_vt (seat, num);
+        vt_trace_finish (seat, num);
 }
 
 static gboolean
@@ -967,38 +1074,22 @@ ck_seat_can_graphical (void)
         return TRUE;
 }
 
+/* The seat is exported on the bus by the manager, through its
+ * object manager, once this succeeds */
 gboolean
 ck_seat_register (CkSeat *seat)
 {
-        GError   *error = NULL;
         ConsoleKitSeat *ckseat = CONSOLE_KIT_SEAT (seat);
 
         g_debug ("register seat");
 
-        error = NULL;
-
         if (seat->priv->connection == NULL) {
                 g_critical ("seat->priv->connection == NULL");
                 return FALSE;
         }
 
-        g_debug ("exporting path %s", seat->priv->path);
-
-        if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (ckseat),
-                                               seat->priv->connection,
-                                               seat->priv->path,
-                                               &error)) {
-                if (error != NULL) {
-                        g_critical ("error exporting interface: %s", error->message);
-                        g_error_free (error);
-                        return FALSE;
-                }
-        }
-
         console_kit_seat_set_can_graphical (ckseat, ck_seat_can_graphical ());
 
-        g_debug ("exported on %s", g_dbus_interface_skeleton_get_object_path (G_DBUS_INTERFACE_SKELETON (ckseat)));
-
         return TRUE;
 }
 
@@ -1031,8 +1122,10 @@ static gboolean
 dbus_get_sessions (ConsoleKitSeat        *ckseat,
                    GDBusMethodInvocation *context)
 {
-        CkSeat       *seat;
-        GPtrArray    *sessions;
+        CkSeat         *seat;
+        GVariantBuilder sessions;
+        GHashTableIter  iter;
+        gpointer        value;
 
         TRACE ();
 
@@ -1040,22 +1133,51 @@ dbus_get_sessions (ConsoleKitSeat        *ckseat,
 
         g_return_val_if_fail (CK_IS_SEAT (seat), FALSE);
 
-        sessions = g_hash_table_get_values_as_ptr_array (seat->priv->sessions);
-
         /* gdbus/gvariant requires that we throw an error to return NULL */
-        if (sessions->len == NULL) {
+        if (g_hash_table_size (seat->priv->sessions) == 0) {
                 throw_error (context, CK_SEAT_ERROR_NO_SESSIONS, _("Seat has no sessions"));
                 return TRUE;
         }
 
-        /* replace each session with its path */
-        for (guint i = 0; i < sessions->len; i++) {
-                sessions->pdata[i] = ck_session_get_path ( CK_SESSION(sessions->pdata[i]) );
+        if (seat->priv->get_sessions_reply == NULL) {
+                g_variant_builder_init (&sessions, G_VARIANT_TYPE ("ao"));
+
+                g_hash_table_iter_init (&iter, seat->priv->sessions);
+                while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                        g_variant_builder_add (&sessions, "o", ck_session_get_path (CK_SESSION (value)));
+                }
+
+                seat->priv->get_sessions_reply = g_variant_ref_sink (g_variant_new ("(ao)", &sessions));
         }
 
-        g_ptr_array_add (sessions, NULL);
-        console_kit_seat_complete_get_sessions (ckseat, context, (const gchar **)sessions->pdata);
-        g_ptr_array_unref (sessions);
+        g_dbus_method_invocation_return_value (context, seat->priv->get_sessions_reply);
+        return TRUE;
+}
+
+static gboolean
+dbus_get_sessions_snapshot (ConsoleKitSeat        *ckseat,
+                            GDBusMethodInvocation *context)
+{
+        CkSeat         *seat;
+        GVariantBuilder sessions;
+        GHashTableIter  iter;
+        gpointer        value;
+
+        TRACE ();
+
+        seat = CK_SEAT (ckseat);
+
+        g_return_val_if_fail (CK_IS_SEAT (seat), FALSE);
+
+        g_variant_builder_init (&sessions, G_VARIANT_TYPE ("a(oa{sv})"));
+
+        g_hash_table_iter_init (&iter, seat->priv->sessions);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                ck_session_add_to_snapshot (CK_SESSION (value), &sessions);
+        }
+
+        console_kit_seat_complete_get_sessions_snapshot (ckseat, context, g_variant_builder_end (&sessions));
+
         return TRUE;
 }
 
@@ -1120,8 +1242,8 @@ static void
 _ck_seat_set_id (CkSeat         *seat,
                  const char     *id)
 {
-        g_free (seat->priv->id);
-        seat->priv->id = g_strdup (id);
+        ck_string_pool_release (seat->priv->id);
+        seat->priv->id = ck_string_pool_intern (id);
 }
 
 static void
@@ -1198,6 +1320,7 @@ ck_seat_constructor (GType                  type,
                      GObjectConstructParam *construct_properties)
 {
         CkSeat      *seat;
+        char        *path;
 
         seat = CK_SEAT (G_OBJECT_CLASS (ck_seat_parent_class)->constructor (type,
                                                                             n_construct_properties,
@@ -1208,7 +1331,9 @@ ck_seat_constructor (GType                  type,
                 g_signal_connect (seat->priv->vt_monitor, "active-changed", G_CALLBACK (active_vt_changed), seat);
         }
 
-        seat->priv->path = g_strdup_printf ("%s/%s", CK_DBUS_PATH, seat->priv->id);
+        path = g_strdup_printf ("%s/%s", CK_DBUS_PATH, seat->priv->id);
+        seat->priv->path = ck_string_pool_intern (path);
+        g_free (path);
 
         return G_OBJECT (seat);
 }
@@ -1312,8 +1437,11 @@ ck_seat_finalize (GObject *object)
 
         g_ptr_array_free (seat->priv->devices, TRUE);
         g_hash_table_destroy (seat->priv->sessions);
-        g_free (seat->priv->id);
-        g_free (seat->priv->path);
+        if (seat->priv->get_sessions_reply != NULL) {
+                g_variant_unref (seat->priv->get_sessions_reply);
+        }
+        ck_string_pool_release (seat->priv->id);
+        ck_string_pool_release (seat->priv->path);
 
         G_OBJECT_CLASS (ck_seat_parent_class)->finalize (object);
 }
@@ -1328,6 +1456,7 @@ ck_seat_iface_init (ConsoleKitSeatIface *iface)
         iface->handle_get_id                = dbus_get_id;
         iface->handle_get_name              = dbus_get_name;
         iface->handle_get_sessions          = dbus_get_sessions;
+        iface->handle_get_sessions_snapshot = dbus_get_sessions_snapshot;
         iface->handle_switch_to             = dbus_switch_to;
 }
 
@@ -1630,3 +1759,36 @@ ck_seat_dump (CkSeat   *seat,
 
         g_free (group_name);
 }
+
+/**
+ * ck_seat_get_vt_switch_stats:
+ * @seat: a #CkSeat
+ * @switches: returns the number of VT switches traced
+ * @stage_usec: returns the total time spent in each #CkSeatVtSwitchStage,
+ *              an array of CK_SEAT_VT_SWITCH_LAST
+ * @max_usec: returns the longest VT switch, from the kernel to the end
+ */
+void
+ck_seat_get_vt_switch_stats (CkSeat *seat,
+                             guint  *switches,
+                             gint64 *stage_usec,
+                             gint64 *max_usec)
+{
+        guint i;
+
+        g_return_if_fail (CK_IS_SEAT (seat));
+
+        *switches = seat->priv->vt_switches;
+        for (i = 0; i < CK_SEAT_VT_SWITCH_LAST; i++) {
+                stage_usec[i] = seat->priv->vt_switch_stage_usec[i];
+        }
+        *max_usec = seat->priv->vt_switch_max_usec;
+}
+
+const char *
+ck_seat_get_vt_switch_stage_name (CkSeatVtSwitchStage stage)
+{
+        g_return_val_if_fail (stage < CK_SEAT_VT_SWITCH_LAST, NULL);
+
+        return vt_switch_stage_names[stage];
+}
@@ -58,6 +58,18 @@ typedef enum
 GType ck_seat_kind_get_type (void);
 #define CK_TYPE_SEAT_KIND (ck_seat_kind_get_type ())
 
+/* The steps of a VT switch, each timed from the end of the one before */
+typedef enum
+{
+        CK_SEAT_VT_SWITCH_DISPATCH,     /* kernel reports it until the seat handles it */
+        CK_SEAT_VT_SWITCH_PAUSE,        /* pausing the old session's devices, up to
+                                         * the seat seeing the switch when that
+                                         * session held its VT */
+        CK_SEAT_VT_SWITCH_RESUME,       /* resuming the new session's devices */
+        CK_SEAT_VT_SWITCH_SIGNAL,       /* emitting ActiveSessionChanged */
+        CK_SEAT_VT_SWITCH_LAST
+} CkSeatVtSwitchStage;
+
 typedef enum
 {
         CK_SEAT_ERROR_GENERAL,
@@ -130,6 +142,12 @@ gpointer            ck_seat_activate_session      (CkSeat                *seat,
                                                    CkSession             *session,
                                                    GDBusMethodInvocation *context);
 
+void                ck_seat_get_vt_switch_stats   (CkSeat                *seat,
+                                                   guint                 *switches,
+                                                   gint64                *stage_usec,
+                                                   gint64                *max_usec);
+const char        * ck_seat_get_vt_switch_stage_name (CkSeatVtSwitchStage stage);
+
 G_END_DECLS
 
 #endif /* __CK_SEAT_H */
@@ -35,6 +35,7 @@
 
 #include "ck-session-leader.h"
 #include "ck-job.h"
+#include "ck-sysdeps.h"
 
 #define CK_SESSION_LEADER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CK_TYPE_SESSION_LEADER, CkSessionLeaderPrivate))
 
@@ -63,15 +64,27 @@ struct CkSessionLeaderPrivate
         char       *id;
         uid_t       uid;
         pid_t       pid;
+        guint64     start_time;
         char       *service_name;
         char       *session_id;
         char       *cookie;
         char       *runtime_dir;
         GList      *pending_jobs;
+        GList      *pending_collects;
         gboolean    cancelled;
+        gboolean    force_helper;
         GHashTable *override_parameters;
 };
 
+typedef struct {
+        CkSessionLeader        *leader;
+        CkSessionLeaderDoneFunc done_cb;
+        gpointer                user_data;
+        GDBusMethodInvocation  *context;
+        GVariant               *parameters;
+        guint                   idle_id;
+} JobData;
+
 enum {
         PROP_0,
 };
@@ -108,6 +121,15 @@ remove_pending_job (CkJob *job)
         }
 }
 
+/* The number of information collection jobs still running */
+guint
+ck_session_leader_get_n_pending_jobs (CkSessionLeader *leader)
+{
+        g_return_val_if_fail (CK_IS_SESSION_LEADER (leader), 0);
+
+        return g_list_length (leader->priv->pending_jobs);
+}
+
 void
 ck_session_leader_cancel (CkSessionLeader *leader)
 {
@@ -119,6 +141,17 @@ ck_session_leader_cancel (CkSessionLeader *leader)
                 leader->priv->pending_jobs = NULL;
         }
 
+        if (leader->priv->pending_collects != NULL) {
+                GList *l;
+
+                for (l = leader->priv->pending_collects; l != NULL; l = l->next) {
+                        JobData *data = l->data;
+                        g_source_remove (data->idle_id);
+                }
+                g_list_free (leader->priv->pending_collects);
+                leader->priv->pending_collects = NULL;
+        }
+
         leader->priv->cancelled = TRUE;
 }
 
@@ -355,13 +388,6 @@ save_parameters (CkSessionLeader *leader,
         g_variant_iter_free (iter);
 }
 
-typedef struct {
-        CkSessionLeader        *leader;
-        CkSessionLeaderDoneFunc done_cb;
-        gpointer                user_data;
-        GDBusMethodInvocation  *context;
-} JobData;
-
 static void
 job_completed (CkJob     *job,
                int        status,
@@ -401,10 +427,140 @@ job_completed (CkJob     *job,
 static void
 job_data_free (JobData *data)
 {
+        if (data->parameters != NULL) {
+                g_variant_unref (data->parameters);
+        }
         g_object_unref (data->leader);
         g_free (data);
 }
 
+static void
+add_generated_parameter (CkSessionLeader *leader,
+                         GVariantBuilder *ck_parameters,
+                         const char      *name,
+                         GVariant        *value)
+{
+        g_variant_ref_sink (value);
+
+        if (! have_override_parameter (leader, name)) {
+                g_variant_builder_add (ck_parameters, "{sv}", name, value);
+        }
+
+        g_variant_unref (value);
+}
+
+/* Gathers the same information ck-collect-session-info would print
+ * without forking it. Returns NULL when the helper is still needed:
+ * when the leader has an X11 display we would have to connect to as
+ * the user, or when its process can't be inspected from here.
+ */
+static GVariant *
+collect_parameters_in_process (CkSessionLeader *leader)
+{
+        GVariantBuilder ck_parameters;
+        GHashTable     *env;
+        CkProcessStat  *stat;
+        GError         *error;
+        const char     *x11_display_device = NULL;
+        const char     *vt_device;
+        char           *display_device;
+        char           *login_session_id;
+        gboolean        have_display;
+        guint           vtnr;
+
+        if (leader->priv->pid < 2) {
+                return NULL;
+        }
+
+        if (have_override_parameter (leader, "x11-display-device")) {
+                GVariant *var = g_hash_table_lookup (leader->priv->override_parameters, "x11-display-device");
+                x11_display_device = g_variant_get_string (var, NULL);
+                if (x11_display_device[0] == '\0') {
+                        x11_display_device = NULL;
+                }
+        }
+
+        /* If our DM set the display device there is nothing to probe,
+         * otherwise only sessions without a DISPLAY can skip the helper */
+        if (x11_display_device == NULL) {
+                env = ck_unix_pid_get_env_hash (leader->priv->pid);
+                if (env == NULL) {
+                        return NULL;
+                }
+
+                have_display = g_hash_table_lookup (env, "DISPLAY") != NULL;
+                g_hash_table_destroy (env);
+
+                if (have_display) {
+                        g_debug ("Leader %d has a DISPLAY, using the helper", leader->priv->pid);
+                        return NULL;
+                }
+        }
+
+        error = NULL;
+        if (! ck_process_stat_new_for_unix_pid (leader->priv->pid, &stat, &error)) {
+                if (error != NULL) {
+                        g_debug ("stat on pid %d failed: %s", leader->priv->pid, error->message);
+                        g_error_free (error);
+                }
+                return NULL;
+        }
+
+        display_device = ck_process_stat_get_tty (stat);
+        ck_process_stat_free (stat);
+
+        if (! ck_unix_pid_get_login_session_id (leader->priv->pid, &login_session_id)) {
+                login_session_id = NULL;
+        }
+
+        vt_device = x11_display_device != NULL ? x11_display_device : display_device;
+        vtnr = 0;
+        if (vt_device != NULL && ! ck_get_console_num_from_device (vt_device, &vtnr)) {
+                vtnr = 0;
+        }
+
+        g_variant_builder_init (&ck_parameters, G_VARIANT_TYPE ("a{sv}"));
+
+        add_generated_parameter (leader, &ck_parameters, "unix-user", g_variant_new_int32 (leader->priv->uid));
+        add_generated_parameter (leader, &ck_parameters, "vtnr", g_variant_new_uint32 (vtnr));
+        if (display_device != NULL) {
+                add_generated_parameter (leader, &ck_parameters, "display-device", g_variant_new_string (display_device));
+        }
+        /* when PAM is supported don't set is-local here - let the daemon do that */
+#ifndef HAVE_PAM
+        add_generated_parameter (leader, &ck_parameters, "is-local", g_variant_new_boolean (TRUE));
+#endif
+        if (login_session_id != NULL) {
+                add_generated_parameter (leader, &ck_parameters, "login-session-id", g_variant_new_string (login_session_id));
+        }
+
+        g_free (display_device);
+        g_free (login_session_id);
+
+        /* now overlay the overrides */
+        g_hash_table_foreach (leader->priv->override_parameters,
+                              (GHFunc)add_to_parameters,
+                              &ck_parameters);
+
+        return g_variant_builder_end (&ck_parameters);
+}
+
+static gboolean
+collect_idle_cb (JobData *data)
+{
+        CkSessionLeader *leader = data->leader;
+
+        leader->priv->pending_collects = g_list_remove (leader->priv->pending_collects, data);
+        data->idle_id = 0;
+
+        data->done_cb (leader,
+                       data->parameters,
+                       data->context,
+                       data->user_data);
+
+        return FALSE;
+}
+
 gboolean
 ck_session_leader_collect_parameters (CkSessionLeader        *session_leader,
                                       GDBusMethodInvocation  *context,
@@ -427,6 +583,22 @@ ck_session_leader_collect_parameters (CkSessionLeader        *session_leader,
         data->user_data = user_data;
         data->context = context;
 
+        if (! session_leader->priv->force_helper) {
+                GVariant *parameters;
+
+                parameters = collect_parameters_in_process (session_leader);
+                if (parameters != NULL) {
+                        /* keep the reply asynchronous, as it is with the helper */
+                        data->parameters = g_variant_ref_sink (parameters);
+                        data->idle_id = g_idle_add_full (G_PRIORITY_DEFAULT,
+                                                         (GSourceFunc)collect_idle_cb,
+                                                         data,
+                                                         (GDestroyNotify)job_data_free);
+                        session_leader->priv->pending_collects = g_list_prepend (session_leader->priv->pending_collects, data);
+                        return TRUE;
+                }
+        }
+
         if (have_override_parameter (session_leader, "x11-display-device")) {
                 GVariant *var = g_hash_table_lookup (session_leader->priv->override_parameters, "x11-display-device");
                 x11_display_device = g_variant_get_string (var, NULL);
@@ -523,6 +695,25 @@ ck_session_leader_set_pid          (CkSessionLeader       *session_leader,
         session_leader->priv->pid = pid;
 }
 
+guint64
+ck_session_leader_get_start_time     (CkSessionLeader        *session_leader)
+{
+        g_return_val_if_fail (CK_IS_SESSION_LEADER (session_leader), 0);
+        return session_leader->priv->start_time;
+}
+
+/* The start time of the leader process, as reported by
+ * ck_process_stat_get_start_time(). Together with the pid it tells
+ * the leader apart from a later process that reused the pid.
+ */
+void
+ck_session_leader_set_start_time   (CkSessionLeader       *session_leader,
+                                    guint64                start_time)
+{
+        g_return_if_fail (CK_IS_SESSION_LEADER (session_leader));
+        session_leader->priv->start_time = start_time;
+}
+
 void
 ck_session_leader_set_uid          (CkSessionLeader       *session_leader,
                                     uid_t                  uid)
@@ -549,6 +740,16 @@ ck_session_leader_set_cookie       (CkSessionLeader       *session_leader,
         session_leader->priv->cookie = g_strdup (cookie);
 }
 
+/* Always run ck-collect-session-info, even when the parameters could
+ * be gathered in-process. Used to compare both paths. */
+void
+ck_session_leader_set_force_helper (CkSessionLeader       *session_leader,
+                                    gboolean               force_helper)
+{
+        g_return_if_fail (CK_IS_SESSION_LEADER (session_leader));
+        session_leader->priv->force_helper = force_helper;
+}
+
 void
 ck_session_leader_set_service_name (CkSessionLeader       *session_leader,
                                     const char            *service_name)
@@ -692,3 +893,22 @@ ck_session_leader_dump (CkSessionLeader *session_leader,
 
         g_free (group_name);
 }
+
+/* Adds the fields that must not end up in the world readable
+ * database but are needed to bring the leader back after a restart.
+ */
+void
+ck_session_leader_dump_secrets (CkSessionLeader *session_leader,
+                                GKeyFile        *key_file)
+{
+        char *group_name;
+        char *start_time;
+
+        group_name = g_strdup_printf ("SessionLeader %s", session_leader->priv->session_id);
+        start_time = g_strdup_printf ("%" G_GUINT64_FORMAT, session_leader->priv->start_time);
+        g_key_file_set_string (key_file, group_name, "cookie", session_leader->priv->cookie);
+        g_key_file_set_string (key_file, group_name, "start_time", start_time);
+
+        g_free (start_time);
+        g_free (group_name);
+}
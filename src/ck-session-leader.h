@@ -74,6 +74,10 @@ void                ck_session_leader_set_cookie              (CkSessionLeader
                                                                const char             *cookie);
 void                ck_session_leader_set_service_name        (CkSessionLeader        *session_leader,
                                                                const char             *sender);
+void                ck_session_leader_set_start_time          (CkSessionLeader        *session_leader,
+                                                               guint64                 start_time);
+void                ck_session_leader_set_force_helper        (CkSessionLeader        *session_leader,
+                                                               gboolean                force_helper);
 
 void                ck_session_leader_set_override_parameters (CkSessionLeader       *session_leader,
                                                                const GVariant        *parameters);
@@ -83,6 +87,7 @@ const char *        ck_session_leader_peek_cookie             (CkSessionLeader
 const char *        ck_session_leader_peek_service_name       (CkSessionLeader        *session_leader);
 uid_t               ck_session_leader_get_uid                 (CkSessionLeader        *session_leader);
 pid_t               ck_session_leader_get_pid                 (CkSessionLeader        *session_leader);
+guint64             ck_session_leader_get_start_time          (CkSessionLeader        *session_leader);
 
 
 gboolean            ck_session_leader_collect_parameters      (CkSessionLeader        *session_leader,
@@ -90,9 +95,12 @@ gboolean            ck_session_leader_collect_parameters      (CkSessionLeader
                                                                CkSessionLeaderDoneFunc done_cb,
                                                                gpointer                data);
 void                ck_session_leader_cancel                  (CkSessionLeader        *session_leader);
+guint               ck_session_leader_get_n_pending_jobs      (CkSessionLeader        *session_leader);
 
 void                ck_session_leader_dump                    (CkSessionLeader         *session_leader,
                                                                GKeyFile                *key_file);
+void                ck_session_leader_dump_secrets            (CkSessionLeader         *session_leader,
+                                                               GKeyFile                *key_file);
 
 
 G_END_DECLS
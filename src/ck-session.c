@@ -75,6 +75,8 @@
 #include "ck-run-programs.h"
 #include "ck-sysdeps.h"
 #include "ck-device.h"
+#include "ck-caller-cache.h"
+#include "ck-string-pool.h"
 
 #define CK_SESSION_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CK_TYPE_SESSION, CkSessionPrivate))
 
@@ -99,19 +101,48 @@ struct CkSessionPrivate
         char            *id;
         char            *path;
         char            *cookie;
-        char            *seat_id;
-        char            *seat_path;
-        char            *runtime_dir;
+        /* from the string pool, see ck_session_set_seat_id and
+         * ck_session_set_runtime_dir */
+        const char      *seat_id;
+        const char      *seat_path;
+        const char      *runtime_dir;
         char            *login_session_id;
 
+        /* Most sessions share these, so they come from the string
+         * pool too rather than the skeleton's own copies. They are
+         * set before the session is exported and never change after,
+         * so no PropertiesChanged is needed for them. */
+        const char      *session_type;
+        const char      *session_class;
+        const char      *session_service;
+        const char      *display_device;
+        const char      *remote_host_name;
+
         gchar           *session_controller;
         guint            session_controller_watchid;
-        GList           *devices;
+        /* devnum -> CkDevice, see device_devnum */
+        GHashTable      *devices;
+        /* how many of the devices are currently active, so we can
+         * tell when a pause has finished without walking them all */
+        guint            active_devices;
+        /* set once the controller uses TakeDevices, it then gets the
+         * PauseDevices/ResumeDevices signals instead of one per device */
+        gboolean         batched_devices;
         guint            pause_devices_timer;
+        /* when the pending PauseDevice went out, 0 when none is */
+        gint64           pause_start;
+        /* running average of how long the session controller takes to
+         * pause all its devices, 0 until it has done so once */
+        gint64           pause_latency;
         gint             tty_fd;
         gint             old_kbd_mode;
         guint            sig_watch_s1;
         guint            sig_watch_s2;
+        /* the kernel is waiting for VT_RELDISP until the controller
+         * has paused its devices */
+        gboolean         vt_release_pending;
+        /* when we started pausing to give up the VT, 0 while active */
+        gint64           vt_release_start;
 
         GTimeVal         creation_time;
 
@@ -120,7 +151,6 @@ struct CkSessionPrivate
         GTimeVal         idle_since_hint;
 
         GDBusConnection *connection;
-        GDBusProxy      *bus_proxy;
 };
 
 enum {
@@ -135,10 +165,27 @@ enum {
         PROP_COOKIE,
         PROP_LOGIN_SESSION_ID,
         PROP_SESSION_CONTROLLER,
+        PROP_SESSION_TYPE,
+        PROP_SESSION_CLASS,
+        PROP_SESSION_SERVICE,
+        PROP_DISPLAY_DEVICE,
+        PROP_REMOTE_HOST_NAME,
 };
 
 static guint signals [LAST_SIGNAL] = { 0, };
 
+/* The force-pause timeout is this many times the controller's average
+ * pause latency, kept within the bounds below */
+#define PAUSE_TIMEOUT_FACTOR 4
+
+/* Shared by all sessions, see ck_session_set_pause_timeout */
+static guint  pause_timeout_min = CK_SESSION_DEFAULT_PAUSE_TIMEOUT_MIN;
+static guint  pause_timeout_max = CK_SESSION_DEFAULT_PAUSE_TIMEOUT_MAX;
+static guint  pause_count = 0;
+static guint  pause_timeouts = 0;
+static gint64 pause_total_usec = 0;
+static gint64 pause_max_usec = 0;
+
 static void     ck_session_iface_init           (ConsoleKitSessionIface *iface);
 static void     ck_session_finalize             (GObject                *object);
 static void     ck_session_remove_all_devices   (CkSession              *session);
@@ -235,35 +282,7 @@ register_session (CkSession *session, GDBusConnection *connection)
                 return FALSE;
         }
 
-        g_debug ("exporting path %s", session->priv->path);
-
-        if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (CONSOLE_KIT_SESSION (session)),
-                                               session->priv->connection,
-                                               session->priv->path,
-                                               &error)) {
-                if (error != NULL) {
-                        g_critical ("error exporting interface: %s", error->message);
-                        g_error_free (error);
-                        return FALSE;
-                }
-        }
-
-        g_debug ("exported on %s", g_dbus_interface_skeleton_get_object_path (G_DBUS_INTERFACE_SKELETON (CONSOLE_KIT_SESSION (session))));
-
-        /* connect to DBus for get_caller_info */
-        session->priv->bus_proxy = g_dbus_proxy_new_sync (session->priv->connection,
-                                                          G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
-                                                          G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
-                                                          NULL,
-                                                          "org.freedesktop.DBus",
-                                                          "/org/freedesktop/DBus/Bus",
-                                                          "org.freedesktop.DBus",
-                                                          NULL,
-                                                          &error);
-        if (session->priv->bus_proxy == NULL) {
-                g_warning ("cannot connect to DBus: %s", error->message);
-                g_error_free (error);
-        }
+        /* the manager exports us on the bus through its object manager */
 
         /* default to unspecified for the session type on startup */
         if (console_kit_session_get_session_type (CONSOLE_KIT_SESSION (session)) == NULL) {
@@ -324,6 +343,35 @@ ck_session_unlock (CkSession *session)
         console_kit_session_emit_unlock (cksession);
 }
 
+/**
+ * ck_session_set_pause_timeout:
+ * @min_msec: shortest time to wait for a PauseDeviceComplete
+ * @max_msec: longest time to wait for a PauseDeviceComplete
+ *
+ * Sets the bounds of the adaptive timeout after which the devices of
+ * a session are paused by force. A controller that has not paused its
+ * devices yet gets @max_msec.
+ */
+void
+ck_session_set_pause_timeout (guint min_msec,
+                              guint max_msec)
+{
+        pause_timeout_min = min_msec;
+        pause_timeout_max = MAX (min_msec, max_msec);
+}
+
+void
+ck_session_get_pause_stats (guint  *pauses,
+                            guint  *timeouts,
+                            gint64 *avg_usec,
+                            gint64 *max_usec)
+{
+        *pauses = pause_count;
+        *timeouts = pause_timeouts;
+        *avg_usec = pause_count > 0 ? pause_total_usec / pause_count : 0;
+        *max_usec = pause_max_usec;
+}
+
 static gboolean
 dbus_lock (ConsoleKitSession     *cksession,
            GDBusMethodInvocation *context)
@@ -348,58 +396,61 @@ dbus_unlock (ConsoleKitSession     *cksession,
         return TRUE;
 }
 
-/* adapted from PolicyKit */
-static gboolean
-get_caller_info (CkSession   *session,
-                 const char  *sender,
-                 uid_t       *calling_uid,
-                 pid_t       *calling_pid)
-{
-        gboolean  res   = FALSE;
-        GVariant *value = NULL;
-        GError   *error = NULL;
+/* Continuation for D-Bus handlers that need to know who is calling.
+ * Only runs if the caller's credentials could be resolved. The method
+ * arguments can be read back from the invocation.
+ */
+typedef void (* CallerInfoFunc) (CkSession             *session,
+                                 GDBusMethodInvocation *context,
+                                 uid_t                  calling_uid,
+                                 pid_t                  calling_pid);
 
-        if (sender == NULL) {
-                goto out;
-        }
+typedef struct
+{
+        CkSession             *session;
+        GDBusMethodInvocation *context;
+        CallerInfoFunc         func;
+} CallerInfoData;
 
-        value = g_dbus_proxy_call_sync (session->priv->bus_proxy, "GetConnectionUnixUser",
-                                        g_variant_new ("(s)", sender),
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        2000,
-                                        NULL,
-                                        &error);
+static void
+caller_info_ready_cb (CkCallerCache *cache,
+                      const gchar   *sender,
+                      gboolean       success,
+                      uid_t          uid,
+                      pid_t          pid,
+                      gpointer       user_data)
+{
+        CallerInfoData *info = user_data;
 
-        if (value == NULL) {
-                g_warning ("GetConnectionUnixUser() failed: %s", error->message);
-                g_error_free (error);
-                goto out;
+        if (success) {
+                info->func (info->session, info->context, uid, pid);
+        } else {
+                g_warning ("Unable to get information about the calling process %s", sender);
+                throw_error (info->context, CK_SESSION_ERROR_FAILED, _("Unable to lookup information about the calling process"));
         }
-        g_variant_get (value, "(u)", calling_uid);
-        g_variant_unref (value);
-
-        value = g_dbus_proxy_call_sync (session->priv->bus_proxy, "GetConnectionUnixProcessID",
-                                        g_variant_new ("(s)", sender),
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        2000,
-                                        NULL,
-                                        &error);
 
-        if (value == NULL) {
-                g_warning ("GetConnectionUnixProcessID() failed: %s", error->message);
-                g_error_free (error);
-                goto out;
-        }
-        g_variant_get (value, "(u)", calling_pid);
-        g_variant_unref (value);
+        g_object_unref (info->context);
+        g_object_unref (info->session);
+        g_free (info);
+}
 
-        res = TRUE;
+static void
+with_caller_info (CkSession             *session,
+                  GDBusMethodInvocation *context,
+                  CallerInfoFunc         func)
+{
+        CallerInfoData *info;
 
-        g_debug ("uid = %d", *calling_uid);
-        g_debug ("pid = %d", *calling_pid);
+        info = g_new0 (CallerInfoData, 1);
+        info->session = g_object_ref (session);
+        info->context = g_object_ref (context);
+        info->func = func;
 
-out:
-        return res;
+        ck_caller_cache_resolve (ck_caller_cache_get (),
+                                 session->priv->connection,
+                                 g_dbus_method_invocation_get_sender (context),
+                                 caller_info_ready_cb,
+                                 info);
 }
 
 static gboolean
@@ -461,45 +512,38 @@ dbus_get_idle_hint (ConsoleKitSession *cksession,
   /org/freedesktop/ConsoleKit/Session1 \
   org.freedesktop.ConsoleKit.Session.SetIdleHint boolean:TRUE
 */
-static gboolean
-dbus_set_idle_hint (ConsoleKitSession     *cksession,
-                    GDBusMethodInvocation *context,
-                    gboolean               idle_hint)
+static void
+set_idle_hint_for_caller (CkSession             *session,
+                          GDBusMethodInvocation *context,
+                          uid_t                  calling_uid,
+                          pid_t                  calling_pid)
 {
-        const char *sender;
-        uid_t       calling_uid = 0;
-        pid_t       calling_pid = 0;
-        gboolean    res;
-        CkSession *session;
-
-        TRACE ();
-
-        g_return_val_if_fail (CK_IS_SESSION (cksession), FALSE);
-
-        session = CK_SESSION(cksession);
-
-        sender = g_dbus_method_invocation_get_sender (context);
-
-        res = get_caller_info (session,
-                               sender,
-                               &calling_uid,
-                               &calling_pid);
-
-        if (! res) {
-                g_warning ("stat on pid %d failed", calling_pid);
-                throw_error (context, CK_SESSION_ERROR_FAILED, _("Unable to lookup information about calling process '%d'"), calling_pid);
-                return TRUE;
-        }
+        ConsoleKitSession *cksession = CONSOLE_KIT_SESSION (session);
+        gboolean           idle_hint;
 
         /* only restrict this by UID for now */
         if (console_kit_session_get_unix_user (cksession) != calling_uid) {
                 throw_error (context, CK_SESSION_ERROR_INSUFFICIENT_PERMISSION, _("Only session owner may set idle hint state"));
-                return TRUE;
+                return;
         }
 
+        g_variant_get (g_dbus_method_invocation_get_parameters (context), "(b)", &idle_hint);
+
         session_set_idle_hint_internal (session, idle_hint);
 
         console_kit_session_complete_set_idle_hint (cksession, context);
+}
+
+static gboolean
+dbus_set_idle_hint (ConsoleKitSession     *cksession,
+                    GDBusMethodInvocation *context,
+                    gboolean               idle_hint)
+{
+        TRACE ();
+
+        g_return_val_if_fail (CK_IS_SESSION (cksession), FALSE);
+
+        with_caller_info (CK_SESSION (cksession), context, set_idle_hint_for_caller);
         return TRUE;
 }
 
@@ -510,45 +554,38 @@ dbus_set_idle_hint (ConsoleKitSession     *cksession,
   /org/freedesktop/ConsoleKit/Session1 \
   org.freedesktop.ConsoleKit.Session.SetLockedHint boolean:TRUE
 */
-static gboolean
-dbus_set_locked_hint (ConsoleKitSession     *cksession,
-                      GDBusMethodInvocation *context,
-                      gboolean               arg_locked_hint)
+static void
+set_locked_hint_for_caller (CkSession             *session,
+                            GDBusMethodInvocation *context,
+                            uid_t                  calling_uid,
+                            pid_t                  calling_pid)
 {
-        const char *sender;
-        uid_t       calling_uid = 0;
-        pid_t       calling_pid = 0;
-        gboolean    res;
-        CkSession *session;
-
-        TRACE ();
-
-        g_return_val_if_fail (CK_IS_SESSION (cksession), FALSE);
-
-        session = CK_SESSION(cksession);
-
-        sender = g_dbus_method_invocation_get_sender (context);
-
-        res = get_caller_info (session,
-                               sender,
-                               &calling_uid,
-                               &calling_pid);
-
-        if (! res) {
-                g_warning ("stat on pid %d failed", calling_pid);
-                throw_error (context, CK_SESSION_ERROR_FAILED, _("Unable to lookup information about calling process '%d'"), calling_pid);
-                return TRUE;
-        }
+        ConsoleKitSession *cksession = CONSOLE_KIT_SESSION (session);
+        gboolean           locked_hint;
 
         /* only restrict this by UID for now */
         if (console_kit_session_get_unix_user (cksession) != calling_uid) {
                 throw_error (context, CK_SESSION_ERROR_INSUFFICIENT_PERMISSION, _("Only session owner may set locked hint state"));
-                return TRUE;
+                return;
         }
 
-        console_kit_session_set_locked_hint (cksession, arg_locked_hint);
+        g_variant_get (g_dbus_method_invocation_get_parameters (context), "(b)", &locked_hint);
+
+        console_kit_session_set_locked_hint (cksession, locked_hint);
 
         console_kit_session_complete_set_idle_hint (cksession, context);
+}
+
+static gboolean
+dbus_set_locked_hint (ConsoleKitSession     *cksession,
+                      GDBusMethodInvocation *context,
+                      gboolean               arg_locked_hint)
+{
+        TRACE ();
+
+        g_return_val_if_fail (CK_IS_SESSION (cksession), FALSE);
+
+        with_caller_info (CK_SESSION (cksession), context, set_locked_hint_for_caller);
         return TRUE;
 }
 
@@ -624,9 +661,90 @@ static void
 ck_session_print_list_size (CkSession *session)
 {
 #if defined(CONSOLEKIT_DEBUGGING)
-        g_debug ("session %s list size is %d",
+        g_debug ("session %s has %u devices, %u active",
+                 session->priv->id,
+                 g_hash_table_size (session->priv->devices),
+                 session->priv->active_devices);
+#endif
+}
+
+static void
+ck_session_set_device_active (CkSession *session,
+                              CkDevice  *device,
+                              gboolean   active)
+{
+        if (ck_device_get_active (device) == active) {
+                return;
+        }
+
+        ck_device_set_active (device, active);
+
+        if (active) {
+                session->priv->active_devices++;
+        } else {
+                session->priv->active_devices--;
+        }
+}
+
+static guint
+ck_session_get_pause_timeout (CkSession *session)
+{
+        gint64 timeout;
+
+        /* Until the controller has answered once it gets the most time */
+        if (session->priv->pause_latency == 0) {
+                return pause_timeout_max;
+        }
+
+        timeout = session->priv->pause_latency * PAUSE_TIMEOUT_FACTOR / 1000;
+
+        return (guint) CLAMP (timeout, (gint64) pause_timeout_min, (gint64) pause_timeout_max);
+}
+
+static void
+ck_session_record_pause (CkSession *session)
+{
+        gint64 latency;
+
+        if (session->priv->pause_start == 0) {
+                return;
+        }
+
+        latency = g_get_monotonic_time () - session->priv->pause_start;
+        session->priv->pause_start = 0;
+
+        if (session->priv->pause_latency == 0) {
+                session->priv->pause_latency = latency;
+        } else {
+                session->priv->pause_latency = (session->priv->pause_latency * 3 + latency) / 4;
+        }
+
+        pause_count++;
+        pause_total_usec += latency;
+        pause_max_usec = MAX (pause_max_usec, latency);
+
+        g_debug ("session controller %s paused the devices of session %s in %" G_GINT64_FORMAT " us, average now %" G_GINT64_FORMAT " us",
+                 session->priv->session_controller,
                  session->priv->id,
-                 g_list_length (session->priv->devices));
+                 latency,
+                 session->priv->pause_latency);
+}
+
+/* Answers a VT release the kernel is waiting on, if there is one */
+static void
+ck_session_release_vt (CkSession *session,
+                       gboolean   release)
+{
+        if (!session->priv->vt_release_pending) {
+                return;
+        }
+
+        session->priv->vt_release_pending = FALSE;
+
+        g_debug ("%s the VT of session %s", release ? "releasing" : "keeping", session->priv->id);
+
+#if defined(VT_RELDISP)
+        ioctl (session->priv->tty_fd, VT_RELDISP, release ? 1 : 0);
 #endif
 }
 
@@ -634,20 +752,18 @@ static void
 ck_session_check_paused_devices (CkSession *session)
 {
         ConsoleKitSession *cksession = CONSOLE_KIT_SESSION (session);
-        GList             *itr;
 
         TRACE ();
 
         ck_session_print_list_size (session);
 
         /* See if we've paused all the devices in the session */
-        for (itr = session->priv->devices; itr != NULL; itr = g_list_next (itr)) {
-                CkDevice *device = CK_DEVICE (itr->data);
-                if (ck_device_get_active (device)) {
-                        return;
-                }
+        if (session->priv->active_devices > 0) {
+                return;
         }
 
+        ck_session_record_pause (session);
+
         /* If we didn't force the state change, do it now */
         if (console_kit_session_get_active (cksession) != FALSE) {
                 g_debug ("marking session %s inactive", session->priv->id);
@@ -661,20 +777,27 @@ ck_session_check_paused_devices (CkSession *session)
                 g_source_remove (session->priv->pause_devices_timer);
                 session->priv->pause_devices_timer = 0;
         }
+
+        ck_session_release_vt (session, TRUE);
 }
 
 static gboolean
 force_pause_devices (CkSession *session)
 {
-        GList *itr;
+        GHashTableIter iter;
+        gpointer       device;
 
         TRACE ();
 
         ck_session_print_list_size (session);
 
-        for (itr = session->priv->devices; itr != NULL; itr = g_list_next (itr))
-        {
-                ck_device_set_active (CK_DEVICE (itr->data), FALSE);
+        g_debug ("session controller %s didn't pause in time, forcing it",
+                 session->priv->session_controller);
+        pause_timeouts++;
+
+        g_hash_table_iter_init (&iter, session->priv->devices);
+        while (g_hash_table_iter_next (&iter, NULL, &device)) {
+                ck_session_set_device_active (session, CK_DEVICE (device), FALSE);
         }
 
         session->priv->pause_devices_timer = 0;
@@ -689,15 +812,21 @@ ck_session_pause_all_devices (CkSession *session,
                               gboolean   force)
 {
         ConsoleKitSession *cksession = CONSOLE_KIT_SESSION (session);
-        GList             *itr;
+        GHashTableIter     iter;
+        gpointer           value;
+        GVariantBuilder    builder;
+        guint              n_paused = 0;
 
         TRACE ();
 
         ck_session_print_list_size (session);
 
-        for (itr = session->priv->devices; itr != NULL; itr = g_list_next (itr))
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uu)"));
+
+        g_hash_table_iter_init (&iter, session->priv->devices);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
         {
-                CkDevice *device = CK_DEVICE (itr->data);
+                CkDevice *device = CK_DEVICE (value);
 
                 if (ck_device_get_active (device) == FALSE) {
                         g_debug ("device already paused");
@@ -705,29 +834,55 @@ ck_session_pause_all_devices (CkSession *session,
                 }
 
                 /* Let the session controller know about the change */
-                g_debug ("emit pause device for %d, %d, type %s",
-                         ck_device_get_major (device),
-                         ck_device_get_minor (device),
-                         force ? "force" : "pause");
-
-                console_kit_session_emit_pause_device (CONSOLE_KIT_SESSION (session),
-                                                       ck_device_get_major (device),
-                                                       ck_device_get_minor (device),
-                                                       force ? "force" : "pause");
+                if (session->priv->batched_devices) {
+                        g_variant_builder_add (&builder, "(uu)",
+                                               ck_device_get_major (device),
+                                               ck_device_get_minor (device));
+                        n_paused++;
+                } else {
+                        g_debug ("emit pause device for %d, %d, type %s",
+                                 ck_device_get_major (device),
+                                 ck_device_get_minor (device),
+                                 force ? "force" : "pause");
+
+                        console_kit_session_emit_pause_device (CONSOLE_KIT_SESSION (session),
+                                                               ck_device_get_major (device),
+                                                               ck_device_get_minor (device),
+                                                               force ? "force" : "pause");
+                }
 
                 if (force) {
-                        ck_device_set_active (device, FALSE);
+                        ck_session_set_device_active (session, device, FALSE);
                 }
         }
 
-        if (force || session->priv->devices == NULL) {
+        if (n_paused > 0) {
+                g_debug ("emit pause devices for %u devices, type %s",
+                         n_paused,
+                         force ? "force" : "pause");
+
+                console_kit_session_emit_pause_devices (CONSOLE_KIT_SESSION (session),
+                                                        g_variant_builder_end (&builder),
+                                                        force ? "force" : "pause");
+        } else {
+                g_variant_builder_clear (&builder);
+        }
+
+        if (force || session->priv->active_devices == 0) {
                 g_debug ("marking session %s inactive", session->priv->id);
 
                 console_kit_session_set_active (cksession, FALSE);
                 console_kit_session_emit_active_changed (cksession, FALSE);
                 console_kit_session_set_session_state (cksession, "online");
+
+                ck_session_release_vt (session, TRUE);
         } else {
-                session->priv->pause_devices_timer = g_timeout_add_seconds (3, (GSourceFunc)force_pause_devices, session);
+                guint timeout = ck_session_get_pause_timeout (session);
+
+                g_debug ("giving the session controller %u ms to pause", timeout);
+
+                session->priv->pause_start = g_get_monotonic_time ();
+                session->priv->pause_devices_timer = g_timeout_add (timeout, (GSourceFunc)force_pause_devices, session);
         }
 }
 
@@ -749,11 +904,45 @@ ck_session_debug_print_dbus_message (CkSession    *session,
 #endif
 }
 
+/* Signals carrying fds only go to the session controller, so we
+ * build the message by hand rather than emit it */
+static void
+ck_session_send_to_controller (CkSession   *session,
+                               const gchar *member,
+                               GVariant    *body,
+                               GUnixFDList *fd_list)
+{
+        GDBusMessage *message;
+
+        message = g_dbus_message_new_signal (session->priv->path,
+                                             DBUS_SESSION_INTERFACE,
+                                             member);
+
+        /* We always send to the session controller */
+        g_dbus_message_set_destination (message, session->priv->session_controller);
+        g_dbus_message_set_body (message, body);
+        g_dbus_message_set_unix_fd_list (message, fd_list);
+
+        ck_session_debug_print_dbus_message (session, message);
+
+        g_dbus_connection_send_message (session->priv->connection,
+                                        message,
+                                        G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                        NULL,
+                                        NULL);
+
+        g_object_unref (message);
+}
+
 static void
 ck_session_resume_all_devices (CkSession *session)
 {
         ConsoleKitSession *cksession = CONSOLE_KIT_SESSION (session);
-        GList             *itr;
+        GHashTableIter     iter;
+        gpointer           value;
+        GVariantBuilder    builder;
+        GUnixFDList       *fd_list = NULL;
+        guint              n_resumed = 0;
         gint               vtnr;
 
         TRACE ();
@@ -797,16 +986,20 @@ ck_session_resume_all_devices (CkSession *session)
 
         ck_session_print_list_size (session);
 
-        for (itr = session->priv->devices; itr != NULL; itr = g_list_next (itr))
+        if (session->priv->batched_devices) {
+                g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uuh)"));
+                fd_list = g_unix_fd_list_new ();
+        }
+
+        g_hash_table_iter_init (&iter, session->priv->devices);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
         {
-                CkDevice     *device = CK_DEVICE (itr->data);
-                GVariant     *body;
-                GDBusMessage *message;
-                GUnixFDList  *out_fd_list = NULL;
+                CkDevice     *device = CK_DEVICE (value);
+                GUnixFDList  *out_fd_list;
                 gint          fd = -1;
-                gint          fd2 = -1;
+                gint          index;
 
-                ck_device_set_active (device, TRUE);
+                ck_session_set_device_active (session, device, TRUE);
 
                 fd = ck_device_get_fd (device);
 
@@ -815,39 +1008,53 @@ ck_session_resume_all_devices (CkSession *session)
                         continue;
                 }
 
-                message = g_dbus_message_new_signal (session->priv->path,
-                                                     DBUS_SESSION_INTERFACE,
-                                                     "ResumeDevice");
-
-                /* We always send to the session controller */
-                g_dbus_message_set_destination (message, session->priv->session_controller);
+                /* we need to copy the fd, because gdbus closes the
+                 * ones in the list on us */
+                out_fd_list = fd_list != NULL ? fd_list : g_unix_fd_list_new ();
+                index = g_unix_fd_list_append (out_fd_list, fd, NULL);
+                if (index < 0) {
+                        g_debug ("Unable to signal ResumeDevice, failed to copy fd");
+                        if (fd_list == NULL) {
+                                g_object_unref (out_fd_list);
+                        }
+                        continue;
+                }
 
-                body = g_variant_new ("(uu@h)",
-                                      ck_device_get_major (device),
-                                      ck_device_get_minor (device),
-                                      g_variant_new_handle (0));
+                if (fd_list != NULL) {
+                        g_variant_builder_add (&builder, "(uuh)",
+                                               ck_device_get_major (device),
+                                               ck_device_get_minor (device),
+                                               index);
+                        n_resumed++;
+                        continue;
+                }
 
-                g_dbus_message_set_body (message, body);
+                g_debug ("sending ResumeDevice signal to session controller");
 
-                /* we need to copy this, because gdbus closes the fd on us */
-                fd2 = dup (fd);
-                out_fd_list = g_unix_fd_list_new_from_array (&fd2, 1);
-                g_dbus_message_set_unix_fd_list (message, out_fd_list);
+                ck_session_send_to_controller (session,
+                                               "ResumeDevice",
+                                               g_variant_new ("(uu@h)",
+                                                              ck_device_get_major (device),
+                                                              ck_device_get_minor (device),
+                                                              g_variant_new_handle (index)),
+                                               out_fd_list);
 
-                g_debug ("sending ResumeDevice signal to session controller");
+                g_object_unref (out_fd_list);
+        }
 
-                ck_session_debug_print_dbus_message (session, message);
+        if (fd_list != NULL) {
+                if (n_resumed > 0) {
+                        g_debug ("sending ResumeDevices signal for %u devices to session controller", n_resumed);
 
-                /* Let only the session controller know about the change and
-                 * give them the new fd. */
-                g_dbus_connection_send_message (session->priv->connection,
-                                                message,
-                                                G_DBUS_SEND_MESSAGE_FLAGS_NONE,
-                                                NULL,
-                                                NULL);
+                        ck_session_send_to_controller (session,
+                                                       "ResumeDevices",
+                                                       g_variant_new ("(@a(uuh))", g_variant_builder_end (&builder)),
+                                                       fd_list);
+                } else {
+                        g_variant_builder_clear (&builder);
+                }
 
-                g_clear_object (&out_fd_list);
-                g_clear_object (&message);
+                g_object_unref (fd_list);
         }
 
         g_debug ("marking session active");
@@ -869,16 +1076,38 @@ ck_session_set_active (CkSession *session,
 
         cksession = CONSOLE_KIT_SESSION (session);
 
+        if (active) {
+                session->priv->vt_release_start = 0;
+        }
+
+        if (active && session->priv->pause_devices_timer != 0) {
+                /* switching away was called off before the pause
+                 * finished, the session is still marked active */
+                g_source_remove (session->priv->pause_devices_timer);
+                session->priv->pause_devices_timer = 0;
+                session->priv->pause_start = 0;
+
+                ck_session_release_vt (session, FALSE);
+                ck_session_resume_all_devices (session);
+                return TRUE;
+        }
+
         if (console_kit_session_get_active (cksession) == active) {
                 /* redundant call, we shouldn't need to do anything */
                 return TRUE;
         }
 
-
         if (session->priv->pause_devices_timer != 0) {
                 g_source_remove (session->priv->pause_devices_timer);
                 session->priv->pause_devices_timer = 0;
         }
+        session->priv->pause_start = 0;
+
+        /* the kernel won't switch until we're done, keep the first
+         * attempt if the pause gets restarted */
+        if (!active && session->priv->sig_watch_s1 != 0 && session->priv->vt_release_start == 0) {
+                session->priv->vt_release_start = g_get_monotonic_time ();
+        }
 
         g_debug ("ck_session_set_active: session %s changing to %s, forced? %s",
                  session->priv->id,
@@ -994,6 +1223,23 @@ const char *ck_session_get_path (CkSession *session)
         return session->priv->path;
 }
 
+/* Adds an (oa{sv}) entry holding the session's path and the current
+ * values of its exported properties to an a(oa{sv}) builder */
+void
+ck_session_add_to_snapshot (CkSession       *session,
+                            GVariantBuilder *builder)
+{
+        GVariant *properties;
+
+        g_return_if_fail (CK_IS_SESSION (session));
+
+        properties = g_variant_ref_sink (g_dbus_interface_skeleton_get_properties (G_DBUS_INTERFACE_SKELETON (session)));
+
+        g_variant_builder_add (builder, "(o@a{sv})", session->priv->path, properties);
+
+        g_variant_unref (properties);
+}
+
 static gboolean
 dbus_get_seat_id (ConsoleKitSession     *cksession,
                   GDBusMethodInvocation *context)
@@ -1288,10 +1534,10 @@ ck_session_set_seat_id (CkSession      *session,
 
         g_return_val_if_fail (CK_IS_SESSION (session), FALSE);
 
-        g_free (session->priv->seat_id);
-        session->priv->seat_id = g_strdup (id);
-        g_free (session->priv->seat_path);
-        session->priv->seat_path = g_strdup (path);
+        ck_string_pool_release (session->priv->seat_id);
+        session->priv->seat_id = ck_string_pool_intern (id);
+        ck_string_pool_release (session->priv->seat_path);
+        session->priv->seat_path = ck_string_pool_intern (path);
 
         if (id != NULL && path != NULL) {
                 seat = g_variant_new ("(so)", id, path);
@@ -1317,8 +1563,8 @@ ck_session_set_runtime_dir (CkSession      *session,
 {
         g_return_val_if_fail (CK_IS_SESSION (session), FALSE);
 
-        g_free (session->priv->runtime_dir);
-        session->priv->runtime_dir = g_strdup (runtime_dir);
+        ck_string_pool_release (session->priv->runtime_dir);
+        session->priv->runtime_dir = ck_string_pool_intern (runtime_dir);
 
         return TRUE;
 }
@@ -1336,6 +1582,34 @@ ck_session_get_runtime_dir (CkSession *session)
         return session->priv->runtime_dir;
 }
 
+/**
+ * ck_session_get_holds_vt:
+ * @session: a #CkSession
+ *
+ * Return value: TRUE when the kernel waits for @session to release its
+ * VT before switching away from it.
+ **/
+gboolean
+ck_session_get_holds_vt (CkSession *session)
+{
+        g_return_val_if_fail (CK_IS_SESSION (session), FALSE);
+        return session->priv->sig_watch_s1 != 0;
+}
+
+/**
+ * ck_session_get_vt_release_start:
+ * @session: a #CkSession
+ *
+ * Return value: the monotonic time @session started pausing its devices
+ * to give up the VT it holds, or 0 when it isn't doing so.
+ **/
+gint64
+ck_session_get_vt_release_start (CkSession *session)
+{
+        g_return_val_if_fail (CK_IS_SESSION (session), 0);
+        return session->priv->vt_release_start;
+}
+
 static gboolean
 dbus_get_runtime_dir (ConsoleKitSession     *cksession,
                       GDBusMethodInvocation *context)
@@ -1439,15 +1713,21 @@ vt_leave_handler (gpointer data)
         /* g_unix_signal_add_full returns this callback in the GMainContext
          * so we don't have the limitations of POSIX signal handlers */
 
-        /* Forcably disable all devices, we have to do this
-         * now or we'll crash Xorg if it's running as root on
-         * the new VT */
-        ck_session_pause_all_devices (session, TRUE);
+        /* The kernel doesn't switch until we release the VT, so the
+         * controller can pause its devices itself. They must all be
+         * paused before the release or we'll crash Xorg if it's
+         * running as root on the new VT, the pause timer forces them
+         * if the controller takes too long. */
+        session->priv->vt_release_pending = TRUE;
 
-        /* release control */
-#if defined(VT_RELDISP)
-        ioctl (session->priv->tty_fd, VT_RELDISP, 1);
-#endif
+        if (session->priv->pause_devices_timer == 0) {
+                ck_session_set_active (session, FALSE, FALSE);
+        }
+
+        /* nothing to wait for */
+        if (session->priv->pause_devices_timer == 0) {
+                ck_session_release_vt (session, TRUE);
+        }
 
         return TRUE;
 }
@@ -1587,6 +1867,14 @@ ck_session_controller_cleanup (CkSession *session)
         }
 
         ck_session_remove_all_devices (session);
+        session->priv->batched_devices = FALSE;
+
+        /* nobody is left to pause anything */
+        ck_session_release_vt (session, TRUE);
+
+        /* the pause latency belongs to the controller */
+        session->priv->pause_start = 0;
+        session->priv->pause_latency = 0;
 
 #if defined(VT_SETMODE)
         /* Remove the old signal call backs, restore VT switching to auto
@@ -1689,28 +1977,17 @@ dbus_can_control_session (ConsoleKitSession *object,
         return TRUE;
 }
 
-static gboolean
-dbus_take_control (ConsoleKitSession *object,
-                   GDBusMethodInvocation *invocation,
-                   gboolean arg_force)
+static void
+take_control_for_caller (CkSession             *session,
+                         GDBusMethodInvocation *invocation,
+                         uid_t                  uid,
+                         pid_t                  pid)
 {
-        CkSession   *session = CK_SESSION (object);
-        uid_t        uid = 0;
-        pid_t        pid = 0;
-        const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
-
-        TRACE ();
+        ConsoleKitSession *object = CONSOLE_KIT_SESSION (session);
+        const gchar       *sender = g_dbus_method_invocation_get_sender (invocation);
+        gboolean           arg_force;
 
-        if (!ck_device_is_server_managed ()) {
-                throw_error (invocation, CK_SESSION_ERROR_NOT_SUPPORTED, _("Server managed devices not supported"));
-                return TRUE;
-        }
-
-        if (!get_caller_info (session, sender, &uid, &pid))
-        {
-                throw_error (invocation, CK_SESSION_ERROR_GENERAL, _("Failed to get uid of dbus caller"));
-                return TRUE;
-        }
+        g_variant_get (g_dbus_method_invocation_get_parameters (invocation), "(b)", &arg_force);
 
         if (g_strcmp0 (session->priv->session_controller, sender) == 0)
         {
@@ -1729,10 +2006,25 @@ dbus_take_control (ConsoleKitSession *object,
                 } else {
                         throw_error (invocation, CK_SESSION_ERROR_FAILED, _("Session controller already present"));
                 }
-                return TRUE;
+                return;
         }
 
         console_kit_session_complete_take_control (object, invocation);
+}
+
+static gboolean
+dbus_take_control (ConsoleKitSession *object,
+                   GDBusMethodInvocation *invocation,
+                   gboolean arg_force)
+{
+        TRACE ();
+
+        if (!ck_device_is_server_managed ()) {
+                throw_error (invocation, CK_SESSION_ERROR_NOT_SUPPORTED, _("Server managed devices not supported"));
+                return TRUE;
+        }
+
+        with_caller_info (CK_SESSION (object), invocation, take_control_for_caller);
         return TRUE;
 }
 
@@ -1757,35 +2049,63 @@ dbus_release_control (ConsoleKitSession *object,
         return TRUE;
 }
 
+static gint64
+device_devnum (guint major,
+               guint minor)
+{
+        /* dev_t isn't the same size everywhere, so pack our own key */
+        return ((gint64) major << 32) | minor;
+}
+
 static CkDevice*
 ck_session_get_device (CkSession *session,
                        guint major,
                        guint minor)
 {
-        GList *iter;
+        gint64 devnum = device_devnum (major, minor);
 
         TRACE ();
 
-        ck_session_print_list_size (session);
+        return g_hash_table_lookup (session->priv->devices, &devnum);
+}
 
-        for (iter = session->priv->devices; iter != NULL; iter = g_list_next (iter)) {
-                if (ck_device_compare (iter->data, major, minor)) {
-                        g_debug ("found device");
-                        CkDevice *device = CK_DEVICE (iter->data);
-                        if (ck_device_get_category(device) == DEVICE_EVDEV) {
-                                struct stat st;
-                                if (fstat(ck_device_get_fd(device), &st) == -1 && errno == EBADF) {
-                                        g_debug ("but it was a dead input device, removing");
-                                        session->priv->devices = g_list_remove (session->priv->devices, device);
-                                        return NULL;
-                                }
-                        }
-                        return iter->data;
-                }
+static void
+ck_session_remove_device (CkSession *session,
+                          CkDevice  *device)
+{
+        gint64 devnum;
+
+        TRACE ();
+
+        devnum = device_devnum (ck_device_get_major (device),
+                                ck_device_get_minor (device));
+
+        g_signal_handlers_disconnect_by_data (device, session);
+
+        if (ck_device_get_active (device)) {
+                session->priv->active_devices--;
         }
 
-        g_debug ("failed to find deivce");
-        return NULL;
+        /* drops our ref on the device */
+        g_hash_table_remove (session->priv->devices, &devnum);
+        ck_session_print_list_size (session);
+}
+
+static void
+on_device_removed (CkDevice  *device,
+                   CkSession *session)
+{
+        g_debug ("device %d, %d went away, dropping it from session %s",
+                 ck_device_get_major (device),
+                 ck_device_get_minor (device),
+                 session->priv->id);
+
+        ck_session_remove_device (session, device);
+
+        /* A pause may have been waiting on the device */
+        if (session->priv->pause_devices_timer != 0) {
+                ck_session_check_paused_devices (session);
+        }
 }
 
 static CkDevice*
@@ -1804,8 +2124,17 @@ ck_session_create_device (CkSession *session,
                                         console_kit_session_get_active (CONSOLE_KIT_SESSION (session)));
 
                 if (device != NULL && CK_IS_DEVICE (device)) {
-                        g_debug ("adding device to the list");
-                        session->priv->devices = g_list_prepend (session->priv->devices, device);
+                        gint64 *devnum = g_new (gint64, 1);
+
+                        g_debug ("adding device to the table");
+                        *devnum = device_devnum (major, minor);
+                        g_hash_table_insert (session->priv->devices, devnum, device);
+
+                        if (ck_device_get_active (device)) {
+                                session->priv->active_devices++;
+                        }
+
+                        g_signal_connect (device, "removed", G_CALLBACK (on_device_removed), session);
                         ck_session_print_list_size (session);
                 }
         }
@@ -1814,23 +2143,62 @@ ck_session_create_device (CkSession *session,
 }
 
 static void
-ck_session_remove_device (CkSession *session,
-                          CkDevice  *device)
+ck_session_remove_all_devices (CkSession *session)
 {
+        GHashTableIter iter;
+        gpointer       device;
+
         TRACE ();
         ck_session_print_list_size (session);
-        session->priv->devices = g_list_remove (session->priv->devices, device);
-        ck_session_print_list_size (session);
+
+        g_hash_table_iter_init (&iter, session->priv->devices);
+        while (g_hash_table_iter_next (&iter, NULL, &device)) {
+                g_signal_handlers_disconnect_by_data (device, session);
+        }
+
+        g_hash_table_remove_all (session->priv->devices);
+        session->priv->active_devices = 0;
+        g_debug ("table size is now 0");
 }
 
-static void
-ck_session_remove_all_devices (CkSession *session)
+/* Takes the device for the session controller. On failure the error
+ * has already been returned on @invocation and NULL is returned. */
+static CkDevice*
+ck_session_take_device (CkSession             *session,
+                        GDBusMethodInvocation *invocation,
+                        guint                  major,
+                        guint                  minor)
 {
-        TRACE ();
-        ck_session_print_list_size (session);
-        g_list_free_full (session->priv->devices, g_object_unref);
-        session->priv->devices = NULL;
-        g_debug ("list size is now 0");
+        CkDevice *device = ck_session_get_device (session, major, minor);
+
+        /* an unplugged input device may come back with the same
+         * numbers, so don't hold the old one against the caller */
+        if (device != NULL && ck_device_get_removed (device)) {
+                g_debug ("replacing a removed device");
+                ck_session_remove_device (session, device);
+                device = NULL;
+        }
+
+        /* you can't request the device again, that's confusing */
+        if (device != NULL) {
+                throw_error (invocation, CK_SESSION_ERROR_GENERAL, _("Device has already been requested"));
+                return NULL;
+        }
+
+        device = ck_session_create_device (session, major, minor);
+
+        if (device == NULL) {
+                throw_error (invocation, CK_SESSION_ERROR_NOT_SUPPORTED, _("Failed to create device"));
+                return NULL;
+        }
+
+        if (ck_device_get_fd (device) == -1) {
+                ck_session_remove_device (session, device);
+                throw_error (invocation, CK_SESSION_ERROR_NOT_SUPPORTED, _("Failed to get file descriptor for device"));
+                return NULL;
+        }
+
+        return device;
 }
 
 static gboolean
@@ -1843,7 +2211,6 @@ dbus_take_device (ConsoleKitSession *object,
         CkSession   *session = CK_SESSION (object);
         CkDevice    *device;
         const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
-        gint         fd = -1;
         GUnixFDList *out_fd_list = NULL;
 
 
@@ -1855,31 +2222,101 @@ dbus_take_device (ConsoleKitSession *object,
                 return TRUE;
         }
 
-        /* you can't request the device again, that's confusing */
-        if (ck_session_get_device (session, arg_major, arg_minor)) {
-                throw_error (invocation, CK_SESSION_ERROR_GENERAL, _("Device has already been requested"));
+        device = ck_session_take_device (session, invocation, arg_major, arg_minor);
+        if (device == NULL) {
                 return TRUE;
         }
 
-        device = ck_session_create_device (session, arg_major, arg_minor);
+        /* the list gets a copy of the fd, the device keeps its own */
+        out_fd_list = g_unix_fd_list_new ();
+        g_unix_fd_list_append (out_fd_list, ck_device_get_fd (device), NULL);
 
-        if (device == NULL) {
-                throw_error (invocation, CK_SESSION_ERROR_NOT_SUPPORTED, _("Failed to create device"));
-                return TRUE;
+        console_kit_session_complete_take_device (object, invocation,
+                                                  out_fd_list, g_variant_new_handle (0),
+                                                  console_kit_session_get_active (object));
+        g_object_unref (out_fd_list);
+        return TRUE;
+}
+
+static void
+ck_session_give_back_devices (CkSession *session,
+                              GPtrArray *taken)
+{
+        guint i;
+
+        for (i = 0; i < taken->len; i++) {
+                ck_session_remove_device (session, g_ptr_array_index (taken, i));
         }
 
-        fd = ck_device_get_fd (device);
+        g_ptr_array_free (taken, TRUE);
+}
 
-        if (fd == -1) {
-                throw_error (invocation, CK_SESSION_ERROR_NOT_SUPPORTED, _("Failed to get file descriptor for device"));
+static gboolean
+dbus_take_devices (ConsoleKitSession *object,
+                   GDBusMethodInvocation *invocation,
+                   GUnixFDList *fd_list,
+                   GVariant *arg_devices)
+{
+        CkSession      *session = CK_SESSION (object);
+        const gchar    *sender = g_dbus_method_invocation_get_sender (invocation);
+        GUnixFDList    *out_fd_list = NULL;
+        GPtrArray      *taken;
+        GVariantBuilder builder;
+        GVariantIter    iter;
+        guint           major;
+        guint           minor;
+        guint           i;
+
+        TRACE ();
+
+        /* only the session controller can call us */
+        if (g_strcmp0 (session->priv->session_controller, sender) != 0) {
+                throw_error (invocation, CK_SESSION_ERROR_FAILED, _("Only the session controller may call this function"));
                 return TRUE;
         }
 
-        out_fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+        taken = g_ptr_array_new ();
 
-        console_kit_session_complete_take_device (object, invocation,
-                                                  out_fd_list, g_variant_new_handle (0),
-                                                  console_kit_session_get_active (object));
+        g_variant_iter_init (&iter, arg_devices);
+        while (g_variant_iter_next (&iter, "(uu)", &major, &minor)) {
+                CkDevice *device = ck_session_take_device (session, invocation, major, minor);
+
+                if (device == NULL) {
+                        /* all or nothing, give back what we took so far */
+                        ck_session_give_back_devices (session, taken);
+                        return TRUE;
+                }
+
+                g_ptr_array_add (taken, device);
+        }
+
+        out_fd_list = g_unix_fd_list_new ();
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("ah"));
+
+        for (i = 0; i < taken->len; i++) {
+                gint index = g_unix_fd_list_append (out_fd_list,
+                                                    ck_device_get_fd (g_ptr_array_index (taken, i)),
+                                                    NULL);
+                if (index < 0) {
+                        ck_session_give_back_devices (session, taken);
+                        g_variant_builder_clear (&builder);
+                        g_object_unref (out_fd_list);
+                        throw_error (invocation, CK_SESSION_ERROR_GENERAL, _("Failed to get file descriptor for device"));
+                        return TRUE;
+                }
+
+                g_variant_builder_add (&builder, "h", index);
+        }
+
+        g_ptr_array_free (taken, TRUE);
+
+        /* from now on pause and resume are batched for this controller */
+        session->priv->batched_devices = TRUE;
+
+        console_kit_session_complete_take_devices (object, invocation,
+                                                   out_fd_list, g_variant_builder_end (&builder),
+                                                   console_kit_session_get_active (object));
+        g_object_unref (out_fd_list);
         return TRUE;
 }
 
@@ -1910,7 +2347,6 @@ dbus_release_device (ConsoleKitSession *object,
         }
 
         ck_session_remove_device (session, device);
-        g_object_unref (device);
 
         console_kit_session_complete_release_device (object, invocation);
         return TRUE;
@@ -1941,7 +2377,7 @@ dbus_pause_device_complete (ConsoleKitSession *object,
                 return TRUE;
         }
 
-        ck_device_set_active (device, FALSE);
+        ck_session_set_device_active (session, device, FALSE);
 
         ck_session_check_paused_devices (session);
 
@@ -1949,6 +2385,16 @@ dbus_pause_device_complete (ConsoleKitSession *object,
         return TRUE;
 }
 
+static void
+set_pooled_string (const char **field,
+                   const char  *value)
+{
+        const char *old = *field;
+
+        *field = ck_string_pool_intern (value);
+        ck_string_pool_release (old);
+}
+
 static void
 ck_session_set_property (GObject            *object,
                          guint               prop_id,
@@ -1972,6 +2418,21 @@ ck_session_set_property (GObject            *object,
         case PROP_SESSION_CONTROLLER:
                 ck_session_set_session_controller (self, g_value_get_string (value));
                 break;
+        case PROP_SESSION_TYPE:
+                set_pooled_string (&self->priv->session_type, g_value_get_string (value));
+                break;
+        case PROP_SESSION_CLASS:
+                set_pooled_string (&self->priv->session_class, g_value_get_string (value));
+                break;
+        case PROP_SESSION_SERVICE:
+                set_pooled_string (&self->priv->session_service, g_value_get_string (value));
+                break;
+        case PROP_DISPLAY_DEVICE:
+                set_pooled_string (&self->priv->display_device, g_value_get_string (value));
+                break;
+        case PROP_REMOTE_HOST_NAME:
+                set_pooled_string (&self->priv->remote_host_name, g_value_get_string (value));
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
                 break;
@@ -2001,6 +2462,21 @@ ck_session_get_property (GObject    *object,
         case PROP_SESSION_CONTROLLER:
                 g_value_set_string (value, self->priv->session_controller);
                 break;
+        case PROP_SESSION_TYPE:
+                g_value_set_string (value, self->priv->session_type);
+                break;
+        case PROP_SESSION_CLASS:
+                g_value_set_string (value, self->priv->session_class);
+                break;
+        case PROP_SESSION_SERVICE:
+                g_value_set_string (value, self->priv->session_service);
+                break;
+        case PROP_DISPLAY_DEVICE:
+                g_value_set_string (value, self->priv->display_device);
+                break;
+        case PROP_REMOTE_HOST_NAME:
+                g_value_set_string (value, self->priv->remote_host_name);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
                 break;
@@ -2137,6 +2613,14 @@ ck_session_class_init (CkSessionClass *klass)
                                                               NULL,
                                                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 
+        /* Keep these exported properties in the string pool, see
+         * ck_session_iface_init for the matching getters */
+        g_object_class_override_property (object_class, PROP_SESSION_TYPE, "session-type");
+        g_object_class_override_property (object_class, PROP_SESSION_CLASS, "session-class");
+        g_object_class_override_property (object_class, PROP_SESSION_SERVICE, "session-service");
+        g_object_class_override_property (object_class, PROP_DISPLAY_DEVICE, "display-device");
+        g_object_class_override_property (object_class, PROP_REMOTE_HOST_NAME, "remote-host-name");
+
         g_type_class_add_private (klass, sizeof (CkSessionPrivate));
 }
 
@@ -2149,11 +2633,52 @@ ck_session_init (CkSession *session)
         g_get_current_time (&session->priv->creation_time);
 
         session->priv->tty_fd = -1;
+
+        session->priv->devices = g_hash_table_new_full (g_int64_hash,
+                                                        g_int64_equal,
+                                                        g_free,
+                                                        g_object_unref);
+}
+
+static const gchar *
+ck_session_iface_get_session_type (ConsoleKitSession *cksession)
+{
+        return CK_SESSION (cksession)->priv->session_type;
+}
+
+static const gchar *
+ck_session_iface_get_session_class (ConsoleKitSession *cksession)
+{
+        return CK_SESSION (cksession)->priv->session_class;
+}
+
+static const gchar *
+ck_session_iface_get_session_service (ConsoleKitSession *cksession)
+{
+        return CK_SESSION (cksession)->priv->session_service;
+}
+
+static const gchar *
+ck_session_iface_get_display_device (ConsoleKitSession *cksession)
+{
+        return CK_SESSION (cksession)->priv->display_device;
+}
+
+static const gchar *
+ck_session_iface_get_remote_host_name (ConsoleKitSession *cksession)
+{
+        return CK_SESSION (cksession)->priv->remote_host_name;
 }
 
 static void
 ck_session_iface_init (ConsoleKitSessionIface *iface)
 {
+        iface->get_session_type              = ck_session_iface_get_session_type;
+        iface->get_session_class             = ck_session_iface_get_session_class;
+        iface->get_session_service           = ck_session_iface_get_session_service;
+        iface->get_display_device            = ck_session_iface_get_display_device;
+        iface->get_remote_host_name          = ck_session_iface_get_remote_host_name;
+
         iface->handle_activate               = dbus_activate;
         iface->handle_set_idle_hint          = dbus_set_idle_hint;
         iface->handle_set_locked_hint        = dbus_set_locked_hint;
@@ -2183,6 +2708,7 @@ ck_session_iface_init (ConsoleKitSessionIface *iface)
         iface->handle_take_control           = dbus_take_control;
         iface->handle_release_control        = dbus_release_control;
         iface->handle_take_device            = dbus_take_device;
+        iface->handle_take_devices           = dbus_take_devices;
         iface->handle_release_device         = dbus_release_device;
         iface->handle_pause_device_complete  = dbus_pause_device_complete;
 }
@@ -2206,20 +2732,22 @@ ck_session_finalize (GObject *object)
         ck_session_set_session_controller (session, NULL);
 
         ck_session_remove_all_devices (session);
+        g_hash_table_destroy (session->priv->devices);
 
         g_free (session->priv->id);
         g_free (session->priv->path);
         g_free (session->priv->cookie);
         g_free (session->priv->login_session_id);
-        g_free (session->priv->runtime_dir);
-        g_free (session->priv->seat_id);
-        g_free (session->priv->seat_path);
+        ck_string_pool_release (session->priv->runtime_dir);
+        ck_string_pool_release (session->priv->seat_id);
+        ck_string_pool_release (session->priv->seat_path);
+        ck_string_pool_release (session->priv->session_type);
+        ck_string_pool_release (session->priv->session_class);
+        ck_string_pool_release (session->priv->session_service);
+        ck_string_pool_release (session->priv->display_device);
+        ck_string_pool_release (session->priv->remote_host_name);
         g_free (session->priv->session_controller);
 
-        if (session->priv->bus_proxy) {
-            g_object_unref(session->priv->bus_proxy);
-        }
-
         if (session->priv->session_controller_watchid != 0) {
                 g_bus_unwatch_name (session->priv->session_controller_watchid);
         }
@@ -2364,6 +2892,98 @@ cleanup:
         return CK_SESSION (object);
 }
 
+static void
+add_key_file_string (GVariantBuilder *builder,
+                     GKeyFile        *key_file,
+                     const char      *group_name,
+                     const char      *key,
+                     const char      *prop_name)
+{
+        char *value;
+
+        value = g_key_file_get_string (key_file, group_name, key, NULL);
+        if (value != NULL && value[0] != '\0') {
+                g_variant_builder_add (builder, "{sv}", prop_name, g_variant_new_string (value));
+        }
+        g_free (value);
+}
+
+/**
+ * ck_session_new_from_key_file:
+ * @ssid: The session id
+ * @cookie: The session cookie
+ * @key_file: A state database written by ck_session_dump
+ * @connection: The bus connection to register on
+ *
+ * Recreates a session from its "Session @ssid" group, including the
+ * runtime dir and creation time, so that a restarted daemon can pick
+ * up where the previous one left off.
+ *
+ * Returns: The new session, or NULL if the group is missing.
+ **/
+CkSession *
+ck_session_new_from_key_file (const char      *ssid,
+                              const char      *cookie,
+                              GKeyFile        *key_file,
+                              GDBusConnection *connection)
+{
+        CkSession       *session;
+        GVariantBuilder  parameters;
+        char            *group_name;
+        char            *runtime_dir;
+        char            *creation_time;
+        GError          *error = NULL;
+        gint             uid;
+
+        group_name = g_strdup_printf ("Session %s", ssid);
+
+        uid = g_key_file_get_integer (key_file, group_name, "uid", &error);
+        if (error != NULL) {
+                g_debug ("Unable to restore %s: %s", ssid, error->message);
+                g_error_free (error);
+                g_free (group_name);
+                return NULL;
+        }
+
+        g_variant_builder_init (&parameters, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (&parameters, "{sv}", "unix-user", g_variant_new_uint32 (uid));
+        g_variant_builder_add (&parameters, "{sv}", "vtnr",
+                               g_variant_new_uint32 (g_key_file_get_integer (key_file, group_name, "vtnr", NULL)));
+        add_key_file_string (&parameters, key_file, group_name, "service", "session-service");
+        add_key_file_string (&parameters, key_file, group_name, "type", "session-type");
+        add_key_file_string (&parameters, key_file, group_name, "class", "session-class");
+        add_key_file_string (&parameters, key_file, group_name, "login_session_id", "login-session-id");
+        add_key_file_string (&parameters, key_file, group_name, "display_device", "display-device");
+        add_key_file_string (&parameters, key_file, group_name, "x11_display_device", "x11-display-device");
+        add_key_file_string (&parameters, key_file, group_name, "x11_display", "x11-display");
+        add_key_file_string (&parameters, key_file, group_name, "remote_host_name", "remote-host-name");
+
+        session = ck_session_new_with_parameters (ssid,
+                                                  cookie,
+                                                  g_variant_builder_end (&parameters),
+                                                  connection);
+        if (session == NULL) {
+                g_free (group_name);
+                return NULL;
+        }
+
+        runtime_dir = g_key_file_get_string (key_file, group_name, "XDG_RUNTIME_DIR", NULL);
+        if (runtime_dir != NULL && runtime_dir[0] != '\0') {
+                ck_session_set_runtime_dir (session, runtime_dir);
+        }
+        g_free (runtime_dir);
+
+        creation_time = g_key_file_get_string (key_file, group_name, "creation_time", NULL);
+        if (creation_time != NULL) {
+                g_time_val_from_iso8601 (creation_time, &session->priv->creation_time);
+        }
+        g_free (creation_time);
+
+        g_free (group_name);
+
+        return session;
+}
+
 void
 ck_session_run_programs (CkSession  *session,
                          const char *action)
@@ -2476,6 +3096,14 @@ ck_session_dump (CkSession *session,
                                "remote_host_name",
                                NONULL_STRING (console_kit_session_get_remote_host_name (cksession)));
 
+        if (console_kit_session_get_session_class (cksession) != NULL) {
+                g_key_file_set_string (key_file,
+                                       group_name,
+                                       "class",
+                                       NONULL_STRING (console_kit_session_get_session_class (cksession)));
+        }
+        g_key_file_set_integer (key_file, group_name, "vtnr", console_kit_session_get_vtnr (cksession));
+
         g_key_file_set_boolean (key_file, group_name, "is_active", console_kit_session_get_active (cksession));
         g_key_file_set_boolean (key_file, group_name, "is_local", console_kit_session_get_is_local (cksession));
         g_key_file_set_string  (key_file, group_name, "XDG_RUNTIME_DIR", NONULL_STRING (session->priv->runtime_dir));
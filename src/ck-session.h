@@ -63,6 +63,11 @@ typedef enum
 
 #define CK_SESSION_ERROR ck_session_error_quark ()
 
+/* Bounds in milliseconds on how long a session controller gets to
+ * acknowledge a PauseDevice before the devices are paused by force */
+#define CK_SESSION_DEFAULT_PAUSE_TIMEOUT_MIN 250
+#define CK_SESSION_DEFAULT_PAUSE_TIMEOUT_MAX 3000
+
 
 GQuark              ck_session_error_quark            (void);
 GType               ck_session_error_get_type         (void);
@@ -75,6 +80,10 @@ CkSession         * ck_session_new_with_parameters    (const char            *ss
                                                        const char            *cookie,
                                                        const GVariant        *parameters,
                                                        GDBusConnection       *connection);
+CkSession         * ck_session_new_from_key_file      (const char            *ssid,
+                                                       const char            *cookie,
+                                                       GKeyFile              *key_file,
+                                                       GDBusConnection       *connection);
 
 void                ck_session_dump                   (CkSession             *session,
                                                        GKeyFile              *key_file);
@@ -113,6 +122,8 @@ gboolean            ck_session_get_id                 (CkSession             *se
                                                        char                 **ssid,
                                                        GError               **error);
 const char        * ck_session_get_path               (CkSession             *session);
+void                ck_session_add_to_snapshot        (CkSession             *session,
+                                                       GVariantBuilder       *builder);
 gboolean            ck_session_get_seat_id            (CkSession             *session,
                                                        char                 **sid,
                                                        GError               **error);
@@ -129,6 +140,8 @@ gboolean            ck_session_get_creation_time      (CkSession             *se
                                                        char                 **iso8601_datetime,
                                                        GError               **error);
 const char        * ck_session_get_runtime_dir        (CkSession             *session);
+gboolean            ck_session_get_holds_vt           (CkSession             *session);
+gint64              ck_session_get_vt_release_start   (CkSession             *session);
 
 
 gboolean            ck_session_set_runtime_dir        (CkSession             *session,
@@ -151,6 +164,13 @@ gboolean            ck_session_set_login_session_id   (CkSession             *se
 void                ck_session_lock                   (CkSession             *session);
 void                ck_session_unlock                 (CkSession             *session);
 
+void                ck_session_set_pause_timeout      (guint                  min_msec,
+                                                       guint                  max_msec);
+void                ck_session_get_pause_stats        (guint                 *pauses,
+                                                       guint                 *timeouts,
+                                                       gint64                *avg_usec,
+                                                       gint64                *max_usec);
+
 G_END_DECLS
 
 #endif /* __CK_SESSION_H */
@@ -0,0 +1,507 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Keeps per-method call counts and latencies for everything ConsoleKit
+ * answers. Calls are timed on the wire: a connection filter notes when
+ * each method call arrives and matches it against the reply or error
+ * going out, so it sees the calls answered by the handlers on the main
+ * loop and the ones the query server answers from the worker thread
+ * alike, and includes any time a call spent waiting on the main loop.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "ck-statistics.h"
+
+#define CK_STATISTICS_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CK_TYPE_STATISTICS, CkStatisticsPrivate))
+
+/* Bucket n counts calls that took less than 2^n usec, the last one
+ * everything slower.
+ */
+#define N_BUCKETS 32
+
+/* Calls that never get a reply (the caller going away doesn't stop
+ * us from sending one, but a handler could leak its invocation) must
+ * not grow the pending table forever.
+ */
+#define MAX_PENDING_CALLS 4096
+
+typedef struct
+{
+        guint   calls;
+        guint   errors;
+        guint64 max_usec;
+        guint   buckets[N_BUCKETS];
+} MethodStats;
+
+typedef struct
+{
+        char   *method;
+        gint64  start;
+} PendingCall;
+
+/* Shared with statistics_filter, which keeps a reference of its own:
+ * the filter may run once more after finalize removed it.
+ */
+typedef struct
+{
+        gint                     ref_count;
+
+        /* protects pending, methods and untracked, which are updated
+         * from the GDBus worker thread */
+        GMutex                   lock;
+        GHashTable              *pending;
+        GHashTable              *methods;
+        guint                    untracked;
+} FilterData;
+
+struct CkStatisticsPrivate
+{
+        GDBusConnection         *connection;
+        guint                    filter_id;
+        FilterData              *data;
+
+        CkStatisticsCountersFunc counters_func;
+        gpointer                 counters_data;
+};
+
+static void     ck_statistics_iface_init  (ConsoleKitStatisticsIface *iface);
+static void     ck_statistics_finalize    (GObject                   *object);
+
+G_DEFINE_TYPE_WITH_CODE (CkStatistics, ck_statistics, CONSOLE_KIT_TYPE_STATISTICS_SKELETON, G_IMPLEMENT_INTERFACE (CONSOLE_KIT_TYPE_STATISTICS, ck_statistics_iface_init));
+
+static void
+pending_call_free (PendingCall *call)
+{
+        g_free (call->method);
+        g_free (call);
+}
+
+static FilterData *
+filter_data_new (void)
+{
+        FilterData *data;
+
+        data = g_new0 (FilterData, 1);
+        data->ref_count = 1;
+        g_mutex_init (&data->lock);
+        data->pending = g_hash_table_new_full (g_str_hash,
+                                               g_str_equal,
+                                               g_free,
+                                               (GDestroyNotify) pending_call_free);
+        data->methods = g_hash_table_new_full (g_str_hash,
+                                               g_str_equal,
+                                               g_free,
+                                               g_free);
+
+        return data;
+}
+
+static FilterData *
+filter_data_ref (FilterData *data)
+{
+        g_atomic_int_inc (&data->ref_count);
+        return data;
+}
+
+static void
+filter_data_unref (FilterData *data)
+{
+        if (!g_atomic_int_dec_and_test (&data->ref_count)) {
+                return;
+        }
+
+        g_hash_table_destroy (data->pending);
+        g_hash_table_destroy (data->methods);
+        g_mutex_clear (&data->lock);
+        g_free (data);
+}
+
+static char *
+pending_call_key (const char *peer,
+                  guint32     serial)
+{
+        return g_strdup_printf ("%s %u", peer != NULL ? peer : "", serial);
+}
+
+static guint
+bucket_for_usec (guint64 usec)
+{
+        guint bucket;
+
+        bucket = 0;
+        while (usec > 0 && bucket < N_BUCKETS - 1) {
+                usec >>= 1;
+                bucket++;
+        }
+
+        return bucket;
+}
+
+static void
+record_call (FilterData   *data,
+             GDBusMessage *message)
+{
+        PendingCall *call;
+
+        if (g_dbus_message_get_flags (message) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED) {
+                return;
+        }
+
+        g_mutex_lock (&data->lock);
+
+        if (g_hash_table_size (data->pending) >= MAX_PENDING_CALLS) {
+                data->untracked++;
+                g_mutex_unlock (&data->lock);
+                return;
+        }
+
+        call = g_new0 (PendingCall, 1);
+        call->method = g_strdup_printf ("%s.%s",
+                                        g_dbus_message_get_interface (message) != NULL ? g_dbus_message_get_interface (message) : "",
+                                        g_dbus_message_get_member (message));
+        call->start = g_get_monotonic_time ();
+
+        g_hash_table_replace (data->pending,
+                              pending_call_key (g_dbus_message_get_sender (message),
+                                                g_dbus_message_get_serial (message)),
+                              call);
+
+        g_mutex_unlock (&data->lock);
+}
+
+static void
+record_reply (FilterData   *data,
+              GDBusMessage *message,
+              gboolean      is_error)
+{
+        PendingCall *call;
+        MethodStats *stats;
+        char        *key;
+        guint64      usec;
+
+        key = pending_call_key (g_dbus_message_get_destination (message),
+                                g_dbus_message_get_reply_serial (message));
+
+        g_mutex_lock (&data->lock);
+
+        call = g_hash_table_lookup (data->pending, key);
+        if (call == NULL) {
+                /* a reply to a call we made, or one we weren't tracking */
+                goto out;
+        }
+
+        usec = (guint64) MAX (g_get_monotonic_time () - call->start, 0);
+
+        stats = g_hash_table_lookup (data->methods, call->method);
+        if (stats == NULL) {
+                stats = g_new0 (MethodStats, 1);
+                g_hash_table_insert (data->methods, g_strdup (call->method), stats);
+        }
+
+        stats->calls++;
+        if (is_error) {
+                stats->errors++;
+        }
+        stats->max_usec = MAX (stats->max_usec, usec);
+        stats->buckets[bucket_for_usec (usec)]++;
+
+        g_hash_table_remove (data->pending, key);
+ out:
+        g_mutex_unlock (&data->lock);
+        g_free (key);
+}
+
+/* Runs on the GDBus worker thread for every message, keep it cheap */
+static GDBusMessage *
+statistics_filter (GDBusConnection *connection,
+                   GDBusMessage    *message,
+                   gboolean         incoming,
+                   gpointer         user_data)
+{
+        FilterData *data = user_data;
+
+        switch (g_dbus_message_get_message_type (message)) {
+        case G_DBUS_MESSAGE_TYPE_METHOD_CALL:
+                if (incoming) {
+                        record_call (data, message);
+                }
+                break;
+        case G_DBUS_MESSAGE_TYPE_METHOD_RETURN:
+                if (!incoming) {
+                        record_reply (data, message, FALSE);
+                }
+                break;
+        case G_DBUS_MESSAGE_TYPE_ERROR:
+                if (!incoming) {
+                        record_reply (data, message, TRUE);
+                }
+                break;
+        default:
+                break;
+        }
+
+        return message;
+}
+
+/* Returns the upper bound of the bucket holding the @percent-th
+ * percentile, capped by the slowest call actually seen.
+ */
+static guint64
+stats_percentile (const MethodStats *stats,
+                  guint              percent)
+{
+        guint64 rank;
+        guint64 seen;
+        guint   i;
+
+        if (stats->calls == 0) {
+                return 0;
+        }
+
+        rank = ((guint64) stats->calls * percent + 99) / 100;
+        seen = 0;
+        for (i = 0; i < N_BUCKETS - 1; i++) {
+                seen += stats->buckets[i];
+                if (seen >= rank) {
+                        return MIN ((G_GUINT64_CONSTANT (1) << i), stats->max_usec);
+                }
+        }
+
+        return stats->max_usec;
+}
+
+static gint
+compare_method_names (gconstpointer a,
+                      gconstpointer b)
+{
+        return g_strcmp0 (*(const char **) a, *(const char **) b);
+}
+
+static gboolean
+dbus_get_method_statistics (ConsoleKitStatistics  *object,
+                            GDBusMethodInvocation *context)
+{
+        CkStatistics    *statistics = CK_STATISTICS (object);
+        GVariantBuilder  builder;
+        GPtrArray       *names;
+        GHashTableIter   iter;
+        gpointer         key;
+        guint            i;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(suuttt)"));
+
+        g_mutex_lock (&statistics->priv->data->lock);
+
+        names = g_ptr_array_sized_new (g_hash_table_size (statistics->priv->data->methods));
+        g_hash_table_iter_init (&iter, statistics->priv->data->methods);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                g_ptr_array_add (names, key);
+        }
+        g_ptr_array_sort (names, compare_method_names);
+
+        for (i = 0; i < names->len; i++) {
+                const char  *name = g_ptr_array_index (names, i);
+                MethodStats *stats = g_hash_table_lookup (statistics->priv->data->methods, name);
+
+                g_variant_builder_add (&builder, "(suuttt)",
+                                       name,
+                                       stats->calls,
+                                       stats->errors,
+                                       stats_percentile (stats, 50),
+                                       stats_percentile (stats, 99),
+                                       stats->max_usec);
+        }
+
+        g_mutex_unlock (&statistics->priv->data->lock);
+
+        g_ptr_array_free (names, TRUE);
+
+        console_kit_statistics_complete_get_method_statistics (object, context, g_variant_builder_end (&builder));
+        return TRUE;
+}
+
+static gboolean
+dbus_get_counters (ConsoleKitStatistics  *object,
+                   GDBusMethodInvocation *context)
+{
+        CkStatistics    *statistics = CK_STATISTICS (object);
+        GVariantBuilder  builder;
+        guint            pending;
+        guint            untracked;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+        if (statistics->priv->counters_func != NULL) {
+                statistics->priv->counters_func (statistics, &builder, statistics->priv->counters_data);
+        }
+
+        g_mutex_lock (&statistics->priv->data->lock);
+        /* less one for this call */
+        pending = MAX (g_hash_table_size (statistics->priv->data->pending), 1) - 1;
+        untracked = statistics->priv->data->untracked;
+        g_mutex_unlock (&statistics->priv->data->lock);
+
+        g_variant_builder_add (&builder, "{sv}", "pending-method-calls", g_variant_new_uint32 (pending));
+        g_variant_builder_add (&builder, "{sv}", "untracked-method-calls", g_variant_new_uint32 (untracked));
+
+        console_kit_statistics_complete_get_counters (object, context, g_variant_builder_end (&builder));
+        return TRUE;
+}
+
+static gboolean
+dbus_reset_method_statistics (ConsoleKitStatistics  *object,
+                              GDBusMethodInvocation *context)
+{
+        CkStatistics *statistics = CK_STATISTICS (object);
+
+        g_debug ("resetting method statistics");
+
+        g_mutex_lock (&statistics->priv->data->lock);
+        g_hash_table_remove_all (statistics->priv->data->methods);
+        statistics->priv->data->untracked = 0;
+        g_mutex_unlock (&statistics->priv->data->lock);
+
+        console_kit_statistics_complete_reset_method_statistics (object, context);
+        return TRUE;
+}
+
+static void
+ck_statistics_class_init (CkStatisticsClass *klass)
+{
+        GObjectClass   *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = ck_statistics_finalize;
+
+        g_type_class_add_private (klass, sizeof (CkStatisticsPrivate));
+}
+
+static void
+ck_statistics_init (CkStatistics *statistics)
+{
+        statistics->priv = CK_STATISTICS_GET_PRIVATE (statistics);
+
+        statistics->priv->data = filter_data_new ();
+}
+
+static void
+ck_statistics_iface_init (ConsoleKitStatisticsIface *iface)
+{
+        iface->handle_get_method_statistics   = dbus_get_method_statistics;
+        iface->handle_get_counters            = dbus_get_counters;
+        iface->handle_reset_method_statistics = dbus_reset_method_statistics;
+}
+
+static void
+ck_statistics_finalize (GObject *object)
+{
+        CkStatistics *statistics;
+
+        g_return_if_fail (CK_IS_STATISTICS (object));
+
+        statistics = CK_STATISTICS (object);
+
+        if (statistics->priv->filter_id != 0) {
+                g_dbus_connection_remove_filter (statistics->priv->connection, statistics->priv->filter_id);
+                g_object_unref (statistics->priv->connection);
+        }
+
+        filter_data_unref (statistics->priv->data);
+
+        G_OBJECT_CLASS (ck_statistics_parent_class)->finalize (object);
+}
+
+CkStatistics *
+ck_statistics_new (void)
+{
+        return CK_STATISTICS (g_object_new (CK_TYPE_STATISTICS, NULL));
+}
+
+/**
+ * ck_statistics_register:
+ * @statistics: a #CkStatistics
+ * @connection: the connection the manager is exported on
+ * @path: the object path to export the interface on
+ * @error: (out) (allow-none): return location for error or %NULL
+ *
+ * Exports the Statistics interface and starts timing the method calls
+ * arriving on @connection. This should be done before any other
+ * message filter is added to @connection, or the calls that filter
+ * answers itself won't be counted.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+ck_statistics_register (CkStatistics     *statistics,
+                        GDBusConnection  *connection,
+                        const char       *path,
+                        GError          **error)
+{
+        g_return_val_if_fail (CK_IS_STATISTICS (statistics), FALSE);
+        g_return_val_if_fail (statistics->priv->filter_id == 0, FALSE);
+
+        if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (statistics),
+                                               connection,
+                                               path,
+                                               error)) {
+                return FALSE;
+        }
+
+        statistics->priv->connection = g_object_ref (connection);
+        statistics->priv->filter_id = g_dbus_connection_add_filter (connection,
+                                                                    statistics_filter,
+                                                                    filter_data_ref (statistics->priv->data),
+                                                                    (GDestroyNotify) filter_data_unref);
+
+        return TRUE;
+}
+
+/**
+ * ck_statistics_set_counters_func:
+ * @statistics: a #CkStatistics
+ * @func: (allow-none): called to fill in the reply to GetCounters
+ * @user_data: data to pass to @func
+ **/
+void
+ck_statistics_set_counters_func (CkStatistics             *statistics,
+                                 CkStatisticsCountersFunc  func,
+                                 gpointer                  user_data)
+{
+        g_return_if_fail (CK_IS_STATISTICS (statistics));
+
+        statistics->priv->counters_func = func;
+        statistics->priv->counters_data = user_data;
+}
@@ -0,0 +1,79 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CK_STATISTICS_H_
+#define __CK_STATISTICS_H_
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "ck-statistics-generated.h"
+
+#define CK_TYPE_STATISTICS           (ck_statistics_get_type ())
+#define CK_STATISTICS(o)             (G_TYPE_CHECK_INSTANCE_CAST ((o), CK_TYPE_STATISTICS, CkStatistics))
+#define CK_STATISTICS_CLASS(k)       (G_TYPE_CHECK_CLASS_CAST((k), CK_TYPE_STATISTICS, CkStatisticsClass))
+#define CK_IS_STATISTICS(o)          (G_TYPE_CHECK_INSTANCE_TYPE ((o), CK_TYPE_STATISTICS))
+#define CK_IS_STATISTICS_CLASS(k)    (G_TYPE_CHECK_CLASS_TYPE ((k), CK_TYPE_STATISTICS))
+#define CK_STATISTICS_GET_CLASS(o)   (G_TYPE_INSTANCE_GET_CLASS ((o), CK_TYPE_STATISTICS, CkStatisticsClass))
+
+typedef struct CkStatisticsPrivate CkStatisticsPrivate;
+
+typedef struct
+{
+        ConsoleKitStatisticsSkeleton  parent;
+        CkStatisticsPrivate          *priv;
+} CkStatistics;
+
+typedef struct
+{
+        ConsoleKitStatisticsSkeletonClass parent_class;
+} CkStatisticsClass;
+
+/* Called on the main loop to add the current counters to @builder,
+ * an a{sv} builder.
+ */
+typedef void (* CkStatisticsCountersFunc) (CkStatistics    *statistics,
+                                           GVariantBuilder *builder,
+                                           gpointer         user_data);
+
+
+GType             ck_statistics_get_type                 (void);
+
+CkStatistics     *ck_statistics_new                      (void);
+
+gboolean          ck_statistics_register                 (CkStatistics             *statistics,
+                                                          GDBusConnection          *connection,
+                                                          const char               *path,
+                                                          GError                  **error);
+
+void              ck_statistics_set_counters_func        (CkStatistics             *statistics,
+                                                          CkStatisticsCountersFunc  func,
+                                                          gpointer                  user_data);
+
+#endif /* __CK_STATISTICS_H_ */
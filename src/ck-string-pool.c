@@ -0,0 +1,155 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Reference counted, shared copies of strings that a lot of objects
+ * hold the same value of: seat ids and paths, runtime dirs and the
+ * session attributes carried by log events. Unlike g_intern_string
+ * the copies are freed once the last holder releases them, so values
+ * like remote host names don't pile up over the daemon's lifetime.
+ *
+ * Log events are released on the event logger thread, hence the lock.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "ck-string-pool.h"
+
+typedef struct
+{
+        guint ref_count;
+        gsize len;
+        char  str[1];
+} PoolEntry;
+
+#define ENTRY_FROM_STRING(s) ((PoolEntry *) ((char *) (s) - G_STRUCT_OFFSET (PoolEntry, str)))
+
+static GMutex      pool_lock;
+static GHashTable *pool = NULL;   /* str -> PoolEntry */
+/* bytes of the pooled strings, once each and once per reference */
+static gsize       pool_bytes = 0;
+static gsize       pool_ref_bytes = 0;
+
+/**
+ * ck_string_pool_intern:
+ * @str: (allow-none): the string to share
+ *
+ * Returns: the pooled copy of @str, to be given back with
+ * ck_string_pool_release, or %NULL if @str is %NULL.
+ **/
+const char *
+ck_string_pool_intern (const char *str)
+{
+        PoolEntry *entry;
+        gsize      len;
+
+        if (str == NULL) {
+                return NULL;
+        }
+
+        g_mutex_lock (&pool_lock);
+
+        if (G_UNLIKELY (pool == NULL)) {
+                pool = g_hash_table_new (g_str_hash, g_str_equal);
+        }
+
+        entry = g_hash_table_lookup (pool, str);
+        if (entry == NULL) {
+                len = strlen (str);
+                entry = g_malloc (G_STRUCT_OFFSET (PoolEntry, str) + len + 1);
+                entry->ref_count = 0;
+                entry->len = len;
+                memcpy (entry->str, str, len + 1);
+
+                g_hash_table_insert (pool, entry->str, entry);
+                pool_bytes += len + 1;
+        }
+
+        entry->ref_count++;
+        pool_ref_bytes += entry->len + 1;
+
+        g_mutex_unlock (&pool_lock);
+
+        return entry->str;
+}
+
+/**
+ * ck_string_pool_release:
+ * @str: (allow-none): a string returned by ck_string_pool_intern
+ *
+ * Drops a reference to @str, freeing it when it was the last one.
+ **/
+void
+ck_string_pool_release (const char *str)
+{
+        PoolEntry *entry;
+
+        if (str == NULL) {
+                return;
+        }
+
+        entry = ENTRY_FROM_STRING (str);
+
+        g_mutex_lock (&pool_lock);
+
+        g_assert (entry->ref_count > 0);
+
+        pool_ref_bytes -= entry->len + 1;
+        if (--entry->ref_count == 0) {
+                g_hash_table_remove (pool, entry->str);
+                pool_bytes -= entry->len + 1;
+                g_free (entry);
+        }
+
+        g_mutex_unlock (&pool_lock);
+}
+
+/**
+ * ck_string_pool_get_stats:
+ * @entries: (out): the number of distinct strings in the pool
+ * @bytes: (out): the size of those strings
+ * @bytes_saved: (out): what separate copies for every holder would
+ *               have taken on top of that
+ **/
+void
+ck_string_pool_get_stats (guint *entries,
+                          gsize *bytes,
+                          gsize *bytes_saved)
+{
+        g_mutex_lock (&pool_lock);
+
+        *entries = pool != NULL ? g_hash_table_size (pool) : 0;
+        *bytes = pool_bytes;
+        *bytes_saved = pool_ref_bytes - pool_bytes;
+
+        g_mutex_unlock (&pool_lock);
+}
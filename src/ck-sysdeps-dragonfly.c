@@ -127,6 +127,14 @@ ck_process_stat_get_cmd (CkProcessStat *stat)
         return g_strdup (stat->cmd);
 }
 
+guint64
+ck_process_stat_get_start_time (CkProcessStat *stat)
+{
+        g_return_val_if_fail (stat != NULL, 0);
+
+        return stat->start_time;
+}
+
 char *
 ck_process_stat_get_tty (CkProcessStat *stat)
 {
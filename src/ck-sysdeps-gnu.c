@@ -93,6 +93,15 @@ ck_process_stat_get_cmd (CkProcessStat *stat)
         return g_strdup (proc_stat_args (stat->ps));
 }
 
+guint64
+ck_process_stat_get_start_time (CkProcessStat *stat)
+{
+        g_return_val_if_fail (stat != NULL, 0);
+
+        /* not collected here, callers treat 0 as unknown */
+        return 0;
+}
+
 char *
 ck_process_stat_get_tty (CkProcessStat *stat)
 {
@@ -307,6 +307,14 @@ ck_process_stat_get_cmd (CkProcessStat *stat)
         return g_strdup (stat->cmd);
 }
 
+guint64
+ck_process_stat_get_start_time (CkProcessStat *stat)
+{
+        g_return_val_if_fail (stat != NULL, 0);
+
+        return stat->start_time;
+}
+
 /* adapted from procps */
 char *
 ck_process_stat_get_tty (CkProcessStat *stat)
@@ -880,22 +888,28 @@ static gboolean
 linux_supports_sleep_state (const gchar *state)
 {
         gboolean ret = FALSE;
-        gchar *command;
+        gchar *contents = NULL;
+        gchar **states;
+        guint i;
         GError *error = NULL;
-        gint exit_status;
+        const gchar *filename = "/sys/power/state";
 
-        command = g_strdup_printf ("grep -q %s /sys/power/state", state);
-        g_debug ("executing command: %s", command);
-        ret = g_spawn_command_line_sync (command, NULL, NULL, &exit_status, &error);
-        if (!ret) {
-                g_debug ("failed to run script: %s", error->message);
+        if (!g_file_get_contents (filename, &contents, NULL, &error)) {
+                g_debug ("failed to open %s: %s", filename, error->message);
                 g_error_free (error);
-                goto out;
+                return FALSE;
         }
-        ret = (WIFEXITED(exit_status) && (WEXITSTATUS(exit_status) == EXIT_SUCCESS));
 
-out:
-        g_free (command);
+        states = g_strsplit_set (g_strstrip (contents), " \n", -1);
+        for (i = 0; states[i] != NULL; i++) {
+                if (g_strcmp0 (states[i], state) == 0) {
+                        ret = TRUE;
+                        break;
+                }
+        }
+
+        g_strfreev (states);
+        g_free (contents);
 
         return ret;
 }
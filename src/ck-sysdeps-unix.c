@@ -34,6 +34,10 @@
 #include <sys/ioctl.h>
 #include <pwd.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 #ifdef HAVE_LINUX_KD_H
 #include <linux/kd.h>
 #endif
@@ -363,6 +367,52 @@ ck_get_a_console_fd (void)
         return fd;
 }
 
+/* Returns a descriptor that polls readable once @pid has exited, or -1
+ * when the platform has no way to do that. On Linux this is a pidfd,
+ * which always refers to the process that was running when it was
+ * opened even if the pid is later reused.
+ */
+int
+ck_unix_pid_open_exit_fd (pid_t pid)
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+        int fd;
+
+        g_return_val_if_fail (pid > 1, -1);
+
+        fd = syscall (SYS_pidfd_open, pid, 0);
+        if (fd < 0) {
+                g_debug ("pidfd_open for %d failed: %s", pid, g_strerror (errno));
+                return -1;
+        }
+
+        /* pidfds are always close-on-exec */
+        return fd;
+#else
+        return -1;
+#endif
+}
+
+/* Returns a descriptor that polls with G_IO_PRI whenever a swap area is
+ * added or removed, or -1 when the platform can't tell us that.
+ */
+int
+ck_open_swap_monitor_fd (void)
+{
+#ifdef __linux__
+        int fd;
+
+        fd = open ("/proc/swaps", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                g_debug ("Unable to open /proc/swaps: %s", g_strerror (errno));
+        }
+
+        return fd;
+#else
+        return -1;
+#endif
+}
+
 gboolean
 ck_is_root_user (void)
 {
@@ -456,19 +506,65 @@ remove_rundir (guint uid, const gchar *dest)
         return TRUE;
 }
 
+/**
+ * ck_get_primary_gid:
+ * @uid: the user to look up
+ * @gid: returns the user's primary group
+ *
+ * Thread safe lookup of the primary group of @uid, unlike getpwuid
+ * this may be called from worker threads.
+ *
+ * Return value: TRUE if the user was found
+ **/
+gboolean
+ck_get_primary_gid (guint  uid,
+                    guint *gid)
+{
+        struct passwd  pwd;
+        struct passwd *pwent = NULL;
+        gchar         *buf;
+        glong          bufsize;
+        gint           res;
+
+        bufsize = sysconf (_SC_GETPW_R_SIZE_MAX);
+        if (bufsize <= 0) {
+                bufsize = 16384;
+        }
+
+        for (;;) {
+                buf = g_malloc (bufsize);
+                res = getpwuid_r (uid, &pwd, buf, bufsize, &pwent);
+                if (res != ERANGE) {
+                        break;
+                }
+
+                /* the entry didn't fit, try again with more room */
+                g_free (buf);
+                bufsize *= 2;
+        }
+
+        if (pwent == NULL) {
+                g_warning ("Unable to lookup UID %u: %s", uid,
+                           res != 0 ? g_strerror (res) : "no such user");
+                g_free (buf);
+                return FALSE;
+        }
+
+        *gid = pwent->pw_gid;
+        g_free (buf);
+
+        return TRUE;
+}
+
 gchar *
 ck_generate_runtime_dir_for_user (guint uid)
 {
         gchar        *dest;
-        struct passwd *pwent;
+        guint         gid;
 
         TRACE ();
 
-        errno = 0;
-        pwent = getpwuid (uid);
-        if (pwent == NULL) {
-                g_warning ("Unable to lookup UID: %s", g_strerror (errno));
-                errno = 0;
+        if (!ck_get_primary_gid (uid, &gid)) {
                 return NULL;
         }
 
@@ -492,10 +588,10 @@ ck_generate_runtime_dir_for_user (guint uid)
                 return NULL;
         }
 
-        g_debug ("setting uid %d, gid %d", uid, pwent->pw_gid);
+        g_debug ("setting uid %d, gid %d", uid, gid);
 
         /* assign ownership to the user */
-        if (chown (dest, uid, pwent->pw_gid) != 0) {
+        if (chown (dest, uid, gid) != 0) {
                 g_warning ("Failed to chown XDG_RUNTIME_DIR, reason was: %s", strerror(errno));
                 errno = 0;
                 g_free (dest);
@@ -503,7 +599,7 @@ ck_generate_runtime_dir_for_user (guint uid)
         }
 
         /* attempt to make it a small tmpfs location */
-        ck_make_tmpfs (uid, pwent->pw_gid, dest);
+        ck_make_tmpfs (uid, gid, dest);
 
         return dest;
 }
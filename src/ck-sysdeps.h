@@ -25,6 +25,8 @@
 
 #include <glib.h>
 
+#include "ck-watchdog.h"
+
 G_BEGIN_DECLS
 
 typedef struct _CkProcessStat CkProcessStat;
@@ -38,6 +40,7 @@ gboolean     ck_process_stat_new_for_unix_pid (pid_t           pid,
 pid_t        ck_process_stat_get_ppid         (CkProcessStat  *stat);
 char        *ck_process_stat_get_tty          (CkProcessStat  *stat);
 char        *ck_process_stat_get_cmd          (CkProcessStat  *stat);
+guint64      ck_process_stat_get_start_time   (CkProcessStat  *stat);
 void         ck_process_stat_free             (CkProcessStat  *stat);
 
 
@@ -50,6 +53,7 @@ pid_t        ck_unix_pid_get_ppid             (pid_t           pid);
 uid_t        ck_unix_pid_get_uid              (pid_t           pid);
 gboolean     ck_unix_pid_get_login_session_id (pid_t           pid,
                                                char          **id);
+int          ck_unix_pid_open_exit_fd         (pid_t           pid);
 
 
 gboolean     ck_get_socket_peer_credentials   (int             socket_fd,
@@ -66,6 +70,9 @@ int          ck_open_a_console                (char *fnam);
 
 gboolean     ck_is_root_user                  (void);
 
+gboolean     ck_get_primary_gid               (guint           uid,
+                                               guint          *gid);
+
 gchar *      ck_generate_runtime_dir_for_user (guint           uid);
 
 gboolean     ck_remove_runtime_dir_for_user   (guint           uid);
@@ -92,6 +99,7 @@ gboolean     ck_wait_for_active_console_num   (int             console_fd,
 gboolean     ck_system_can_suspend            (void);
 gboolean     ck_system_can_hibernate          (void);
 gboolean     ck_system_can_hybrid_sleep       (void);
+int          ck_open_swap_monitor_fd          (void);
 
 
 #ifdef HAVE_SYS_VT_SIGNAL
@@ -101,9 +109,6 @@ gboolean     ck_wait_for_console_switch       (gint            sys_fd,
 #endif /* HAVE_SYS_VT_SIGNAL */
 
 
-/* compiling with --enable-debug=full enables TRACE messages */
-#if defined(CONSOLEKIT_DEBUGGING)
-
 #if defined(__NetBSD__) || (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
 #define __DBG_FUNC__    __func__
 #elif defined(__GNUC__) && __GNUC__ >= 3
@@ -114,23 +119,29 @@ gboolean     ck_wait_for_console_switch       (gint            sys_fd,
 #define __DBG_FUNC__    "??"
 #endif
 
+/* TRACE points go to the main loop watchdog's flight recorder while it
+ * runs, compiling with --enable-debug=full also logs them */
+#if defined(CONSOLEKIT_DEBUGGING)
+
 #if defined(G_HAVE_ISO_VARARGS)
 
 #define TRACE(...)              G_STMT_START{                                \
     g_debug ("TRACE[%s:%d] %s(): entering",__FILE__,__LINE__,__DBG_FUNC__);  \
+    CK_WATCHDOG_TRACE (__FILE__, __LINE__, __DBG_FUNC__);                    \
 }G_STMT_END
 
 #elif defined (G_HAVE_GNUC_VARARGS)
 
 #define TRACE(fmt, args...)     G_STMT_START{                                \
     g_debug ("TRACE[%s:%d] %s(): entering",__FILE__,__LINE__,__DBG_FUNC__);  \
+    CK_WATCHDOG_TRACE (__FILE__, __LINE__, __DBG_FUNC__);                    \
 }G_STMT_END
 
 #endif
 
 #else /* !defined(CONSOLEKIT_DEBUGGING) */
 
-#define TRACE(...) G_STMT_START{ (void)0; }G_STMT_END
+#define TRACE(...) CK_WATCHDOG_TRACE (__FILE__, __LINE__, __DBG_FUNC__)
 
 #endif
 
@@ -53,6 +53,8 @@ struct CkVtMonitorPrivate
         int              vfd;
         GHashTable      *vt_thread_hash;
         guint            active_num;
+        /* monotonic time the kernel reported the last change */
+        gint64           active_changed_time;
 
         GAsyncQueue     *event_queue;
         guint            process_queue_id;
@@ -158,6 +160,22 @@ ck_vt_monitor_get_active (CkVtMonitor    *vt_monitor,
         return TRUE;
 }
 
+/**
+ * ck_vt_monitor_get_active_changed_time:
+ * @vt_monitor: a #CkVtMonitor
+ *
+ * Returns: the monotonic time, in microseconds, at which the kernel
+ * reported the change to the current active VT, or 0 if it hasn't
+ * changed since the monitor was created.
+ */
+gint64
+ck_vt_monitor_get_active_changed_time (CkVtMonitor *vt_monitor)
+{
+        g_return_val_if_fail (CK_IS_VT_MONITOR (vt_monitor), 0);
+
+        return vt_monitor->priv->active_changed_time;
+}
+
 #if defined (__sun) && defined (HAVE_SYS_VT_H)
 static void
 handle_vt_active (void)
@@ -188,6 +206,7 @@ handle_vt_active (void)
                 g_debug ("Changing active VT: %d", num);
 
                 vt_monitor->priv->active_num = num;
+                vt_monitor->priv->active_changed_time = g_get_monotonic_time ();
 
                 g_signal_emit (vt_monitor, signals [ACTIVE_CHANGED], 0, num);
         } else {
@@ -198,13 +217,15 @@ handle_vt_active (void)
 
 static void
 change_active_num (CkVtMonitor *vt_monitor,
-                   guint        num)
+                   guint        num,
+                   gint64       time)
 {
 
         if (vt_monitor->priv->active_num != num) {
                 g_debug ("Changing active VT: %d", num);
 
                 vt_monitor->priv->active_num = num;
+                vt_monitor->priv->active_changed_time = time;
 
                 /* add a watch to every vt without a thread */
                 vt_add_watches (vt_monitor);
@@ -222,6 +243,8 @@ typedef struct {
 
 typedef struct {
         gint32       num;
+        /* when the vt thread woke up for it */
+        gint64       time;
 } EventData;
 
 static void
@@ -280,7 +303,7 @@ process_queue (CkVtMonitor *vt_monitor)
         G_UNLOCK (hash_lock);
 
         if (data != NULL) {
-                change_active_num (vt_monitor, data->num);
+                change_active_num (vt_monitor, data->num, data->time);
                 event_data_free (data);
         }
 
@@ -329,6 +352,7 @@ vt_thread_start (ThreadData *data)
                         /* add event to queue */
                         event = g_new0 (EventData, 1);
                         event->num = num;
+                        event->time = g_get_monotonic_time ();
                         g_debug ("Pushing activation event for VT %d onto queue", num);
 
                         g_async_queue_push (vt_monitor->priv->event_queue, event);
@@ -350,6 +374,7 @@ vt_thread_start (ThreadData *data)
                 /* add event to queue */
                 event = g_new0 (EventData, 1);
                 event->num = num;
+                event->time = g_get_monotonic_time ();
                 g_debug ("Pushing activation event for VT %d onto queue", num);
 
                 g_async_queue_push (vt_monitor->priv->event_queue, event);
@@ -67,6 +67,7 @@ gboolean            ck_vt_monitor_set_active          (CkVtMonitor    *vt_monito
 gboolean            ck_vt_monitor_get_active          (CkVtMonitor    *vt_monitor,
                                                        guint32        *num,
                                                        GError        **error);
+gint64              ck_vt_monitor_get_active_changed_time (CkVtMonitor *vt_monitor);
 
 G_END_DECLS
 
@@ -0,0 +1,453 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Watches the main loop for iterations that take too long.
+ *
+ * The main context's poll function is wrapped so we know when an
+ * iteration starts (poll returned) and when it ends (poll is entered
+ * again). Polls made by a nested iteration, like the one ck_run_programs
+ * runs while it waits, are part of the handler that started it. A
+ * separate thread sleeps until an iteration has been running for longer
+ * than the threshold, then writes out a flight recorder: the last few
+ * hundred TRACE points hit, on any thread, ending with whatever the
+ * main loop was doing when it got stuck. The main loop itself logs how
+ * long the stall was once it gets going again.
+ *
+ * Trace points don't take the lock, each one claims a slot in the ring
+ * with an atomic increment. Nothing here wakes up while the main loop
+ * is idle.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "ck-watchdog.h"
+
+#define FLIGHT_RECORDER_DIR  RUNDIR "/ConsoleKit"
+#define FLIGHT_RECORDER_FILE FLIGHT_RECORDER_DIR "/flight-recorder"
+
+#define N_TRACE_EVENTS 256
+
+typedef struct
+{
+        /* number of the trace point plus one, 0 while it is written */
+        gint        seq;
+        gint64      time;
+        const char *file;
+        const char *func;
+        int         line;
+        gboolean    main_thread;
+} TraceEvent;
+
+typedef struct
+{
+        GMutex        lock;
+        GCond         cond;
+        GThread      *thread;
+        GThread      *main_thread;
+        GMainContext *context;
+        GPollFunc     poll_func;
+        gint64        threshold_usec;
+
+        /* the iteration in progress, if busy */
+        gboolean      busy;
+        gint64        busy_since;
+        guint         iteration;
+        guint         reported_iteration;
+
+        /* written without the lock, see ck_watchdog_trace */
+        TraceEvent    events[N_TRACE_EVENTS];
+        gint          n_traced;
+        /* seq of the last trace point the main loop hit during this
+         * iteration, 0 if none */
+        gint          main_seq;
+
+        guint         stalls;
+        gint64        max_stall_usec;
+} Watchdog;
+
+/* zero-initialized, which is all a static GMutex and GCond need */
+static Watchdog watchdog;
+
+gint ck_watchdog_tracing = 0;
+
+/* Copies trace point @seq out of the ring, FALSE if it was
+ * overwritten or is still being written */
+static gboolean
+copy_trace_event (guint       seq,
+                  TraceEvent *copy)
+{
+        const TraceEvent *event;
+
+        if (seq == 0) {
+                return FALSE;
+        }
+
+        event = &watchdog.events[(seq - 1) % N_TRACE_EVENTS];
+        if ((guint) g_atomic_int_get (&event->seq) != seq) {
+                return FALSE;
+        }
+
+        *copy = *event;
+
+        return (guint) g_atomic_int_get (&event->seq) == seq;
+}
+
+static const char *
+location_func (const char *func)
+{
+        return func != NULL ? func : "(no trace point)";
+}
+
+/* Called with the lock held */
+static char *
+format_flight_recorder (gint64 now)
+{
+        GString   *str;
+        TraceEvent last;
+        guint      n_traced;
+        guint      i;
+
+        str = g_string_new (NULL);
+
+        if (!copy_trace_event ((guint) g_atomic_int_get (&watchdog.main_seq), &last)) {
+                last.file = NULL;
+                last.func = NULL;
+                last.line = 0;
+        }
+
+        g_string_append_printf (str,
+                                "main loop iteration %u has been running for %" G_GINT64_FORMAT " ms (threshold %" G_GINT64_FORMAT " ms)\n",
+                                watchdog.iteration,
+                                (now - watchdog.busy_since) / 1000,
+                                watchdog.threshold_usec / 1000);
+        g_string_append_printf (str,
+                                "last trace point on the main loop: %s (%s:%d)\n\n",
+                                location_func (last.func),
+                                last.file != NULL ? last.file : "",
+                                last.line);
+
+        g_string_append (str, "recent trace points, oldest first, in ms before the dump:\n");
+
+        n_traced = (guint) g_atomic_int_get (&watchdog.n_traced);
+        for (i = MIN (n_traced, N_TRACE_EVENTS); i > 0; i--) {
+                TraceEvent event;
+
+                if (!copy_trace_event (n_traced - i + 1, &event)) {
+                        continue;
+                }
+
+                g_string_append_printf (str,
+                                        "%10.3f %-6s %s (%s:%d)%s\n",
+                                        (double) (now - event.time) / 1000.0,
+                                        event.main_thread ? "main" : "thread",
+                                        event.func,
+                                        event.file,
+                                        event.line,
+                                        event.main_thread && event.time >= watchdog.busy_since ? " *" : "");
+        }
+
+        return g_string_free (str, FALSE);
+}
+
+static void
+write_flight_recorder (const char *contents)
+{
+        GError *error = NULL;
+
+        if (g_mkdir_with_parents (FLIGHT_RECORDER_DIR, 0755) != 0) {
+                g_warning ("Unable to create directory %s", FLIGHT_RECORDER_DIR);
+                return;
+        }
+
+        if (!g_file_set_contents (FLIGHT_RECORDER_FILE, contents, -1, &error)) {
+                g_warning ("Unable to write flight recorder: %s", error->message);
+                g_error_free (error);
+        }
+}
+
+static gpointer
+watchdog_thread (gpointer data)
+{
+        g_mutex_lock (&watchdog.lock);
+
+        while (g_atomic_int_get (&ck_watchdog_tracing)) {
+                gint64     deadline;
+                char      *contents;
+                char      *func;
+                TraceEvent last;
+
+                if (!watchdog.busy || watchdog.reported_iteration == watchdog.iteration) {
+                        g_cond_wait (&watchdog.cond, &watchdog.lock);
+                        continue;
+                }
+
+                deadline = watchdog.busy_since + watchdog.threshold_usec;
+                if (g_get_monotonic_time () < deadline) {
+                        g_cond_wait_until (&watchdog.cond, &watchdog.lock, deadline);
+                        continue;
+                }
+
+                watchdog.reported_iteration = watchdog.iteration;
+                contents = format_flight_recorder (g_get_monotonic_time ());
+                func = g_strdup (location_func (copy_trace_event ((guint) g_atomic_int_get (&watchdog.main_seq), &last) ? last.func : NULL));
+
+                /* don't hold up the trace points while doing I/O */
+                g_mutex_unlock (&watchdog.lock);
+
+                g_warning ("Main loop blocked for more than %" G_GINT64_FORMAT " ms, last in %s; see %s",
+                           watchdog.threshold_usec / 1000,
+                           func,
+                           FLIGHT_RECORDER_FILE);
+                write_flight_recorder (contents);
+
+                g_free (contents);
+                g_free (func);
+
+                g_mutex_lock (&watchdog.lock);
+        }
+
+        g_mutex_unlock (&watchdog.lock);
+
+        return NULL;
+}
+
+static void
+iteration_begin (void)
+{
+        g_mutex_lock (&watchdog.lock);
+
+        watchdog.busy = TRUE;
+        watchdog.busy_since = g_get_monotonic_time ();
+        watchdog.iteration++;
+        g_atomic_int_set (&watchdog.main_seq, 0);
+        g_cond_signal (&watchdog.cond);
+
+        g_mutex_unlock (&watchdog.lock);
+}
+
+static void
+iteration_end (void)
+{
+        TraceEvent  last;
+        const char *file = NULL;
+        const char *func = NULL;
+        int         line = 0;
+        gint64      usec = 0;
+
+        g_mutex_lock (&watchdog.lock);
+
+        if (watchdog.busy) {
+                usec = g_get_monotonic_time () - watchdog.busy_since;
+                watchdog.busy = FALSE;
+
+                if (usec >= watchdog.threshold_usec) {
+                        watchdog.stalls++;
+                        watchdog.max_stall_usec = MAX (watchdog.max_stall_usec, usec);
+                        if (copy_trace_event ((guint) g_atomic_int_get (&watchdog.main_seq), &last)) {
+                                file = last.file;
+                                func = last.func;
+                                line = last.line;
+                        }
+                } else {
+                        usec = 0;
+                }
+        }
+
+        g_mutex_unlock (&watchdog.lock);
+
+        if (usec > 0) {
+                g_warning ("Main loop iteration took %" G_GINT64_FORMAT " ms, last in %s (%s:%d)",
+                           usec / 1000,
+                           location_func (func),
+                           file != NULL ? file : "",
+                           line);
+        }
+}
+
+static gint
+watchdog_poll (GPollFD *ufds,
+               guint    nfds,
+               gint     timeout)
+{
+        gint ret;
+
+        /* a handler running a nested iteration is still busy, keep
+         * timing it from where it started */
+        if (g_main_depth () > 0) {
+                return watchdog.poll_func (ufds, nfds, timeout);
+        }
+
+        iteration_end ();
+        ret = watchdog.poll_func (ufds, nfds, timeout);
+        iteration_begin ();
+
+        return ret;
+}
+
+/**
+ * ck_watchdog_start:
+ * @context: the main context to watch, %NULL for the default one
+ * @threshold: the shortest iteration to report, in ms; 0 disables
+ *   the watchdog
+ *
+ * Must be called from the thread that runs @context, before it is run.
+ *
+ * Return value: %TRUE if the watchdog was started.
+ **/
+gboolean
+ck_watchdog_start (GMainContext *context,
+                   guint         threshold)
+{
+        GError *error = NULL;
+
+        g_return_val_if_fail (!ck_watchdog_tracing, FALSE);
+
+        if (threshold == 0) {
+                g_debug ("main loop watchdog disabled");
+                return FALSE;
+        }
+
+        if (context == NULL) {
+                context = g_main_context_default ();
+        }
+
+        watchdog.context = g_main_context_ref (context);
+        watchdog.main_thread = g_thread_self ();
+        watchdog.threshold_usec = (gint64) threshold * 1000;
+        g_atomic_int_set (&ck_watchdog_tracing, TRUE);
+
+        watchdog.thread = g_thread_try_new ("ck-watchdog", watchdog_thread, NULL, &error);
+        if (watchdog.thread == NULL) {
+                g_warning ("Unable to start the main loop watchdog: %s", error->message);
+                g_error_free (error);
+                g_atomic_int_set (&ck_watchdog_tracing, FALSE);
+                g_main_context_unref (watchdog.context);
+                watchdog.context = NULL;
+                return FALSE;
+        }
+
+        watchdog.poll_func = g_main_context_get_poll_func (context);
+        g_main_context_set_poll_func (context, watchdog_poll);
+
+        g_debug ("main loop watchdog started, threshold %u ms", threshold);
+
+        return TRUE;
+}
+
+void
+ck_watchdog_stop (void)
+{
+        if (!ck_watchdog_tracing) {
+                return;
+        }
+
+        g_main_context_set_poll_func (watchdog.context, watchdog.poll_func);
+
+        g_mutex_lock (&watchdog.lock);
+        g_atomic_int_set (&ck_watchdog_tracing, FALSE);
+        g_cond_signal (&watchdog.cond);
+        g_mutex_unlock (&watchdog.lock);
+
+        g_thread_join (watchdog.thread);
+        watchdog.thread = NULL;
+
+        g_main_context_unref (watchdog.context);
+        watchdog.context = NULL;
+}
+
+/**
+ * ck_watchdog_trace:
+ *
+ * Records a trace point in the flight recorder. Called by TRACE ()
+ * through CK_WATCHDOG_TRACE, only while the watchdog is running. Safe
+ * to call from any thread without taking a lock.
+ **/
+void
+ck_watchdog_trace (const char *file,
+                   int         line,
+                   const char *func)
+{
+        TraceEvent *event;
+        gboolean    main_thread;
+        guint       seq;
+
+        if (!g_atomic_int_get (&ck_watchdog_tracing)) {
+                return;
+        }
+
+        main_thread = (g_thread_self () == watchdog.main_thread);
+
+        seq = (guint) g_atomic_int_add (&watchdog.n_traced, 1) + 1;
+        event = &watchdog.events[(seq - 1) % N_TRACE_EVENTS];
+
+        /* readers skip the slot until it is filled in again */
+        g_atomic_int_set (&event->seq, 0);
+        event->time = g_get_monotonic_time ();
+        event->file = file;
+        event->func = func;
+        event->line = line;
+        event->main_thread = main_thread;
+        g_atomic_int_set (&event->seq, (gint) seq);
+
+        if (main_thread) {
+                g_atomic_int_set (&watchdog.main_seq, (gint) seq);
+        }
+}
+
+/**
+ * ck_watchdog_get_stats:
+ * @stalls: (out) (allow-none): iterations longer than the threshold
+ * @max_usec: (out) (allow-none): the longest of those
+ **/
+void
+ck_watchdog_get_stats (guint  *stalls,
+                       gint64 *max_usec)
+{
+        guint  n = 0;
+        gint64 max = 0;
+
+        if (g_atomic_int_get (&ck_watchdog_tracing)) {
+                g_mutex_lock (&watchdog.lock);
+                n = watchdog.stalls;
+                max = watchdog.max_stall_usec;
+                g_mutex_unlock (&watchdog.lock);
+        }
+
+        if (stalls != NULL) {
+                *stalls = n;
+        }
+        if (max_usec != NULL) {
+                *max_usec = max;
+        }
+}
@@ -0,0 +1,61 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (c) 2026, ConsoleKit2 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CK_WATCHDOG_H
+#define __CK_WATCHDOG_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Default length of a main loop iteration that counts as a stall, in ms */
+#define CK_WATCHDOG_DEFAULT_THRESHOLD 250
+
+gboolean  ck_watchdog_start     (GMainContext *context,
+                                 guint         threshold);
+void      ck_watchdog_stop      (void);
+
+void      ck_watchdog_trace     (const char   *file,
+                                 int           line,
+                                 const char   *func);
+
+/* Non-zero while the watchdog runs, only read through CK_WATCHDOG_TRACE */
+extern gint ck_watchdog_tracing;
+
+#define CK_WATCHDOG_TRACE(file, line, func)     G_STMT_START{           \
+    if (G_UNLIKELY (g_atomic_int_get (&ck_watchdog_tracing)))           \
+        ck_watchdog_trace ((file), (line), (func));                     \
+}G_STMT_END
+
+void      ck_watchdog_get_stats (guint        *stalls,
+                                 gint64       *max_usec);
+
+G_END_DECLS
+
+#endif /* __CK_WATCHDOG_H */
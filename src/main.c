@@ -39,12 +39,22 @@
 
 #include "ck-sysdeps.h"
 #include "ck-manager.h"
+#include "ck-session.h"
 #include "ck-log.h"
+#include "ck-watchdog.h"
 
 #define CK_DBUS_NAME "org.freedesktop.ConsoleKit"
 
 
 static GMainLoop *loop = NULL;
+/* -1 keeps the manager's default */
+static gint       database_interval = -1;
+static gint       sessions_changed_interval = -1;
+static gint       stall_threshold = CK_WATCHDOG_DEFAULT_THRESHOLD;
+static gint       max_opening = -1;
+static gint       inhibit_delay_max = -1;
+static gint       pause_timeout_min = CK_SESSION_DEFAULT_PAUSE_TIMEOUT_MIN;
+static gint       pause_timeout_max = CK_SESSION_DEFAULT_PAUSE_TIMEOUT_MAX;
 
 
 static gboolean
@@ -69,6 +79,23 @@ bus_acquired (GDBusConnection *connection,
 
         if (manager == NULL) {
                 g_critical ("Could not create CkManager");
+                return;
+        }
+
+        if (database_interval >= 0) {
+                ck_manager_set_dump_interval (manager, database_interval);
+        }
+
+        if (sessions_changed_interval >= 0) {
+                ck_manager_set_sessions_changed_interval (manager, sessions_changed_interval);
+        }
+
+        if (max_opening >= 0) {
+                ck_manager_set_max_opening (manager, max_opening);
+        }
+
+        if (inhibit_delay_max >= 0) {
+                ck_manager_set_inhibit_delay_max (manager, inhibit_delay_max);
         }
 }
 
@@ -230,6 +257,13 @@ main (int    argc,
                 { "debug", 0, 0, G_OPTION_ARG_NONE, &debug, N_("Enable debugging code"), NULL },
                 { "no-daemon", 0, 0, G_OPTION_ARG_NONE, &no_daemon, N_("Don't become a daemon"), NULL },
                 { "timed-exit", 0, 0, G_OPTION_ARG_NONE, &do_timed_exit, N_("Exit after a time - for debugging"), NULL },
+                { "database-interval", 0, 0, G_OPTION_ARG_INT, &database_interval, N_("Minimum time between writes of the state database, in milliseconds"), N_("MSEC") },
+                { "sessions-changed-interval", 0, 0, G_OPTION_ARG_INT, &sessions_changed_interval, N_("Minimum time between SessionsChanged signals, in milliseconds"), N_("MSEC") },
+                { "stall-threshold", 0, 0, G_OPTION_ARG_INT, &stall_threshold, N_("Report main loop iterations longer than this, in milliseconds, 0 to disable"), N_("MSEC") },
+                { "max-opening", 0, 0, G_OPTION_ARG_INT, &max_opening, N_("Maximum number of sessions opened at the same time, 0 for no limit"), N_("N") },
+                { "inhibit-delay-max-sec", 0, 0, G_OPTION_ARG_INT, &inhibit_delay_max, N_("Longest time delay inhibitors can hold up shutdown or sleep, in seconds"), N_("SEC") },
+                { "pause-timeout-min", 0, 0, G_OPTION_ARG_INT, &pause_timeout_min, N_("Shortest time a session controller gets to pause its devices, in milliseconds"), N_("MSEC") },
+                { "pause-timeout-max", 0, 0, G_OPTION_ARG_INT, &pause_timeout_max, N_("Longest time a session controller gets to pause its devices, in milliseconds"), N_("MSEC") },
                 { NULL }
         };
 
@@ -304,8 +338,13 @@ main (int    argc,
                 g_timeout_add (1000 * 30, (GSourceFunc) timed_exit_cb, loop);
         }
 
+        ck_watchdog_start (NULL, MAX (stall_threshold, 0));
+        ck_session_set_pause_timeout (MAX (pause_timeout_min, 0), MAX (pause_timeout_max, 0));
+
         g_main_loop_run (loop);
 
+        ck_watchdog_stop ();
+
         g_bus_unown_name (id);
 
         g_main_loop_unref (loop);
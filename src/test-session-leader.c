@@ -37,6 +37,7 @@
 #define SERVICE_NAME "test-session-leader"
 #define SESSION_ID "Session9999"
 #define COOKIE "test-session-leader-cookie"
+#define PERF_LOGINS 200
 
 CkSessionLeader *leader = NULL;
 
@@ -84,6 +85,103 @@ test_leader_collect (void)
         g_main_loop_run (loop);
 }
 
+typedef struct {
+        GVariant *result;
+        gboolean  done;
+} CollectSelfData;
+
+static void
+collect_self_cb (CkSessionLeader       *ckleader,
+                 GVariant              *parameters,
+                 GDBusMethodInvocation *context,
+                 CollectSelfData       *data)
+{
+        data->result = parameters != NULL ? g_variant_ref (parameters) : NULL;
+        data->done = TRUE;
+}
+
+static GVariant *
+collect_self (gboolean force_helper)
+{
+        CkSessionLeader *self;
+        CollectSelfData  data = { NULL, FALSE };
+
+        self = ck_session_leader_new ();
+        ck_session_leader_set_uid (self, getuid ());
+        ck_session_leader_set_pid (self, getpid ());
+        ck_session_leader_set_force_helper (self, force_helper);
+
+        g_assert (ck_session_leader_collect_parameters (self, NULL,
+                                                        (CkSessionLeaderDoneFunc)collect_self_cb, &data));
+
+        /* both paths reply from the main loop, a failed helper
+         * replies with NULL */
+        g_assert (!data.done);
+        while (!data.done) {
+                g_main_context_iteration (NULL, TRUE);
+        }
+
+        g_object_unref (self);
+
+        g_assert_nonnull (data.result);
+
+        return data.result;
+}
+
+static void
+test_leader_collect_self (void)
+{
+        GVariant *parameters;
+        gint32    unix_user;
+
+        parameters = collect_self (FALSE);
+
+        g_debug ("[test_leader_collect_self] Parameters: %s", g_variant_print (parameters, TRUE));
+        g_assert (g_variant_lookup (parameters, "unix-user", "i", &unix_user));
+
+        g_variant_unref (parameters);
+}
+
+static double
+perf_logins_per_sec (gboolean force_helper)
+{
+        gdouble elapsed;
+        int     i;
+
+        g_test_timer_start ();
+        for (i = 0; i < PERF_LOGINS; i++) {
+                g_variant_unref (collect_self (force_helper));
+        }
+        elapsed = g_test_timer_elapsed ();
+
+        return PERF_LOGINS / elapsed;
+}
+
+static void
+test_leader_perf_collect (void)
+{
+        gdouble helper;
+        gdouble in_process;
+
+        /* a leader with a DISPLAY always goes through the helper */
+        if (g_getenv ("DISPLAY") != NULL) {
+                g_test_skip ("DISPLAY is set");
+                return;
+        }
+
+        if (geteuid () != 0) {
+                g_test_skip ("the session info helper needs root");
+                return;
+        }
+
+        helper = perf_logins_per_sec (TRUE);
+        in_process = perf_logins_per_sec (FALSE);
+
+        g_print ("ck-collect-session-info: %.1f logins/sec\n", helper);
+        g_print ("in-process collector:    %.1f logins/sec\n", in_process);
+        g_test_maximized_result (in_process, "%.1f logins/sec", in_process);
+}
+
 static void
 test_leader_unref (void)
 {
@@ -107,6 +205,13 @@ main (int   argc,
         g_test_add_func ("/test_session_leader/test_leader_init", test_leader_init);
         g_test_add_func ("/test_session_leader/test_leader_collect", test_leader_collect);
         g_test_add_func ("/test_session_leader/test_leader_unref", test_leader_unref);
+        g_test_add_func ("/test_session_leader/test_leader_collect_self", test_leader_collect_self);
+
+        /* run with -m perf to compare forking the helper with the
+         * in-process collector */
+        if (g_test_perf ()) {
+                g_test_add_func ("/test_session_leader/test_leader_perf_collect", test_leader_perf_collect);
+        }
 
         return g_test_run();
 }